@@ -0,0 +1,50 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "vec3.h"
+
+typedef struct aabb_t aabb;
+
+/* Axis aligned bounding box */
+struct aabb_t
+{
+    vec3 min, max;
+};
+
+/**
+ * Sets a box to the empty box, which contains nothing and grows to fit
+ * whatever is merged into it
+ * @param box The box
+ */
+void empty_aabb(aabb *box);
+
+/**
+ * Grows a box so it also contains another box
+ * @param box The box being grown
+ * @param other The box to contain
+ */
+void merge_aabb(aabb *box, const aabb *other);
+
+/**
+ * Grows a box so it also contains a point
+ * @param box The box being grown
+ * @param p The point to contain
+ */
+void extend_aabb(aabb *box, const vec3 *p);
+
+/**
+ * Calculates the surface area of a box
+ * @param box The box
+ * @return The surface area, 0 for the empty box
+ */
+float aabb_surface_area(const aabb *box);
+
+/**
+ * Calculates the center of a box
+ * @param box The box
+ * @param center The vector receiving the center
+ */
+void aabb_center(const aabb *box, vec3 *center);
+
+#endif
+/* EOF */
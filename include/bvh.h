@@ -0,0 +1,139 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "aabb.h"
+#include "hitable.h"
+#include "ray.h"
+
+/* How the nodes of a bounding volume hierarchy are laid out */
+enum bvh_layout
+{
+    BVH_BINARY,     /* Two children per node, one box tested per step */
+    BVH_WIDE4,      /* Four children per node, tested with one SSE slab test */
+    BVH_WIDE8,      /* Eight children per node, tested with one AVX slab test
+                     * (two SSE tests when built without AVX) */
+    BVH_COMPRESSED8 /* Eight children per node with bounds quantized to 8 bits
+                     * in the parent box, about a third of the size */
+};
+
+typedef struct bvh_t bvh;
+
+/**
+ * Builds a bounding volume hierarchy over a set of primitives with a binned
+ * surface area heuristic. Wide layouts are made by collapsing the binary tree
+ * @param bounds The bounding box of every primitive
+ * @param count The number of primitives
+ * @param layout The node layout
+ * @return The new hierarchy, or NULL if it could not be allocated
+ */
+bvh *build_bvh(const aabb *bounds, int count, enum bvh_layout layout);
+
+/**
+ * Makes a deep copy of a hierarchy. The copy's memory is first written by the
+ * calling thread, which places it on that thread's NUMA node
+ * @param src The hierarchy
+ * @return The copy, or NULL if it could not be allocated
+ */
+bvh *copy_bvh(const bvh *src);
+
+/**
+ * Writes a hierarchy to a file in a form map_bvh can use in place. The file
+ * position must be a multiple of 64 bytes for the nodes to stay aligned
+ * @param b The hierarchy
+ * @param f The file
+ * @return 0 on success, -1 if the file could not be written
+ */
+int save_bvh(const bvh *b, FILE *f);
+
+/**
+ * Makes a hierarchy out of one written by save_bvh, without copying it. The
+ * memory must start on a 64 byte boundary and outlive the hierarchy. Every
+ * index in it is checked once, so a damaged file is refused instead of
+ * being traversed
+ * @param data The saved hierarchy, e.g. in a mapped file
+ * @param size The size of the memory
+ * @param num_prims The number of primitives the hierarchy must cover
+ * @return The hierarchy, or NULL if the memory does not hold a whole, valid
+ *         saved hierarchy over num_prims primitives or something could not
+ *         be allocated
+ */
+bvh *map_bvh(const void *data, size_t size, int num_prims);
+
+/**
+ * Deletes a hierarchy. A mapped hierarchy leaves its memory alone
+ * @param b The hierarchy
+ */
+void delete_bvh(bvh *b);
+
+/**
+ * Finds the closest primitive a ray hits. Children are visited nearest first
+ * so farther subtrees are usually culled by the closest hit so far
+ * @param b The hierarchy
+ * @param r The ray
+ * @param t_min The smallest ray parameter that counts as a hit
+ * @param t_max The largest ray parameter that counts as a hit
+ * @param hit Intersects the ray with one primitive
+ * @param data The primitive collection passed to hit
+ * @param rec The record receiving the closest hit
+ * @return Whether anything was hit
+ */
+bool bvh_closest_hit(const bvh *b, const ray *r, float t_min, float t_max,
+                     prim_hit_fn hit, const void *data, hit_record *rec);
+
+/**
+ * Checks whether a ray hits any primitive. Traversal ends at the first hit
+ * found and children are not sorted, which makes this cheaper than a closest
+ * hit query for shadow rays
+ * @param b The hierarchy
+ * @param r The ray
+ * @param t_min The smallest ray parameter that counts as a hit
+ * @param t_max The largest ray parameter that counts as a hit
+ * @param hit Intersects the ray with one primitive
+ * @param data The primitive collection passed to hit
+ * @return Whether anything was hit
+ */
+bool bvh_any_hit(const bvh *b, const ray *r, float t_min, float t_max,
+                 prim_hit_fn hit, const void *data);
+
+/**
+ * Gets the layout of a hierarchy
+ * @param b The hierarchy
+ * @return The layout
+ */
+enum bvh_layout bvh_get_layout(const bvh *b);
+
+/**
+ * Gets the number of nodes in a hierarchy
+ * @param b The hierarchy
+ * @return The node count
+ */
+int bvh_node_count(const bvh *b);
+
+/**
+ * Gets the memory used by the nodes and primitive indices of a hierarchy
+ * @param b The hierarchy
+ * @return The size in bytes
+ */
+size_t bvh_size_bytes(const bvh *b);
+
+/**
+ * Gets the name of a layout, as accepted by parse_bvh_layout
+ * @param layout The layout
+ * @return The name
+ */
+const char *bvh_layout_name(enum bvh_layout layout);
+
+/**
+ * Parses a layout name: "binary", "bvh4", "bvh8" or "cbvh8"
+ * @param name The name
+ * @param layout The layout receiving the result
+ * @return 0 on success, -1 if the name is unknown
+ */
+int parse_bvh_layout(const char *name, enum bvh_layout *layout);
+
+#endif
+/* EOF */
@@ -0,0 +1,65 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+
+#include "framebuffer.h"
+
+/*
+ * Checkpoint file layout, all values in host byte order:
+ *   char     magic[8]      "RTWCKPT"
+ *   uint32_t version
+ *   uint32_t nx, ny
+ *   uint32_t sampler       enum sampler_type
+ *   uint64_t seed
+ *   uint64_t options       hash of the scene options
+ *   float    accum[nx * ny * 3]
+ *   uint32_t samples[nx * ny]
+ */
+
+typedef struct checkpoint_writer_t checkpoint_writer;
+
+/**
+ * Writes the framebuffer to a checkpoint file. The data goes to a temporary
+ * file first which is then renamed over the target, so a crash part way
+ * through never leaves a truncated checkpoint behind
+ * @param fb The framebuffer
+ * @param filename The checkpoint file
+ * @return 0 on success, -1 on failure with errno set
+ */
+int save_checkpoint(const framebuffer *fb, const char *filename);
+
+/**
+ * Reads a framebuffer back from a checkpoint file
+ * @param filename The checkpoint file
+ * @return The restored framebuffer, or NULL if the file is missing, invalid or
+ *         not the size its header says
+ */
+framebuffer *load_checkpoint(const char *filename);
+
+/**
+ * Creates a writer that saves checkpoints on a background thread
+ * @param filename The checkpoint file
+ * @return The new writer, or NULL if it could not be allocated
+ */
+checkpoint_writer *create_checkpoint_writer(const char *filename);
+
+/**
+ * Snapshots the framebuffer and saves it in the background. The only work done
+ * on the calling thread is copying the buffers
+ * @param w The writer
+ * @param fb The framebuffer
+ * @return false if the previous checkpoint is still being written, in which
+ *         case nothing is done
+ */
+bool request_checkpoint(checkpoint_writer *w, const framebuffer *fb);
+
+/**
+ * Waits for any checkpoint in flight and deletes the writer
+ * @param w The writer
+ * @return 0 if every background save succeeded, -1 otherwise
+ */
+int delete_checkpoint_writer(checkpoint_writer *w);
+
+#endif
+/* EOF */
@@ -0,0 +1,80 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdint.h>
+
+#include "sampler.h"
+#include "vec3.h"
+
+typedef struct framebuffer_t framebuffer;
+
+/**
+ * Progressive render state. Pixel (i, j) lives at index j * nx + i, with j = 0
+ * being the bottom row like in the chapter programs. Samples are a pure
+ * function of the seed, the sampler and the sample index, so the sample counts
+ * are all the random state a render has
+ */
+struct framebuffer_t
+{
+    int nx, ny;
+    uint64_t seed;
+    enum sampler_type sampler;  /* Pattern the samples were drawn with */
+    uint64_t options;   /* Hash of the scene options the samples depend on */
+    float *accum;       /* Running rgb sums, 3 floats per pixel */
+    uint32_t *samples;  /* Number of samples taken per pixel */
+};
+
+/**
+ * Creates a framebuffer with no samples in it
+ * @param nx The width in pixels
+ * @param ny The height in pixels
+ * @param seed The seed the samples are derived from
+ * @param type The sample pattern
+ * @return The new framebuffer, or NULL if it could not be allocated
+ */
+framebuffer *create_framebuffer(int nx, int ny, uint64_t seed,
+                                enum sampler_type type);
+
+/**
+ * Deletes a framebuffer and all of its buffers
+ * @param fb The framebuffer
+ */
+void delete_framebuffer(framebuffer *fb);
+
+/**
+ * Adds one sample to a pixel
+ * @param fb The framebuffer
+ * @param i The column
+ * @param j The row, counted from the bottom
+ * @param col The sample color
+ */
+void add_sample(framebuffer *fb, int i, int j, const vec3 *col);
+
+/**
+ * Gets the average of all samples taken for a pixel
+ * @param fb The framebuffer
+ * @param i The column
+ * @param j The row, counted from the bottom
+ * @param col The vector receiving the average color
+ */
+void resolve_pixel(const framebuffer *fb, int i, int j, vec3 *col);
+
+/**
+ * Gets the number of samples taken for a pixel
+ * @param fb The framebuffer
+ * @param i The column
+ * @param j The row, counted from the bottom
+ * @return The sample count
+ */
+uint32_t pixel_samples(const framebuffer *fb, int i, int j);
+
+/**
+ * Writes the resolved, gamma corrected image as a plain ppm
+ * @param fb The framebuffer
+ * @param filename The output file
+ * @return 0 on success, -1 if the file could not be written
+ */
+int write_ppm(const framebuffer *fb, const char *filename);
+
+#endif
+/* EOF */
@@ -0,0 +1,136 @@
+#ifndef GROUP_H
+#define GROUP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hitable.h"
+#include "ray.h"
+#include "sphere.h"
+
+/* Groups a group context keeps pinned for lock free reuse */
+#define GROUP_FRONT_SIZE 8
+
+typedef struct group_cache_t group_cache;
+typedef struct group_t group;
+typedef struct group_context_t group_context;
+typedef struct group_stats_t group_stats;
+
+/* Counters describing how the cache behaved */
+struct group_stats_t
+{
+    size_t groups_opened;
+    size_t groups_loaded;   /* Including reloads after eviction */
+    size_t groups_evicted;
+    size_t groups_failed;   /* Could not be mapped, so rays missed them */
+    size_t bytes_used;
+    size_t bytes_peak;
+    size_t bytes_budget;
+};
+
+/**
+ * Writes spheres and a hierarchy over them to a group file. The file is laid
+ * out so it can be mapped and traced without being parsed or copied
+ * @param filename The file, replaced if it exists
+ * @param spheres The spheres. Their material indices refer to the scene the
+ *        group will be added to
+ * @param count The number of spheres
+ * @param layout The node layout of the hierarchy
+ * @return 0 on success, -1 if the file could not be written
+ */
+int write_group(const char *filename, const sphere *spheres, int count,
+                enum bvh_layout layout);
+
+/**
+ * Creates a cache for the geometry of groups, shared by all threads
+ * @param budget The number of bytes of mapped groups to stay under. Only
+ *        groups pinned by group contexts can push usage past it
+ * @return The new cache, or NULL if it could not be allocated
+ */
+group_cache *create_group_cache(size_t budget);
+
+/**
+ * Deletes a cache and every group opened through it. All contexts using the
+ * cache and all scenes holding its groups must be deleted first
+ * @param cache The cache
+ */
+void delete_group_cache(group_cache *cache);
+
+/**
+ * Opens a group file. Only the header is read, the spheres and hierarchy are
+ * mapped the first time a ray hits the group's bounds
+ * @param cache The cache
+ * @param filename The group file
+ * @return The group, or NULL if the file is missing or not a group file
+ */
+group *open_group(group_cache *cache, const char *filename);
+
+/**
+ * Gets the bounds of a group, known without loading it
+ * @param g The group
+ * @param box The box receiving the bounds
+ */
+void group_bounds(const group *g, aabb *box);
+
+/**
+ * Gets the length in world units that texture coordinates span on the
+ * spheres of a group, on average
+ * @param g The group
+ * @return The length
+ */
+float group_uv_scale(const group *g);
+
+/**
+ * Creates a per-thread context. Hits on the groups pinned in the context's
+ * small front cache take no locks, and a thread only waits on another one
+ * when both need the same group while it is being mapped
+ * @param cache The cache
+ * @return The new context, or NULL if it could not be allocated
+ */
+group_context *create_group_context(group_cache *cache);
+
+/**
+ * Releases the groups pinned by a context and deletes it
+ * @param ctx The context
+ */
+void delete_group_context(group_context *ctx);
+
+/**
+ * Finds the closest sphere of a group a ray hits, loading the group first if
+ * it is not in memory. A group whose file can not be mapped is counted in
+ * groups_failed and missed by every ray from then on
+ * @param ctx The calling thread's context
+ * @param g The group
+ * @param r The ray
+ * @param t_min The smallest ray parameter that counts as a hit
+ * @param t_max The largest ray parameter that counts as a hit
+ * @param rec The record receiving the closest hit
+ * @return Whether anything was hit
+ */
+bool hit_group(group_context *ctx, group *g, const ray *r, float t_min,
+               float t_max, hit_record *rec);
+
+/**
+ * Checks whether any sphere of a group blocks a ray, loading the group first
+ * if it is not in memory. A group that can not be mapped blocks nothing
+ * @param ctx The calling thread's context
+ * @param g The group
+ * @param r The ray
+ * @param t_min The smallest ray parameter that counts as a blocker
+ * @param t_max The largest ray parameter that counts as a blocker
+ * @return Whether the ray is blocked
+ */
+bool group_occluded(group_context *ctx, group *g, const ray *r, float t_min,
+                    float t_max);
+
+/**
+ * Gets a snapshot of the cache counters
+ * @param cache The cache
+ * @param stats The struct receiving the counters
+ */
+void get_group_stats(group_cache *cache, group_stats *stats);
+
+#endif
+/* EOF */
@@ -0,0 +1,36 @@
+#ifndef HITABLE_H
+#define HITABLE_H
+
+#include <stdbool.h>
+
+#include "ray.h"
+#include "vec3.h"
+
+typedef struct hit_record_t hit_record;
+
+/* Where and what a ray hit */
+struct hit_record_t
+{
+    float t;        /* Ray parameter of the hit */
+    vec3 p;         /* Hit point */
+    vec3 normal;    /* Unit surface normal, facing out of the object */
+    float u, v;     /* Texture coordinates */
+    int prim;       /* Index of the primitive that was hit */
+    int material;   /* Material index of the primitive */
+};
+
+/**
+ * Intersects a ray with one primitive of a collection
+ * @param data The primitive collection
+ * @param prim The primitive index
+ * @param r The ray
+ * @param t_min The smallest ray parameter that counts as a hit
+ * @param t_max The largest ray parameter that counts as a hit
+ * @param rec The record receiving the hit, only written on a hit
+ * @return Whether the ray hits the primitive within [t_min, t_max]
+ */
+typedef bool (*prim_hit_fn)(const void *data, int prim, const ray *r,
+                            float t_min, float t_max, hit_record *rec);
+
+#endif
+/* EOF */
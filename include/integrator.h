@@ -0,0 +1,126 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <stdbool.h>
+
+#include "photon.h"
+#include "radcache.h"
+#include "ray.h"
+#include "sampler.h"
+#include "scene.h"
+#include "texture.h"
+#include "vec3.h"
+
+typedef struct render_settings_t render_settings;
+typedef struct path_state_t path_state;
+
+/* Everything trace_path needs besides the ray. All of it is shared by all
+ * threads except the group context, which each thread sets to its own */
+struct render_settings_t
+{
+    const scene *world;
+    group_context *groups;  /* May be NULL if the world has no groups */
+    float pixel_spread;     /* Angle covered by one pixel, in radians */
+    int max_depth;          /* Most surface hits a path may have */
+    bool light_sampling;    /* Sample lights directly at every bounce */
+    bool sky;               /* Light the scene with the sky gradient */
+    radiance_cache *cache;  /* Ends paths at diffuse hits with the cached
+                             * light there, may be NULL */
+    int cache_depth;        /* The surface hit paths look up the cache at,
+                             * 1 for the hit after the first bounce */
+    const photon_map *photons;  /* Lights diffuse hits with the caustics
+                                 * in it, may be NULL */
+};
+
+/**
+ * A path in flight. Paths only depend on their own pixel, sample index and
+ * the sampler, so any number of them can be advanced in any order
+ */
+struct path_state_t
+{
+    vec3 o, d;              /* The ray the path continues along */
+    vec3 throughput;
+    vec3 radiance;          /* Light gathered so far */
+    vec3 prev_p;            /* Where the last bounce left from */
+    float cone_width, cone_spread;
+    float prev_pdf;         /* Density of the last bounce direction */
+    float time;             /* Every ray of the path sees the scene then */
+    uint32_t x, y, index;   /* Pixel and sample index */
+    int depth;
+    int cache_cell;         /* Cell the path feeds when it ends, or -1 */
+    vec3 cache_weight;      /* Throughput times albedo at that cell's hit */
+    vec3 cache_base;        /* Radiance gathered before that hit */
+    bool prev_diffuse;
+    bool after_diffuse;     /* Whether the last bounce off anything but
+                             * glass was off a diffuse surface */
+    bool active;            /* Whether the ray still has to be traced */
+};
+
+/**
+ * Sets up a path for a camera ray
+ * @param rs The render settings
+ * @param primary The camera ray
+ * @param x The pixel column
+ * @param y The pixel row
+ * @param index The sample index within the pixel
+ * @param path The path
+ */
+void start_path(const render_settings *rs, const ray *primary, uint32_t x,
+                uint32_t y, uint32_t index, path_state *path);
+
+/**
+ * Finds what the current ray of a path hits
+ * @param rs The render settings
+ * @param path The path, which must be active
+ * @param rec The record receiving the hit
+ * @return Whether anything was hit
+ */
+bool path_hit(const render_settings *rs, const path_state *path,
+              hit_record *rec);
+
+/**
+ * Advances a path past the hit of its current ray: gathers emission and
+ * direct light there and picks the next ray, or ends the path. With a
+ * radiance cache, a diffuse hit at the cache depth ends the path with the
+ * cached light if its cell has enough samples. Otherwise, and for a fraction
+ * of paths that keep training the cache, the light the rest of the path
+ * gathers is added to the cell once the path ends. With a photon map, diffuse
+ * hits add the caustics found in it, and lights seen through glass from a
+ * diffuse hit are left to the map
+ * @param rs The render settings
+ * @param smp The sampler for all random decisions of the path
+ * @param tex_ctx The calling thread's texture context
+ * @param path The path, which must be active
+ * @param rec What the ray hit, or NULL if it left the scene
+ */
+void extend_path(const render_settings *rs, const sampler *smp,
+                 texture_context *tex_ctx, path_state *path,
+                 const hit_record *rec);
+
+/**
+ * Estimates the radiance arriving along a camera ray with a path tracer. With
+ * light sampling on, every diffuse hit also sends a shadow ray to one light,
+ * and that estimate is combined with hitting lights by chance through multiple
+ * importance sampling (power heuristic)
+ * @param rs The render settings
+ * @param tex_ctx The calling thread's texture context
+ * @param primary The camera ray
+ * @param smp The sampler for all random decisions of the path
+ * @param x The pixel column
+ * @param y The pixel row
+ * @param index The sample index within the pixel
+ * @param radiance The vector receiving the estimate
+ */
+void trace_path(const render_settings *rs, texture_context *tex_ctx,
+                const ray *primary, const sampler *smp, uint32_t x,
+                uint32_t y, uint32_t index, vec3 *radiance);
+
+/**
+ * Gets the color of the sky gradient in a direction
+ * @param dir The direction, need not be unit length
+ * @param col The vector receiving the color
+ */
+void sky_color(const vec3 *dir, vec3 *col);
+
+#endif
+/* EOF */
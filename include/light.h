@@ -0,0 +1,90 @@
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#include <stdbool.h>
+
+#include "hitable.h"
+#include "vec3.h"
+
+typedef struct scene_t scene;
+typedef struct light_t light;
+typedef struct light_sample_t light_sample;
+typedef struct light_emission_t light_emission;
+
+enum light_type
+{
+    LIGHT_SPHERE,
+    LIGHT_QUAD
+};
+
+/* An emissive primitive of the scene */
+struct light_t
+{
+    enum light_type type;
+    int index;      /* Index into the scene spheres or quads */
+};
+
+/* A direction towards a light, picked by sample_light */
+struct light_sample_t
+{
+    vec3 wi;        /* Unit direction from the shaded point to the light */
+    float dist;     /* Distance to the light surface along wi */
+    float pdf;      /* Solid angle density of picking wi */
+    vec3 radiance;  /* Radiance leaving the light towards the point */
+};
+
+/* A ray leaving a light, picked by sample_emission */
+struct light_emission_t
+{
+    vec3 p;         /* Point on the light surface */
+    vec3 dir;       /* Unit direction the light leaves in */
+    vec3 power;     /* Flux the whole light emits, per channel */
+};
+
+/**
+ * Samples a direction towards a light. Spheres are sampled uniformly over the
+ * cone they subtend, quads uniformly over their area
+ * @param s The scene
+ * @param l The light
+ * @param p The shaded point
+ * @param time The time of the path, which places moving lights
+ * @param u1 The first uniform random number
+ * @param u2 The second uniform random number
+ * @param ls The sample receiving the result
+ * @return false if the light can not contribute to p
+ */
+bool sample_light(const scene *s, const light *l, const vec3 *p, float time,
+                  float u1, float u2, light_sample *ls);
+
+/**
+ * Gets the solid angle density with which sample_light would have picked the
+ * direction of a ray from p that hit the light
+ * @param s The scene
+ * @param l The light
+ * @param p The point the ray left from
+ * @param time The time of the ray
+ * @param rec The hit on the light
+ * @param dir The unit direction of the ray
+ * @return The density, 0 if sample_light can never pick the direction
+ */
+float light_pdf(const scene *s, const light *l, const vec3 *p, float time,
+                const hit_record *rec, const vec3 *dir);
+
+/**
+ * Samples a ray leaving a light: a point uniformly over its area and a
+ * cosine weighted direction about the surface normal there. Every ray then
+ * carries the same share of the light's flux
+ * @param s The scene
+ * @param l The light
+ * @param time The time, which places moving lights
+ * @param u1 The first uniform random number, for the point
+ * @param u2 The second uniform random number, for the point
+ * @param u3 The third uniform random number, for the direction
+ * @param u4 The fourth uniform random number, for the direction
+ * @param le The emission receiving the result
+ */
+void sample_emission(const scene *s, const light *l, float time, float u1,
+                     float u2, float u3, float u4, light_emission *le);
+
+#endif
+/* EOF */
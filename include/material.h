@@ -0,0 +1,60 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include "texture.h"
+#include "vec3.h"
+
+enum material_type
+{
+    MATERIAL_LAMBERTIAN,    /* Ideal diffuse reflector */
+    MATERIAL_LIGHT,         /* Diffuse emitter that reflects nothing */
+    MATERIAL_DIELECTRIC     /* Smooth glass that reflects and refracts */
+};
+
+typedef struct material_t material;
+
+struct material_t
+{
+    enum material_type type;
+    vec3 albedo;
+    vec3 emission;
+    texture *albedo_texture;    /* Replaces albedo when not NULL */
+    float ior;                  /* Index of refraction of a dielectric */
+};
+
+/**
+ * Sets up a diffuse material
+ * @param mat The material
+ * @param albedo The fraction of light reflected per channel
+ */
+void make_lambertian(material *mat, const vec3 *albedo);
+
+/**
+ * Sets up an emissive material
+ * @param mat The material
+ * @param emission The emitted radiance
+ */
+void make_light(material *mat, const vec3 *emission);
+
+/**
+ * Sets up a clear dielectric material
+ * @param mat The material
+ * @param ior The index of refraction, e.g. 1.5 for glass
+ */
+void make_dielectric(material *mat, float ior);
+
+/**
+ * Picks whether light is reflected or refracted by a dielectric, with the
+ * Schlick approximation of the Fresnel reflectance as the probability of
+ * reflecting. Total internal reflection always reflects
+ * @param mat The dielectric
+ * @param dir The unit direction of the incoming ray
+ * @param normal The unit outward normal of the surface
+ * @param u A uniform random number
+ * @param wi The vector receiving the unit direction of the outgoing ray
+ */
+void scatter_dielectric(const material *mat, const vec3 *dir,
+                        const vec3 *normal, float u, vec3 *wi);
+
+#endif
+/* EOF */
@@ -0,0 +1,130 @@
+#ifndef MEDIUM_H
+#define MEDIUM_H
+
+#include <stdbool.h>
+
+#include "aabb.h"
+#include "ray.h"
+#include "rng.h"
+#include "vec3.h"
+
+/* Density voxels per majorant cell along each axis */
+#define MEDIUM_MAJORANT_VOXELS 8
+
+enum medium_type
+{
+    MEDIUM_HOMOGENEOUS,     /* Same density everywhere in the box */
+    MEDIUM_GRID             /* Trilinear density voxels over the box */
+};
+
+typedef struct medium_t medium;
+
+/*
+ * A box of fog or smoke. The extinction at a point is sigma_t times the
+ * density there, between 0 and 1. Free flights are sampled against a coarse
+ * grid of per cell density maxima, so thin regions are crossed in a few
+ * large steps and empty cells are skipped outright
+ */
+struct medium_t
+{
+    enum medium_type type;
+    aabb bounds;
+    float sigma_t;          /* Extinction per unit length at density 1 */
+    vec3 albedo;            /* Fraction of extinction that is scattering */
+    float g;                /* Henyey-Greenstein asymmetry, -1 to 1 */
+    int nx, ny, nz;         /* Density voxels */
+    float *density;
+    int mx, my, mz;         /* Majorant cells */
+    float *majorant;        /* Highest density a cell can interpolate to */
+};
+
+/**
+ * Creates a medium of constant density
+ * @param bounds The box the medium fills
+ * @param sigma_t The extinction per unit length
+ * @param albedo The fraction of extinction that is scattering, per channel
+ * @param g The Henyey-Greenstein asymmetry, above 0 scatters forward
+ * @return The new medium, or NULL if it could not be allocated
+ */
+medium *create_homogeneous_medium(const aabb *bounds, float sigma_t,
+                                  const vec3 *albedo, float g);
+
+/**
+ * Creates a medium from a density grid. Voxel (i, j, k) is at
+ * density[(k * ny + j) * nx + i] and sits at the center of its cell of the
+ * box. Densities are clamped to 0 to 1
+ * @param bounds The box the medium fills
+ * @param nx The number of voxels along x
+ * @param ny The number of voxels along y
+ * @param nz The number of voxels along z
+ * @param density The voxels, copied into the medium
+ * @param sigma_t The extinction per unit length at density 1
+ * @param albedo The fraction of extinction that is scattering, per channel
+ * @param g The Henyey-Greenstein asymmetry, above 0 scatters forward
+ * @return The new medium, or NULL if it could not be allocated
+ */
+medium *create_grid_medium(const aabb *bounds, int nx, int ny, int nz,
+                           const float *density, float sigma_t,
+                           const vec3 *albedo, float g);
+
+/**
+ * Deletes a medium
+ * @param m The medium
+ */
+void delete_medium(medium *m);
+
+/**
+ * Gets the density of a medium at a point
+ * @param m The medium
+ * @param p The point
+ * @return The density, 0 outside the box
+ */
+float medium_density(const medium *m, const vec3 *p);
+
+/**
+ * Samples where a ray first scatters in a medium with delta tracking
+ * @param m The medium
+ * @param r The ray
+ * @param t_max The ray parameter the ray ends at
+ * @param g The random number generator
+ * @param t The ray parameter of the collision, set when there is one
+ * @return Whether the ray scatters before t_max
+ */
+bool sample_medium(const medium *m, const ray *r, float t_max, rng *g,
+                   float *t);
+
+/**
+ * Estimates the fraction of light that makes it through a medium along a ray
+ * with ratio tracking
+ * @param m The medium
+ * @param r The ray
+ * @param t_max The ray parameter the ray ends at
+ * @param g The random number generator
+ * @return The transmittance estimate
+ */
+float medium_transmittance(const medium *m, const ray *r, float t_max,
+                           rng *g);
+
+/**
+ * Picks a scattered direction from the phase function of a medium
+ * @param m The medium
+ * @param dir The unit direction the light was travelling in
+ * @param u1 The first uniform random number
+ * @param u2 The second uniform random number
+ * @param wi The unit vector receiving the new direction
+ * @return The density of the direction, which equals the phase function
+ */
+float sample_phase(const medium *m, const vec3 *dir, float u1, float u2,
+                   vec3 *wi);
+
+/**
+ * Evaluates the phase function of a medium
+ * @param m The medium
+ * @param dir The unit direction the light was travelling in
+ * @param wi The unit scattered direction
+ * @return The phase function, per steradian
+ */
+float phase_function(const medium *m, const vec3 *dir, const vec3 *wi);
+
+#endif
+/* EOF */
@@ -0,0 +1,59 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Most NUMA nodes and processors the renderer keeps track of */
+#define NUMA_MAX_NODES 16
+#define NUMA_MAX_CPUS 1024
+
+typedef struct numa_topology_t numa_topology;
+
+/* The NUMA nodes of the host and the processors on each */
+struct numa_topology_t
+{
+    int num_nodes;
+    int id[NUMA_MAX_NODES];         /* Kernel node number */
+    int num_cpus[NUMA_MAX_NODES];
+    unsigned long cpus[NUMA_MAX_NODES][NUMA_MAX_CPUS / (8 * sizeof(long))];
+};
+
+/**
+ * Finds the NUMA nodes through /sys/devices/system/node, keeping only the
+ * processors this process may run on. Hosts without that directory, or
+ * without NUMA, come out as a single node with every allowed processor
+ * @param topo The topology receiving the result
+ * @return 0 on success, -1 if not even the allowed processors could be read
+ */
+int discover_numa(numa_topology *topo);
+
+/**
+ * Checks whether a processor belongs to a node
+ * @param topo The topology
+ * @param node The node, indexing the topology
+ * @param cpu The processor number
+ * @return Whether the processor is on the node
+ */
+bool numa_node_has_cpu(const numa_topology *topo, int node, int cpu);
+
+/**
+ * Restricts the calling thread to the processors of one node. Memory the
+ * thread writes first from then on is placed on that node
+ * @param topo The topology
+ * @param node The node, indexing the topology
+ * @return 0 on success, -1 on failure
+ */
+int bind_to_numa_node(const numa_topology *topo, int node);
+
+/**
+ * Faults in a range of memory from the calling thread by writing every page,
+ * without changing its contents. Pages that were already faulted in stay
+ * where they are
+ * @param data The start of the range
+ * @param size The size of the range in bytes
+ */
+void touch_pages(void *data, size_t size);
+
+#endif
+/* EOF */
@@ -0,0 +1,100 @@
+#ifndef PHOTON_H
+#define PHOTON_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "scene.h"
+#include "vec3.h"
+
+/* Photons a radiance estimate gathers, and the farthest it looks for them in
+ * world units, which suits the demo scenes */
+#define PHOTON_NEAREST 50
+#define PHOTON_MAX_RADIUS 0.05f
+
+/* Most surface hits a photon may have before it is dropped */
+#define PHOTON_MAX_BOUNCES 8
+
+typedef struct photon_map_t photon_map;
+
+/**
+ * Creates an empty caustic photon map with room for the photons of a number
+ * of emitted ones. Photons are only stored where they land on a diffuse
+ * surface after one or more dielectric bounces, so the map holds the light
+ * that light sampling can not find through glass
+ * @param num_emitted The number of photons that will be emitted
+ * @return The new map, or NULL if it could not be allocated
+ */
+photon_map *create_photon_map(int num_emitted);
+
+/**
+ * Deletes a photon map
+ * @param pm The map, may be NULL
+ */
+void delete_photon_map(photon_map *pm);
+
+/**
+ * Emits a run of photons from randomly picked lights and traces them through
+ * the scene. Photon k only depends on the seed and k, and only writes its own
+ * slot of the map, so runs may be emitted by any number of threads at once
+ * @param pm The map
+ * @param s The scene
+ * @param ctx The calling thread's group context, may be NULL if the scene has
+ *            no groups
+ * @param first The first photon of the run
+ * @param count The number of photons in the run
+ * @param seed The seed all photons are drawn from
+ * @param time0 The earliest time a photon may leave at
+ * @param time1 The latest time a photon may leave at
+ */
+void emit_photons(photon_map *pm, const scene *s, group_context *ctx,
+                  int first, int count, uint64_t seed, float time0,
+                  float time1);
+
+/**
+ * Starts building the kd-tree of a map once every photon was emitted. The
+ * tree is left balanced and stored implicitly: node k has children 2k and
+ * 2k + 1, and every node splits along the longest side of its photons'
+ * bounds at their median. The top levels are built right away until there
+ * are enough disjoint subtrees to hand out, the rest is left to
+ * build_photon_subtree
+ * @param pm The map
+ * @param min_tasks The smallest number of subtrees to split the build into
+ * @return The number of subtrees, or -1 if the tree could not be allocated
+ */
+int prepare_photon_tree(photon_map *pm, int min_tasks);
+
+/**
+ * Builds one subtree left by prepare_photon_tree. Different subtrees may be
+ * built by different threads at once
+ * @param pm The map
+ * @param task The subtree, from 0 to the count prepare_photon_tree returned
+ */
+void build_photon_subtree(photon_map *pm, int task);
+
+/**
+ * Estimates the caustic light arriving at a diffuse surface point from the
+ * PHOTON_NEAREST photons nearest to it, within PHOTON_MAX_RADIUS. Photons
+ * that arrived from behind the surface are left out
+ * @param pm The map, which must be built
+ * @param p The point
+ * @param normal The unit normal on the side being shaded
+ * @param radiance The vector receiving the cosine weighted incoming radiance
+ *                 over the hemisphere, which times the albedo is the radiance
+ *                 leaving the surface
+ * @return false if no photons are close enough
+ */
+bool photon_estimate(const photon_map *pm, const vec3 *p, const vec3 *normal,
+                     vec3 *radiance);
+
+/**
+ * Counts the photons of a map
+ * @param pm The map
+ * @param stored Receives the number of photons stored, which is only known
+ *               once the tree is prepared. May be NULL
+ * @return The number of photons emitted
+ */
+int photon_map_count(const photon_map *pm, int *stored);
+
+#endif
+/* EOF */
@@ -0,0 +1,42 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <stdbool.h>
+
+#include "framebuffer.h"
+
+typedef struct preview_t preview;
+
+/**
+ * Creates a preview stream. Frames are raw binary ppm (P6) images, sent one
+ * after another to a named pipe or to a listening unix domain socket at path.
+ * A missing path is created as a named pipe. Frames go out on a background
+ * thread, and while no viewer is connected they are dropped, so rendering
+ * never waits on the viewer
+ * @param path The named pipe or socket
+ * @param max_width The widest a frame may be, larger images are box filtered
+ *                  down by a whole factor
+ * @return The new stream, or NULL if path is neither a pipe nor a socket or
+ *         something could not be allocated
+ */
+preview *create_preview(const char *path, int max_width);
+
+/**
+ * Downscales and tone maps the framebuffer into the back buffer of the
+ * stream and hands it to the background thread, replacing any frame that has
+ * not gone out yet
+ * @param p The stream
+ * @param fb The framebuffer
+ * @return 0 on success, -1 if the frame buffers could not be allocated
+ */
+int request_preview(preview *p, const framebuffer *fb);
+
+/**
+ * Sends the last requested frame if a viewer is keeping up, then closes the
+ * stream and deletes it
+ * @param p The stream
+ */
+void delete_preview(preview *p);
+
+#endif
+/* EOF */
@@ -0,0 +1,46 @@
+#ifndef QUAD_H
+#define QUAD_H
+
+#include <stdbool.h>
+
+#include "hitable.h"
+#include "ray.h"
+#include "vec3.h"
+
+typedef struct quad_t quad;
+
+/* Parallelogram spanned by two edges from a corner. Only the side the normal
+ * points to is front facing */
+struct quad_t
+{
+    vec3 corner, edge_u, edge_v;
+    vec3 normal;    /* Unit normal, edge_u x edge_v normalized */
+    float area;
+    int material;
+};
+
+/**
+ * Sets up a quad and its derived fields
+ * @param q The quad
+ * @param corner One corner
+ * @param edge_u The first edge from the corner
+ * @param edge_v The second edge from the corner
+ * @param material The material index
+ */
+void make_quad(quad *q, const vec3 *corner, const vec3 *edge_u,
+               const vec3 *edge_v, int material);
+
+/**
+ * Intersects a ray with a quad, from either side
+ * @param q The quad
+ * @param r The ray
+ * @param t_min The smallest ray parameter that counts as a hit
+ * @param t_max The largest ray parameter that counts as a hit
+ * @param rec The record receiving the hit, only written on a hit
+ * @return Whether the ray hits the quad within [t_min, t_max]
+ */
+bool hit_quad(const quad *q, const ray *r, float t_min, float t_max,
+              hit_record *rec);
+
+#endif
+/* EOF */
@@ -0,0 +1,79 @@
+#ifndef RADCACHE_H
+#define RADCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vec3.h"
+
+/* Slots past the home slot of a key that are tried before giving up */
+#define RADIANCE_CACHE_PROBES 8
+
+/* Table size, as a power of 2, and cell side in world units that suit the
+ * demo scenes, where the scattered spheres are 0.04 to 0.16 across */
+#define RADIANCE_CACHE_LOG2_CELLS 18
+#define RADIANCE_CACHE_CELL_SIZE 0.1f
+
+/* Samples a cell needs before lookups in it succeed */
+#define RADIANCE_CACHE_MIN_SAMPLES 16
+
+typedef struct radiance_cache_t radiance_cache;
+
+/**
+ * Creates a radiance cache: a fixed size hash table of grid cells, each one
+ * averaging the light arriving at diffuse surfaces inside it. Cells are keyed
+ * by the position quantized to the grid and by the quantized normal. Every
+ * function may be called from any number of threads at once, cells are
+ * claimed with a compare and swap and their sums are updated atomically
+ * @param log2_cells The base 2 logarithm of the number of table slots
+ * @param cell_size The side of a grid cell in world units
+ * @return The new cache, or NULL if it could not be allocated
+ */
+radiance_cache *create_radiance_cache(int log2_cells, float cell_size);
+
+/**
+ * Deletes a radiance cache
+ * @param c The cache
+ */
+void delete_radiance_cache(radiance_cache *c);
+
+/**
+ * Finds the cell a surface point falls in, claiming a free slot for it if the
+ * cell is new
+ * @param c The cache
+ * @param p The point
+ * @param normal The unit surface normal, facing where the light is gathered
+ * @return The cell, or -1 if the slots the cell may use are all taken
+ */
+int radiance_cache_cell(radiance_cache *c, const vec3 *p, const vec3 *normal);
+
+/**
+ * Gets the average light that arrived in a cell, once the cell has seen
+ * enough samples
+ * @param c The cache
+ * @param cell The cell
+ * @param radiance The average cosine weighted incoming radiance over the
+ *                 hemisphere, which times the albedo is the radiance leaving a
+ *                 diffuse surface
+ * @return Whether the cell has RADIANCE_CACHE_MIN_SAMPLES samples or more
+ */
+bool radiance_cache_lookup(radiance_cache *c, int cell, vec3 *radiance);
+
+/**
+ * Adds a sample to a cell
+ * @param c The cache
+ * @param cell The cell
+ * @param radiance The cosine weighted incoming radiance estimated by a path
+ */
+void radiance_cache_add(radiance_cache *c, int cell, const vec3 *radiance);
+
+/**
+ * Counts the cells of a cache that hold samples
+ * @param c The cache
+ * @param total Receives the number of slots, may be NULL
+ * @return The number of cells in use
+ */
+size_t radiance_cache_cells_used(radiance_cache *c, size_t *total);
+
+#endif
+/* EOF */
@@ -0,0 +1,57 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include "renderer.h"
+#include "scene.h"
+#include "vec3.h"
+
+typedef struct raster_bins_t raster_bins;
+typedef struct raster_pixel_t raster_pixel;
+
+/* One camera ray of a visibility buffer and what it sees first */
+struct raster_pixel_t
+{
+    vec3 origin, dir;
+    float time;
+    float depth;    /* In, the furthest a hit may be, 0 to skip the pixel.
+                     * Out, the ray parameter of the closest hit */
+    int prim;       /* Out, the prim hit first, or -1 */
+};
+
+/**
+ * Sorts the prims of a scene into the render tiles of an image by their
+ * projected bounds, nearest first within each tile. The bins hold for every
+ * ray through a pixel, wherever in the pixel it passes, so they can be reused
+ * for every sample as long as the prims do not change
+ * @param s The scene
+ * @param cam The camera
+ * @param nx The image width
+ * @param ny The image height
+ * @return The bins, or NULL if they could not be allocated
+ */
+raster_bins *create_raster_bins(const scene *s, const camera *cam, int nx,
+                                int ny);
+
+/**
+ * Deletes tile bins
+ * @param b The bins
+ */
+void delete_raster_bins(raster_bins *b);
+
+/**
+ * Fills the visibility buffer of one tile. Every prim binned to the tile is
+ * splatted over the pixels its bounds cover, testing each covered ray against
+ * the prim alone and keeping the nearest hit, as a depth buffer would. The
+ * rays must be camera rays of the camera the bins were made for, from its
+ * origin to the image plane
+ * @param b The bins
+ * @param s The scene the bins were made from, or a copy of it
+ * @param tile The tile, numbered row by row from the bottom left
+ * @param pixels The pixels of the tile, row by row from the bottom left, as
+ *               many per row as the tile is wide
+ */
+void raster_tile(const raster_bins *b, const scene *s, int tile,
+                 raster_pixel *pixels);
+
+#endif
+/* EOF */
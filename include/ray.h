@@ -8,6 +8,7 @@ typedef struct ray_t ray;
 struct ray_t
 {
     vec3 *A, *B;
+    float time;     /* When the ray was cast, 0 to 1 over the shutter */
 };
 
 /**
@@ -25,12 +26,27 @@ ray *create_empty_ray(void);
 ray *create_ray(vec3 *a, vec3 *b);
 
 /**
- * Points the vectors of the input ray to the parameter vectors 
+ * Points the vectors of the input ray to the parameter vectors and resets its
+ * time to 0
  * @param a The origin vector
  * @param b The direction vector
  */
 void set_ray_vectors(ray *r, vec3 *a, vec3* b);
 
+/**
+ * Sets the time a ray was cast at
+ * @param r The ray
+ * @param time The time, 0 to 1 over the shutter interval
+ */
+void set_ray_time(ray *r, float time);
+
+/**
+ * Gets the time a ray was cast at
+ * @param r The ray
+ * @return The time
+ */
+float ray_time(const ray *r);
+
 /**
  * Deletes a ray. Should only be used if ray AND its vectors were heap allocated
  */
@@ -0,0 +1,34 @@
+#ifndef RAYSORT_H
+#define RAYSORT_H
+
+#include <stdint.h>
+
+#include "aabb.h"
+#include "vec3.h"
+
+/* Bits of each origin coordinate that go into a sort key */
+#define RAY_SORT_MORTON_BITS 9
+
+/**
+ * Makes a key that puts rays with similar directions and origins next to each
+ * other. The top 3 bits are the octant of the direction, below them is the
+ * Morton code of the origin quantized to a 512^3 grid over the scene bounds
+ * @param bounds The scene bounds
+ * @param o The ray origin
+ * @param d The ray direction
+ * @return The key, using the low 30 bits
+ */
+uint32_t ray_sort_key(const aabb *bounds, const vec3 *o, const vec3 *d);
+
+/**
+ * Sorts items by their keys with a stable radix sort. Passes over key bytes
+ * every item agrees on are skipped
+ * @param keys The keys, sorted in place
+ * @param items The items, reordered along with the keys
+ * @param scratch Room for 2 * count values
+ * @param count The number of items
+ */
+void sort_rays(uint32_t *keys, uint32_t *items, uint32_t *scratch, int count);
+
+#endif
+/* EOF */
@@ -0,0 +1,226 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "framebuffer.h"
+#include "integrator.h"
+#include "numa.h"
+#include "texture.h"
+#include "vec3.h"
+
+/* Side of the square pixel tiles handed to the workers, in pixels */
+#define RENDER_TILE_SIZE 32
+
+typedef struct camera_t camera;
+typedef struct render_tile_t render_tile;
+typedef struct render_desc_t render_desc;
+typedef struct render_progress_t render_progress;
+typedef struct render_node_stats_t render_node_stats;
+typedef struct render_photon_stats_t render_photon_stats;
+typedef struct render_job_t render_job;
+
+/* The order the rays of a tile are traced in */
+enum ray_order
+{
+    RAY_ORDER_DEPTH_FIRST,  /* Each path to the end before the next */
+    RAY_ORDER_WAVEFRONT,    /* Bounce by bounce over all paths of the tile */
+    RAY_ORDER_SORTED        /* Wavefront, with every bounce after the first
+                             * sorted by direction octant and origin */
+};
+
+enum render_status
+{
+    RENDER_RUNNING,
+    RENDER_DONE,        /* Every pixel reached the sample count */
+    RENDER_CANCELLED    /* Stopped by render_cancel, the framebuffer is valid */
+};
+
+/* The image plane of the chapter programs, seen from origin. Camera rays are
+ * spread evenly over the times from shutter_open to shutter_close */
+struct camera_t
+{
+    vec3 origin;
+    vec3 lower_left;
+    vec3 horizontal;
+    vec3 vertical;
+    float shutter_open, shutter_close;
+};
+
+/**
+ * A block of pixels that just received a sample. The pointers lead straight
+ * into the framebuffer, pixel (x + i, y + j) being at accum[3 * (j * stride +
+ * i)] and samples[j * stride + i]. No thread writes to the tile until the
+ * callback returns
+ */
+struct render_tile_t
+{
+    int x, y;                   /* Bottom left pixel */
+    int width, height;
+    int pass;
+    int stride;                 /* Pixels from one row to the next */
+    const float *accum;
+    const uint32_t *samples;
+};
+
+/**
+ * Is called on a worker thread whenever a tile is finished
+ * @param tile The tile
+ * @param user The user pointer of the job
+ */
+typedef void (*render_tile_fn)(const render_tile *tile, void *user);
+
+/**
+ * Is called between passes, when no tile is being rendered, so the whole
+ * framebuffer can be read safely
+ * @param fb The framebuffer
+ * @param pass The pass that just finished
+ * @param user The user pointer of the job
+ */
+typedef void (*render_pass_fn)(const framebuffer *fb, int pass, void *user);
+
+/* What to render and how */
+struct render_desc_t
+{
+    render_settings settings;
+    camera cam;
+    uint32_t spp;               /* Samples per pixel to reach */
+    int threads;                /* Workers, 0 for one per processor */
+    enum ray_order order;
+    bool numa;                  /* Pin workers per NUMA node, give each node a
+                                 * band of tiles and let it first touch them */
+    bool replicate;             /* With numa, copy the scene to every node */
+    bool raster;                /* Find the first hits of camera rays with a
+                                 * tiled visibility buffer, not the hierarchy.
+                                 * Ignored when the world has groups or
+                                 * signed distance shapes */
+    texture_cache *textures;    /* Cache the scene's textures live in, or NULL */
+    group_cache *groups;        /* Cache the scene's groups live in, or NULL */
+    int photons;                /* Photons to emit for a caustic photon map
+                                 * before the first pass, 0 for none */
+    render_tile_fn on_tile;     /* May be NULL */
+    render_pass_fn on_pass;     /* May be NULL */
+    void *user;
+};
+
+/* How far a job has come */
+struct render_progress_t
+{
+    uint64_t samples_done;      /* Including samples already in the buffer */
+    uint64_t samples_total;
+    uint64_t rays;              /* Closest hit rays traced by this job */
+    int pass;
+    enum render_status status;
+};
+
+/* What the workers of one NUMA node did */
+struct render_node_stats_t
+{
+    int node;                   /* Kernel node number */
+    int workers;
+    uint64_t samples;
+    uint64_t rays;
+    double busy;                /* Seconds spent on tiles, summed over workers */
+    bool replicated;            /* Whether the node traced its own scene copy */
+};
+
+/* What the photon pass of a job did */
+struct render_photon_stats_t
+{
+    int emitted;
+    int stored;                 /* Photons that ended up in the map */
+    double emit_time;           /* Seconds spent tracing the photons */
+    double build_time;          /* Seconds spent building the kd-tree */
+};
+
+/**
+ * Sets up a description with the chapter camera, one worker per processor,
+ * depth first ray order, no visibility buffer and no callbacks
+ * @param desc The description
+ * @param world The scene
+ * @param ny The image height, which sets the pixel footprint
+ */
+void init_render_desc(render_desc *desc, const scene *world, int ny);
+
+/**
+ * Starts rendering into a framebuffer in the background. Every pass takes one
+ * more sample for each pixel short of the sample count, spread over a pool of
+ * workers a tile at a time. With desc.photons, the same workers first emit
+ * the photons and build the photon map, a run of photons or a subtree at a
+ * time. The framebuffer's seed and sampler type decide the samples and the
+ * photons, so the result does not depend on the number of threads
+ * @param desc The description, copied into the job
+ * @param fb The framebuffer, which must outlive the job. It may already hold
+ *        samples, e.g. from a checkpoint
+ * @return The job, or NULL if it could not be started
+ */
+render_job *render_submit(const render_desc *desc, framebuffer *fb);
+
+/**
+ * Asks a job to stop. Workers finish the tile they are on and take no new ones
+ * @param job The job
+ */
+void render_cancel(render_job *job);
+
+/**
+ * Gets how far a job has come without waiting for it
+ * @param job The job
+ * @param progress The struct receiving the progress
+ */
+void render_get_progress(render_job *job, render_progress *progress);
+
+/**
+ * Gets the number of NUMA nodes a job runs on, 1 without desc.numa
+ * @param job The job
+ * @return The node count
+ */
+int render_node_count(render_job *job);
+
+/**
+ * Gets what the workers of one node did so far
+ * @param job The job
+ * @param node The node, from 0 to render_node_count - 1
+ * @param stats The struct receiving the counters
+ */
+void render_get_node_stats(render_job *job, int node, render_node_stats *stats);
+
+/**
+ * Gets what the photon pass of a job did. The numbers are only final once the
+ * first pass has started
+ * @param job The job
+ * @param stats The struct receiving the counters
+ * @return false if the job has no photon map
+ */
+bool render_get_photon_stats(render_job *job, render_photon_stats *stats);
+
+/**
+ * Waits for a job to finish
+ * @param job The job
+ * @return How the job ended
+ */
+enum render_status render_wait(render_job *job);
+
+/**
+ * Waits for a job and deletes it. The framebuffer is left to the caller
+ * @param job The job
+ */
+void delete_render_job(render_job *job);
+
+/**
+ * Gets the name of a ray order, as accepted by parse_ray_order
+ * @param order The order
+ * @return The name
+ */
+const char *ray_order_name(enum ray_order order);
+
+/**
+ * Parses a ray order name: "depth", "wavefront" or "sorted"
+ * @param name The name
+ * @param order The order receiving the result
+ * @return 0 on success, -1 if the name is unknown
+ */
+int parse_ray_order(const char *name, enum ray_order *order);
+
+#endif
+/* EOF */
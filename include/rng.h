@@ -0,0 +1,37 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+typedef struct rng_t rng;
+
+/* PCG32 generator. Plain data so it can be copied and written to disk */
+struct rng_t
+{
+    uint64_t state, inc;
+};
+
+/**
+ * Seeds a generator
+ * @param g The generator
+ * @param seed The starting state
+ * @param stream The stream id. Different streams never overlap
+ */
+void seed_rng(rng *g, uint64_t seed, uint64_t stream);
+
+/**
+ * Advances the generator and returns the next 32 random bits
+ * @param g The generator
+ * @return A uniformly distributed 32 bit value
+ */
+uint32_t rng_next(rng *g);
+
+/**
+ * Advances the generator and returns the next random float
+ * @param g The generator
+ * @return A uniformly distributed float in [0, 1)
+ */
+float rng_float(rng *g);
+
+#endif
+/* EOF */
@@ -0,0 +1,38 @@
+#ifndef RTWEEKEND_H
+#define RTWEEKEND_H
+
+/*
+ * Everything librtweekend exports: scene construction, materials, lights,
+ * textures, framebuffers, checkpoints and the asynchronous renderer. A typical
+ * client builds a scene, calls build_scene, then hands a framebuffer to
+ * render_submit and consumes tiles from the on_tile callback
+ */
+
+#include "aabb.h"
+#include "bvh.h"
+#include "checkpoint.h"
+#include "framebuffer.h"
+#include "group.h"
+#include "hitable.h"
+#include "integrator.h"
+#include "light.h"
+#include "material.h"
+#include "medium.h"
+#include "numa.h"
+#include "photon.h"
+#include "preview.h"
+#include "quad.h"
+#include "radcache.h"
+#include "raster.h"
+#include "ray.h"
+#include "renderer.h"
+#include "rng.h"
+#include "sampler.h"
+#include "scene.h"
+#include "sdf.h"
+#include "sphere.h"
+#include "texture.h"
+#include "vec3.h"
+
+#endif
+/* EOF */
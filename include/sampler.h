@@ -0,0 +1,83 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdint.h>
+
+/* Side of the toroidal blue noise mask used by SAMPLER_BLUE_NOISE */
+#define BLUE_NOISE_SIZE 64
+
+/*
+ * Sample dimensions. Dimensions 2k and 2k + 1 form a well stratified pair, so
+ * 2D decisions always start on an even dimension. Every bounce uses
+ * SAMPLE_DIMS_PER_BOUNCE dimensions starting at SAMPLE_DIM_BOUNCE
+ */
+#define SAMPLE_DIM_PIXEL 0          /* Position inside the pixel, 2D */
+#define SAMPLE_DIM_LENS 2           /* Position on the lens, 2D */
+#define SAMPLE_DIM_TIME 4           /* Time within the shutter interval, 1D */
+#define SAMPLE_DIM_BOUNCE 6
+#define SAMPLE_DIMS_PER_BOUNCE 6
+#define SAMPLE_BOUNCE_BSDF 0        /* Scattered direction, 2D */
+#define SAMPLE_BOUNCE_LIGHT 2       /* Point on the light, 2D */
+#define SAMPLE_BOUNCE_LIGHT_PICK 4  /* Which light to sample, 1D */
+#define SAMPLE_BOUNCE_ROULETTE 5    /* Russian roulette, 1D */
+
+enum sampler_type
+{
+    SAMPLER_RANDOM,     /* Independent uniform samples */
+    SAMPLER_SOBOL,      /* Owen scrambled Sobol, shuffled per pixel */
+    SAMPLER_BLUE_NOISE  /* Sobol shifted per pixel by a blue noise mask */
+};
+
+typedef struct sampler_t sampler;
+
+/*
+ * A sampler is a pure function of (pixel, sample index, dimension), so any
+ * number of threads can draw from one without sharing state, and a render
+ * continued from a checkpoint draws exactly the samples it would have
+ */
+struct sampler_t
+{
+    enum sampler_type type;
+    uint32_t seed;
+    const float *mask;  /* Blue noise ranks in [0, 1), for SAMPLER_BLUE_NOISE */
+};
+
+/**
+ * Sets up a sampler. The blue noise mask is built on first use and shared by
+ * every sampler
+ * @param s The sampler
+ * @param type The sample pattern
+ * @param seed Decorrelates renders with different seeds
+ * @return 0 on success, -1 if the blue noise mask could not be allocated
+ */
+int make_sampler(sampler *s, enum sampler_type type, uint32_t seed);
+
+/**
+ * Gets one sample coordinate
+ * @param s The sampler
+ * @param x The pixel column
+ * @param y The pixel row
+ * @param index The sample index within the pixel
+ * @param dim The dimension
+ * @return A value in [0, 1)
+ */
+float get_sample(const sampler *s, uint32_t x, uint32_t y, uint32_t index,
+                 uint32_t dim);
+
+/**
+ * Gets the name of a sampler type, as accepted by parse_sampler_type
+ * @param type The type
+ * @return The name
+ */
+const char *sampler_type_name(enum sampler_type type);
+
+/**
+ * Parses a sampler name: "random", "sobol" or "bluenoise"
+ * @param name The name
+ * @param type The type receiving the result
+ * @return 0 on success, -1 if the name is unknown
+ */
+int parse_sampler_type(const char *name, enum sampler_type *type);
+
+#endif
+/* EOF */
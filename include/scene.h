@@ -0,0 +1,243 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bvh.h"
+#include "group.h"
+#include "hitable.h"
+#include "light.h"
+#include "material.h"
+#include "medium.h"
+#include "quad.h"
+#include "ray.h"
+#include "sdf.h"
+#include "sphere.h"
+#include "vec3.h"
+
+typedef struct scene_t scene;
+
+/*
+ * Everything a ray can hit, plus the hierarchy used to find it. Spheres go
+ * through the hierarchy, quads are few and tested one by one. Hits on quad k
+ * report prim num_spheres + k. Groups are out-of-core sphere sets with a
+ * hierarchy of their own, found through a second hierarchy over their bounds;
+ * hits on any sphere of group k report prim num_spheres + num_quads + k.
+ * Signed distance shapes share the hierarchy with the spheres, and hits on
+ * shape k report prim num_spheres + num_quads + num_groups + k. Media are
+ * boxes of fog the rays pass through, owned by the caller like textures, and
+ * so are groups
+ */
+struct scene_t
+{
+    sphere *spheres;
+    int num_spheres, cap_spheres;
+    quad *quads;
+    int num_quads, cap_quads;
+    material *materials;
+    int num_materials, cap_materials;
+    const medium **media;
+    int num_media, cap_media;
+    group **groups;
+    int num_groups, cap_groups;
+    sdf *sdfs;
+    int num_sdfs, cap_sdfs;
+    light *lights;      /* Collected from emissive prims by build_scene */
+    int num_lights;
+    aabb bounds;        /* Of every prim, set by build_scene */
+    bvh *accel;
+    bvh *group_accel;   /* Over the group bounds, set by build_scene */
+};
+
+/**
+ * Creates an empty scene
+ * @return The new scene, or NULL if it could not be allocated
+ */
+scene *create_scene(void);
+
+/**
+ * Makes a deep copy of a built scene, hierarchy included. Textures, media and
+ * groups are shared with the original. The copy's memory is first written by
+ * the calling thread, which places it on that thread's NUMA node
+ * @param src The scene
+ * @return The copy, or NULL if it could not be allocated
+ */
+scene *copy_scene(const scene *src);
+
+/**
+ * Deletes a scene and its hierarchy
+ * @param s The scene
+ */
+void delete_scene(scene *s);
+
+/**
+ * Adds a material to a scene
+ * @param s The scene
+ * @param mat The material, copied into the scene
+ * @return The index of the material, or -1 if it could not be added
+ */
+int add_material(scene *s, const material *mat);
+
+/**
+ * Adds a sphere to a scene. The hierarchy must be rebuilt afterwards
+ * @param s The scene
+ * @param center The center of the sphere
+ * @param radius The radius of the sphere
+ * @param material The material index of the sphere
+ * @return The index of the sphere, or -1 if it could not be added
+ */
+int add_sphere(scene *s, const vec3 *center, float radius, int material);
+
+/**
+ * Adds a sphere moving in a straight line over the shutter interval. The
+ * hierarchy must be rebuilt afterwards
+ * @param s The scene
+ * @param center0 The center at time 0
+ * @param center1 The center at time 1
+ * @param radius The radius of the sphere
+ * @param material The material index of the sphere
+ * @return The index of the sphere, or -1 if it could not be added
+ */
+int add_moving_sphere(scene *s, const vec3 *center0, const vec3 *center1,
+                      float radius, int material);
+
+/**
+ * Adds a quad to a scene. The hierarchy must be rebuilt afterwards
+ * @param s The scene
+ * @param corner One corner
+ * @param edge_u The first edge from the corner
+ * @param edge_v The second edge from the corner
+ * @param material The material index of the quad
+ * @return The index of the quad, or -1 if it could not be added
+ */
+int add_quad(scene *s, const vec3 *corner, const vec3 *edge_u,
+             const vec3 *edge_v, int material);
+
+/**
+ * Adds a signed distance shape to a scene. Emissive shapes glow when hit but
+ * are not sampled as lights. The hierarchy must be rebuilt afterwards
+ * @param s The scene
+ * @param shape The shape, copied into the scene
+ * @return The index of the shape, or -1 if it could not be added
+ */
+int add_sdf(scene *s, const sdf *shape);
+
+/**
+ * Adds a medium to a scene. The scene does not take ownership, the medium
+ * must outlive it
+ * @param s The scene
+ * @param m The medium
+ * @return The index of the medium, or -1 if it could not be added
+ */
+int add_medium(scene *s, const medium *m);
+
+/**
+ * Adds a group to a scene. The scene does not take ownership, the group must
+ * outlive it. Emissive spheres in groups glow when hit but are not sampled as
+ * lights. The hierarchy must be rebuilt afterwards
+ * @param s The scene
+ * @param g The group
+ * @return The index of the group, or -1 if it could not be added
+ */
+int add_group(scene *s, group *g);
+
+/**
+ * Scatters small spheres over the ground plane y = -0.5, in the area around
+ * the default camera. With a hop above 0 the spheres move straight up by a
+ * random height of up to hop over the shutter interval
+ * @param s The scene
+ * @param count The number of spheres
+ * @param seed The seed for their placement
+ * @param material The material index of the spheres
+ * @param hop The highest a sphere rises, 0 for static spheres
+ * @return 0 on success, -1 if the spheres could not be added
+ */
+int add_random_spheres(scene *s, int count, uint64_t seed, int material,
+                       float hop);
+
+/**
+ * Builds the scene hierarchy and light list, replacing any previous ones
+ * @param s The scene
+ * @param layout The node layout
+ * @return 0 on success, -1 if the hierarchy could not be allocated
+ */
+int build_scene(scene *s, enum bvh_layout layout);
+
+/**
+ * Finds the closest thing a ray hits. Groups are loaded the first time a ray
+ * reaches their bounds
+ * @param s The scene, which must have been built
+ * @param ctx The calling thread's group context, may be NULL if the scene has
+ *            no groups
+ * @param r The ray
+ * @param t_min The smallest ray parameter that counts as a hit
+ * @param t_max The largest ray parameter that counts as a hit
+ * @param rec The record receiving the closest hit
+ * @return Whether anything was hit
+ */
+bool hit_scene(const scene *s, group_context *ctx, const ray *r, float t_min,
+               float t_max, hit_record *rec);
+
+/**
+ * Intersects a ray with one sphere or quad of a scene
+ * @param s The scene
+ * @param prim The prim, numbered as in hit records
+ * @param r The ray
+ * @param t_min The smallest ray parameter that counts as a hit
+ * @param t_max The largest ray parameter that counts as a hit
+ * @param rec The record receiving the hit, only written on a hit
+ * @return Whether the ray hits the prim
+ */
+bool hit_scene_prim(const scene *s, int prim, const ray *r, float t_min,
+                    float t_max, hit_record *rec);
+
+/**
+ * Checks whether anything blocks a ray. Stops at the first blocker found
+ * instead of looking for the closest one
+ * @param s The scene, which must have been built
+ * @param ctx The calling thread's group context, may be NULL if the scene has
+ *            no groups
+ * @param r The ray
+ * @param t_min The smallest ray parameter that counts as a blocker
+ * @param t_max The largest ray parameter that counts as a blocker
+ * @return Whether the ray is blocked
+ */
+bool scene_occluded(const scene *s, group_context *ctx, const ray *r,
+                    float t_min, float t_max);
+
+/**
+ * Samples where a ray first scatters in the media of a scene, with delta
+ * tracking through each medium the ray crosses
+ * @param s The scene
+ * @param r The ray
+ * @param t_max The ray parameter the ray ends at, such as its closest hit
+ * @param g The random number generator
+ * @param t The ray parameter of the collision, set when there is one
+ * @return The index of the medium the ray scatters in, or -1 if it gets
+ *         through
+ */
+int scene_sample_media(const scene *s, const ray *r, float t_max, rng *g,
+                       float *t);
+
+/**
+ * Estimates the fraction of light that makes it through the media of a
+ * scene along an unblocked ray
+ * @param s The scene
+ * @param r The ray
+ * @param t_max The ray parameter the ray ends at
+ * @param g The random number generator
+ * @return The transmittance estimate
+ */
+float scene_transmittance(const scene *s, const ray *r, float t_max, rng *g);
+
+/**
+ * Finds the light a hit landed on
+ * @param s The scene
+ * @param rec The hit
+ * @return The index into the scene lights, or -1 if the prim is not a light
+ */
+int find_light(const scene *s, const hit_record *rec);
+
+#endif
+/* EOF */
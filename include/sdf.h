@@ -0,0 +1,132 @@
+#ifndef SDF_H
+#define SDF_H
+
+#include <stdbool.h>
+
+#include "aabb.h"
+#include "hitable.h"
+#include "ray.h"
+#include "vec3.h"
+
+/* Most parts one shape can blend together */
+#define SDF_MAX_PARTS 4
+
+/* Most distance evaluations a ray may spend on one shape */
+#define SDF_MAX_STEPS 256
+
+/* Factor sphere tracing stretches its steps by until it overshoots */
+#define SDF_RELAXATION 1.6f
+
+/* Distance from the surface that counts as a hit, in world units */
+#define SDF_EPSILON 1e-4f
+
+/* Escape time iterations of the mandelbulb distance estimate */
+#define SDF_MANDELBULB_ITERATIONS 8
+
+typedef struct sdf_part_t sdf_part;
+typedef struct sdf_t sdf;
+
+enum sdf_part_type
+{
+    SDF_PART_SPHERE,
+    SDF_PART_ROUNDED_BOX,
+    SDF_PART_MANDELBULB
+};
+
+/* One shape given by its signed distance, centered on a point */
+struct sdf_part_t
+{
+    enum sdf_part_type type;
+    vec3 center;
+    vec3 size;      /* Box half extents, or the radius of a sphere or
+                     * mandelbulb in x */
+    float rounding; /* Radius the box edges are rounded with, added to its
+                     * half extents */
+    float power;    /* Exponent of a mandelbulb */
+};
+
+/*
+ * A primitive whose surface is where a signed distance function is zero,
+ * rendered with sphere tracing. Its parts are merged with a smooth union,
+ * blending them over blend world units
+ */
+struct sdf_t
+{
+    sdf_part parts[SDF_MAX_PARTS];
+    int num_parts;
+    float blend;
+    int material;
+};
+
+/**
+ * Sets up a shape with no parts
+ * @param s The shape
+ * @param blend The distance over which the parts blend into each other, 0 for
+ *              a plain union
+ * @param material The material index
+ */
+void make_sdf(sdf *s, float blend, int material);
+
+/**
+ * Adds a sphere to a shape
+ * @param s The shape
+ * @param center The center
+ * @param radius The radius
+ * @return 0 on success, -1 if the shape has no room for another part
+ */
+int sdf_add_sphere(sdf *s, const vec3 *center, float radius);
+
+/**
+ * Adds a box with rounded edges to a shape
+ * @param s The shape
+ * @param center The center
+ * @param half_size The half extents of the box before rounding
+ * @param rounding The radius of the rounded edges, which grows the box
+ * @return 0 on success, -1 if the shape has no room for another part
+ */
+int sdf_add_rounded_box(sdf *s, const vec3 *center, const vec3 *half_size,
+                        float rounding);
+
+/**
+ * Adds a mandelbulb fractal to a shape
+ * @param s The shape
+ * @param center The center
+ * @param radius The scale, about the radius of the bulb
+ * @param power The exponent, 8 for the classic bulb
+ * @return 0 on success, -1 if the shape has no room for another part
+ */
+int sdf_add_mandelbulb(sdf *s, const vec3 *center, float radius, float power);
+
+/**
+ * Gets a lower bound on the distance from a point to the surface of a shape,
+ * negative inside
+ * @param s The shape
+ * @param p The point
+ * @return The signed distance
+ */
+float sdf_distance(const sdf *s, const vec3 *p);
+
+/**
+ * Calculates a box that encloses a shape, including the bulge of the blend
+ * @param s The shape
+ * @param box The box receiving the bounds
+ */
+void sdf_bounds(const sdf *s, aabb *box);
+
+/**
+ * Intersects a ray with a shape. The ray is clipped to the bounds first and
+ * only marched inside them. Steps are stretched by SDF_RELAXATION and fall
+ * back to plain sphere tracing when a stretched step may have passed through
+ * the surface. Rays that take more than SDF_MAX_STEPS steps miss
+ * @param s The shape
+ * @param r The ray
+ * @param t_min The smallest ray parameter that counts as a hit
+ * @param t_max The largest ray parameter that counts as a hit
+ * @param rec The record receiving the hit, only written on a hit
+ * @return Whether the ray hits the shape within [t_min, t_max]
+ */
+bool hit_sdf(const sdf *s, const ray *r, float t_min, float t_max,
+             hit_record *rec);
+
+#endif
+/* EOF */
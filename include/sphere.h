@@ -0,0 +1,73 @@
+#ifndef SPHERE_H
+#define SPHERE_H
+
+#include <stdbool.h>
+
+#include "aabb.h"
+#include "hitable.h"
+#include "ray.h"
+#include "vec3.h"
+
+typedef struct sphere_t sphere;
+
+/* Moving spheres travel in a straight line from center at time 0 to center +
+ * motion at time 1. Static spheres have zero motion */
+struct sphere_t
+{
+    vec3 center;
+    vec3 motion;
+    float radius;
+    int material;
+};
+
+/**
+ * Gets where a sphere is at a point in time
+ * @param s The sphere
+ * @param time The time, 0 to 1 over the shutter interval
+ * @param center The vector receiving the center
+ */
+void sphere_center(const sphere *s, float time, vec3 *center);
+
+/**
+ * Finds how far along a ray it first hits a sphere, placed where it is at the
+ * ray's time, without working out the rest of the hit
+ * @param s The sphere
+ * @param r The ray
+ * @param t_min The smallest ray parameter that counts as a hit
+ * @param t_max The largest ray parameter that counts as a hit
+ * @param t The ray parameter of the hit, only written on a hit
+ * @return Whether the ray hits the sphere within [t_min, t_max]
+ */
+bool sphere_distance(const sphere *s, const ray *r, float t_min, float t_max,
+                     float *t);
+
+/**
+ * Intersects a ray with a sphere, placed where it is at the ray's time
+ * @param s The sphere
+ * @param r The ray
+ * @param t_min The smallest ray parameter that counts as a hit
+ * @param t_max The largest ray parameter that counts as a hit
+ * @param rec The record receiving the hit, only written on a hit
+ * @return Whether the ray hits the sphere within [t_min, t_max]
+ */
+bool hit_sphere(const sphere *s, const ray *r, float t_min, float t_max,
+                hit_record *rec);
+
+/**
+ * Calculates the bounding box of a sphere, enclosing all of its motion so a
+ * hierarchy over it is valid at any time
+ * @param s The sphere
+ * @param box The box receiving the bounds
+ */
+void sphere_bounds(const sphere *s, aabb *box);
+
+/**
+ * Gets the texture coordinates of a point on a unit sphere
+ * @param p The point, relative to the sphere center and divided by the radius
+ * @param u The horizontal coordinate
+ * @param v The vertical coordinate
+ */
+void sphere_uv(const vec3 *p, float *u, float *v);
+
+#endif
+/* EOF */
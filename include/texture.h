@@ -0,0 +1,92 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <stddef.h>
+
+#include "vec3.h"
+
+/* Texels per tile side. Tiles of every mip level have the same size */
+#define TEXTURE_TILE_SIZE 32
+
+/* Tiles a texture context keeps pinned for lock free reuse */
+#define TEXTURE_FRONT_SIZE 16
+
+typedef struct texture_cache_t texture_cache;
+typedef struct texture_t texture;
+typedef struct texture_context_t texture_context;
+typedef struct texture_stats_t texture_stats;
+
+/* Counters describing how the cache behaved */
+struct texture_stats_t
+{
+    size_t tiles_loaded;    /* Level 0 tiles read from disk */
+    size_t tiles_filtered;  /* Mip tiles built from the level below */
+    size_t tiles_evicted;
+    size_t tiles_failed;    /* Tiles that could not be allocated, sampled
+                             * as the texture's average color instead */
+    size_t bytes_used;
+    size_t bytes_peak;
+    size_t bytes_budget;
+};
+
+/**
+ * Creates a tile cache shared by all textures and threads
+ * @param budget The number of bytes of tile memory to stay under. Only tiles
+ *        pinned by texture contexts can push usage past it
+ * @return The new cache, or NULL if it could not be allocated
+ */
+texture_cache *create_texture_cache(size_t budget);
+
+/**
+ * Deletes a cache and every texture opened through it. All contexts using the
+ * cache must be deleted first
+ * @param cache The cache
+ */
+void delete_texture_cache(texture_cache *cache);
+
+/**
+ * Opens a binary (P6) ppm as a texture. Only the header is read, texels are
+ * loaded a tile at a time the first time they are sampled
+ * @param cache The cache
+ * @param filename The image file
+ * @return The texture, or NULL if the file is missing or not a P6 ppm with a
+ *         maxval of 255
+ */
+texture *open_texture(texture_cache *cache, const char *filename);
+
+/**
+ * Creates a per-thread context. Lookups that hit the context's small front
+ * cache take no locks
+ * @param cache The cache
+ * @return The new context, or NULL if it could not be allocated
+ */
+texture_context *create_texture_context(texture_cache *cache);
+
+/**
+ * Releases the tiles pinned by a context and deletes it
+ * @param ctx The context
+ */
+void delete_texture_context(texture_context *ctx);
+
+/**
+ * Samples a texture with trilinear filtering
+ * @param ctx The calling thread's context
+ * @param tex The texture
+ * @param u The horizontal texture coordinate, wraps around
+ * @param v The vertical texture coordinate, 0 is the bottom row, wraps around
+ * @param footprint The width of the ray footprint in texture coordinates,
+ *        used to pick the mip level
+ * @param col The vector receiving the linear color
+ */
+void sample_texture(texture_context *ctx, texture *tex, float u, float v,
+                    float footprint, vec3 *col);
+
+/**
+ * Gets a snapshot of the cache counters
+ * @param cache The cache
+ * @param stats The struct receiving the counters
+ */
+void get_texture_stats(texture_cache *cache, texture_stats *stats);
+
+#endif
+/* EOF */
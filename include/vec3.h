@@ -283,5 +283,13 @@ void entrywise_division(vec3 *quotient, const vec3 *first, const vec3 *second);
  */
 vec3 *entrywise_division_new(const vec3 *first, const vec3 *second);
 
+/**
+ * Builds two unit vectors that form an orthonormal basis with a unit normal
+ * @param n The unit normal
+ * @param t The first tangent
+ * @param b The second tangent
+ */
+void orthonormal_basis(const vec3 *n, vec3 *t, vec3 *b);
+
 #endif
 /* EOF */
\ No newline at end of file
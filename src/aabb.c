@@ -0,0 +1,61 @@
+#include <float.h>
+#include <tgmath.h>
+
+#include "../include/aabb.h"
+
+/* Sets a box to the empty box */
+void
+empty_aabb(aabb *box)
+{
+    set_elems(&box->min, FLT_MAX, FLT_MAX, FLT_MAX);
+    set_elems(&box->max, -FLT_MAX, -FLT_MAX, -FLT_MAX);
+}
+
+/* Grows a box to contain another box */
+void
+merge_aabb(aabb *box, const aabb *other)
+{
+    int k;
+
+    for (k = 0; k < 3; k++) {
+        box->min.e[k] = fminf(box->min.e[k], other->min.e[k]);
+        box->max.e[k] = fmaxf(box->max.e[k], other->max.e[k]);
+    } /* for */
+}
+
+/* Grows a box to contain a point */
+void
+extend_aabb(aabb *box, const vec3 *p)
+{
+    int k;
+
+    for (k = 0; k < 3; k++) {
+        box->min.e[k] = fminf(box->min.e[k], p->e[k]);
+        box->max.e[k] = fmaxf(box->max.e[k], p->e[k]);
+    } /* for */
+}
+
+/* Calculates the surface area of a box */
+float
+aabb_surface_area(const aabb *box)
+{
+    vec3 d;
+
+    subtract_vec(&d, &box->max, &box->min);
+
+    if (get_x(&d) < 0 || get_y(&d) < 0 || get_z(&d) < 0) {
+        return 0;
+    } /* if */
+
+    return 2.0f * (get_x(&d) * get_y(&d) + get_y(&d) * get_z(&d)
+                   + get_z(&d) * get_x(&d));
+}
+
+/* Calculates the center of a box */
+void
+aabb_center(const aabb *box, vec3 *center)
+{
+    add_vec(center, &box->min, &box->max);
+    multiply_scalar(center, 0.5f);
+}
+/* EOF */
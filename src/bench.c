@@ -0,0 +1,456 @@
+#include <errno.h>
+#include <float.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <tgmath.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/rtweekend.h"
+
+/* Gets a monotonic time stamp in seconds */
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/* Starts counting last level cache misses of this thread and every thread it
+ * creates from now on. Returns -1 where hardware counters are not available */
+static int
+open_cache_counter(void)
+{
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+    return fd;
+}
+
+/* Reads and closes a counter. Threads that exited have been added to it */
+static long long
+close_cache_counter(int fd)
+{
+    long long count = -1;
+
+    if (fd < 0) {
+        return -1;
+    } /* if */
+
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+        count = -1;
+    } /* if */
+
+    close(fd);
+
+    return count;
+}
+
+/* Parses a positive integer option */
+static long
+parse_count(const char *opt, const char *arg)
+{
+    char *end;
+    long value;
+
+    if (!arg) {
+        fprintf(stderr, "%s needs a value\n", opt);
+        exit(EXIT_FAILURE);
+    } /* if */
+
+    errno = 0;
+    value = strtol(arg, &end, 10);
+
+    if (errno || *end || value <= 0) {
+        fprintf(stderr, "Invalid value for %s: %s\n", opt, arg);
+        exit(EXIT_FAILURE);
+    } /* if */
+
+    return value;
+}
+
+/**
+ * Fills the ray arrays with camera rays through random points of the image
+ * plane used by the renderer, followed by rays leaving random ground points in
+ * random upward directions
+ * @param origins The ray origins
+ * @param dirs The ray directions
+ * @param count The number of rays
+ */
+static void
+make_rays(vec3 *origins, vec3 *dirs, int count)
+{
+    rng g;
+    int k;
+
+    seed_rng(&g, 7, 0xbe4c);
+
+    for (k = 0; k < count; k++) {
+        if (k < count / 2) {
+            zero_out_vector(&origins[k]);
+            set_elems(&dirs[k], -2.0f + 4.0f * rng_float(&g),
+                      -1.0f + 2.0f * rng_float(&g), -1.0f);
+        } else {
+            set_elems(&origins[k], -6.0f + 12.0f * rng_float(&g), -0.5f,
+                      -0.5f - 8.0f * rng_float(&g));
+            set_elems(&dirs[k], 2.0f * rng_float(&g) - 1.0f, rng_float(&g),
+                      2.0f * rng_float(&g) - 1.0f);
+        } /* if */
+    } /* for */
+}
+
+/* Renders per ray order. The fastest run counts, which filters out noise from
+ * other processes */
+#define ORDER_RUNS 3
+
+/**
+ * Renders the bench scene with every ray order on one thread and prints how
+ * fast the rays went and how often they missed the cache
+ * @param world The scene, which must have materials and lights
+ * @param nx The image width
+ * @param ny The image height
+ * @param spp The samples per pixel
+ */
+static void
+bench_ray_orders(scene *world, int nx, int ny, int spp)
+{
+    enum ray_order orders[] = {
+        RAY_ORDER_DEPTH_FIRST, RAY_ORDER_WAVEFRONT, RAY_ORDER_SORTED
+    };
+    render_desc desc;
+    render_job *job;
+    render_progress progress;
+    framebuffer *fb;
+    double start, trace_time, best_time;
+    long long misses, best_misses;
+    int k, run, counter;
+
+    init_render_desc(&desc, world, ny);
+    desc.settings.max_depth = 16;
+    desc.spp = (uint32_t)spp;
+    desc.threads = 1;
+
+    printf("\n%dx%d, %d spp, up to %d bounces\n", nx, ny, spp,
+           desc.settings.max_depth);
+    printf("%-10s %10s %10s %10s %14s %12s\n", "order", "render ms",
+           "rays", "Mrays/s", "cache misses", "misses/ray");
+
+    for (k = 0; k < (int)(sizeof(orders) / sizeof(orders[0])); k++) {
+        desc.order = orders[k];
+        best_time = DBL_MAX;
+        best_misses = -1;
+
+        for (run = 0; run < ORDER_RUNS; run++) {
+            fb = create_framebuffer(nx, ny, 1, SAMPLER_SOBOL);
+
+            if (!fb) {
+                perror("Could not allocate framebuffer. Aborting.\n");
+                exit(EXIT_FAILURE);
+            } /* if */
+
+            counter = open_cache_counter();
+            start = now();
+            job = render_submit(&desc, fb);
+
+            if (!job) {
+                perror("Could not start render. Aborting.\n");
+                exit(EXIT_FAILURE);
+            } /* if */
+
+            render_wait(job);
+            trace_time = now() - start;
+            misses = close_cache_counter(counter);
+            render_get_progress(job, &progress);
+            delete_render_job(job);
+            delete_framebuffer(fb);
+
+            if (trace_time < best_time) {
+                best_time = trace_time;
+                best_misses = misses;
+            } /* if */
+        } /* for */
+
+        printf("%-10s %10.1f %10llu %10.2f", ray_order_name(orders[k]),
+               1e3 * best_time, (unsigned long long)progress.rays,
+               1e-6 * (double)progress.rays / best_time);
+
+        if (best_misses >= 0) {
+            printf(" %14lld %12.2f\n", best_misses,
+                   (double)best_misses / (double)progress.rays);
+        } else {
+            printf(" %14s %12s\n", "n/a", "n/a");
+        } /* if */
+    } /* for */
+}
+
+/* Samples per pixel of the reference the radiance cache is compared to, as a
+ * multiple of the benchmark spp */
+#define REFERENCE_SPP_SCALE 16
+
+/**
+ * Renders an image on one thread
+ * @param desc The render description
+ * @param nx The image width
+ * @param ny The image height
+ * @param seed The seed of the samples
+ * @param seconds Receives how long the render took
+ * @return The framebuffer, to be deleted by the caller
+ */
+static framebuffer *
+render_image(const render_desc *desc, int nx, int ny, uint64_t seed,
+             double *seconds)
+{
+    framebuffer *fb = create_framebuffer(nx, ny, seed, SAMPLER_SOBOL);
+    render_job *job;
+    double start;
+
+    if (!fb) {
+        perror("Could not allocate framebuffer. Aborting.\n");
+        exit(EXIT_FAILURE);
+    } /* if */
+
+    start = now();
+    job = render_submit(desc, fb);
+
+    if (!job) {
+        perror("Could not start render. Aborting.\n");
+        exit(EXIT_FAILURE);
+    } /* if */
+
+    render_wait(job);
+    *seconds = now() - start;
+    delete_render_job(job);
+
+    return fb;
+}
+
+/* Gets the root mean square difference between two images, over all pixels
+ * and channels */
+static double
+image_rmse(const framebuffer *a, const framebuffer *b)
+{
+    double sum = 0, d;
+    vec3 ca, cb;
+    int i, j, c;
+
+    for (j = 0; j < a->ny; j++) {
+        for (i = 0; i < a->nx; i++) {
+            resolve_pixel(a, i, j, &ca);
+            resolve_pixel(b, i, j, &cb);
+
+            for (c = 0; c < 3; c++) {
+                d = (double)ca.e[c] - (double)cb.e[c];
+                sum += d * d;
+            } /* for */
+        } /* for */
+    } /* for */
+
+    return sqrt(sum / (3.0 * (double)a->nx * (double)a->ny));
+}
+
+/**
+ * Renders the bench scene with plain path tracing and with the radiance cache
+ * looked up after one and after two bounces, and prints the time each took
+ * and how far each is from a reference with many more samples
+ * @param world The scene, which must have materials and lights
+ * @param nx The image width
+ * @param ny The image height
+ * @param spp The samples per pixel
+ */
+static void
+bench_radiance_cache(scene *world, int nx, int ny, int spp)
+{
+    const int depths[] = { 0, 1, 2 };
+    render_desc desc;
+    framebuffer *ref, *fb;
+    radiance_cache *cache;
+    double seconds, ref_seconds;
+    size_t used;
+    int k;
+
+    init_render_desc(&desc, world, ny);
+    desc.settings.max_depth = 16;
+    desc.spp = (uint32_t)spp * REFERENCE_SPP_SCALE;
+    desc.threads = 1;
+    ref = render_image(&desc, nx, ny, 2, &ref_seconds);
+    desc.spp = (uint32_t)spp;
+
+    printf("\n%dx%d, %d spp against %d spp path tracing (%.1f ms)\n", nx,
+           ny, spp, spp * REFERENCE_SPP_SCALE, 1e3 * ref_seconds);
+    printf("%-10s %10s %10s %12s\n", "cache", "render ms", "rmse",
+           "cells used");
+
+    for (k = 0; k < (int)(sizeof(depths) / sizeof(depths[0])); k++) {
+        cache = NULL;
+
+        if (depths[k] > 0) {
+            cache = create_radiance_cache(RADIANCE_CACHE_LOG2_CELLS,
+                                          RADIANCE_CACHE_CELL_SIZE);
+
+            if (!cache) {
+                perror("Could not allocate radiance cache. Aborting.\n");
+                exit(EXIT_FAILURE);
+            } /* if */
+        } /* if */
+
+        desc.settings.cache = cache;
+        desc.settings.cache_depth = depths[k];
+        fb = render_image(&desc, nx, ny, 1, &seconds);
+        used = cache ? radiance_cache_cells_used(cache, NULL) : 0;
+
+        if (cache) {
+            printf("%-7s %-2d %10.1f %10.4f %12zu\n", "bounce", depths[k],
+                   1e3 * seconds, image_rmse(fb, ref), used);
+        } else {
+            printf("%-10s %10.1f %10.4f %12s\n", "off", 1e3 * seconds,
+                   image_rmse(fb, ref), "n/a");
+        } /* if */
+
+        delete_framebuffer(fb);
+        delete_radiance_cache(cache);
+    } /* for */
+
+    delete_framebuffer(ref);
+}
+
+int
+main(int argc, char **argv)
+{
+    long num_spheres = 100000;
+    long num_rays = 1000000;
+    long width = 160, height = 80, spp = 4;
+    int a, k, hits;
+    enum bvh_layout layouts[] = { BVH_BINARY, BVH_WIDE4, BVH_WIDE8,
+                                  BVH_COMPRESSED8 };
+    double start, build_time, trace_time, t_sum;
+    vec3 *origins, *dirs, center, edge_u, edge_v;
+    material mat;
+    scene *world;
+    hit_record rec;
+    ray r;
+
+    for (a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--spheres") == 0) {
+            num_spheres = parse_count(argv[a], argv[a + 1]);
+            a++;
+        } else if (strcmp(argv[a], "--rays") == 0) {
+            num_rays = parse_count(argv[a], argv[a + 1]);
+            a++;
+        } else if (strcmp(argv[a], "--width") == 0) {
+            width = parse_count(argv[a], argv[a + 1]);
+            a++;
+        } else if (strcmp(argv[a], "--height") == 0) {
+            height = parse_count(argv[a], argv[a + 1]);
+            a++;
+        } else if (strcmp(argv[a], "--spp") == 0) {
+            spp = parse_count(argv[a], argv[a + 1]);
+            a++;
+        } else {
+            fprintf(stderr, "Usage: %s [--spheres N] [--rays N] [--width N]"
+                    " [--height N] [--spp N]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        } /* if */
+    } /* for */
+
+    world = create_scene();
+    origins = malloc((size_t)num_rays * sizeof(vec3));
+    dirs = malloc((size_t)num_rays * sizeof(vec3));
+
+    if (!world || !origins || !dirs) {
+        perror("Could not allocate benchmark data. Aborting.\n");
+        exit(EXIT_FAILURE);
+    } /* if */
+
+    set_elems(&center, 0.6f, 0.6f, 0.6f);
+    make_lambertian(&mat, &center);
+    add_material(world, &mat);
+    set_elems(&center, 0, 0, -1);
+    add_sphere(world, &center, 0.5f, 0);
+    set_elems(&center, 0, -100.5f, -1);
+    add_sphere(world, &center, 100.0f, 0);
+
+    if (add_random_spheres(world, (int)num_spheres, 1, 0, 0) != 0) {
+        perror("Could not build scene. Aborting.\n");
+        exit(EXIT_FAILURE);
+    } /* if */
+
+    make_rays(origins, dirs, (int)num_rays);
+
+    printf("%ld spheres, %ld rays\n", num_spheres + 2, num_rays);
+    printf("%-8s %10s %10s %12s %10s %10s %12s\n", "layout", "build ms",
+           "nodes", "bytes/prim", "trace ms", "Mrays/s", "hits");
+
+    for (k = 0; k < (int)(sizeof(layouts) / sizeof(layouts[0])); k++) {
+        start = now();
+
+        if (build_scene(world, layouts[k]) != 0) {
+            perror("Could not build hierarchy. Aborting.\n");
+            exit(EXIT_FAILURE);
+        } /* if */
+
+        build_time = now() - start;
+        hits = 0;
+        t_sum = 0;
+        start = now();
+
+        for (a = 0; a < num_rays; a++) {
+            set_ray_vectors(&r, &origins[a], &dirs[a]);
+
+            if (hit_scene(world, NULL, &r, 0.001f, FLT_MAX, &rec)) {
+                hits++;
+                t_sum += rec.t;
+            } /* if */
+        } /* for */
+
+        trace_time = now() - start;
+
+        printf("%-8s %10.1f %10d %12.1f %10.1f %10.2f %12d\n",
+               bvh_layout_name(layouts[k]), 1e3 * build_time,
+               bvh_node_count(world->accel),
+               (double)bvh_size_bytes(world->accel)
+               / (double)world->num_spheres,
+               1e3 * trace_time, 1e-6 * (double)num_rays / trace_time, hits);
+        fprintf(stderr, "%s: sum of hit distances %.3f\n",
+                bvh_layout_name(layouts[k]), t_sum);
+    } /* for */
+
+    /* A quad light over the clutter, for paths that bounce around in it */
+    set_elems(&center, 4.0f, 4.0f, 4.0f);
+    make_light(&mat, &center);
+    set_elems(&center, -3.0f, 1.5f, -6.0f);
+    set_elems(&edge_u, 6.0f, 0, 0);
+    set_elems(&edge_v, 0, 0, 4.0f);
+
+    if (add_quad(world, &center, &edge_u, &edge_v, add_material(world, &mat))
+            < 0
+        || build_scene(world, BVH_WIDE4) != 0) {
+        perror("Could not build scene. Aborting.\n");
+        exit(EXIT_FAILURE);
+    } /* if */
+
+    bench_ray_orders(world, (int)width, (int)height, (int)spp);
+    bench_radiance_cache(world, (int)width, (int)height, (int)spp);
+
+    free(origins);
+    free(dirs);
+    delete_scene(world);
+
+    return 0;
+}
+/* EOF */
@@ -0,0 +1,1417 @@
+#include <float.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+#include "../include/bvh.h"
+
+#define SAH_BINS 16
+#define MAX_LEAF_SIZE 4
+#define STACK_SIZE 512
+
+/* Deepest level split with the SAH. Below it nodes are split at the median,
+ * halving the prims every level, so no tree is deeper than MAX_DEPTH */
+#define MAX_SAH_DEPTH 32
+#define MAX_DEPTH (MAX_SAH_DEPTH + 31)
+
+/* Every level of a wide node adds at most 7 entries to the traversal stack */
+_Static_assert(7 * MAX_DEPTH + 1 <= STACK_SIZE,
+               "traversal stack too small for the deepest tree");
+#define SAVED_MAGIC "RTWBVH1"
+#define SAVED_ALIGN 64
+
+typedef struct build_node_t build_node;
+typedef struct wide_node_t wide_node;
+typedef struct bvh4_node_t bvh4_node;
+typedef struct bvh8_node_t bvh8_node;
+typedef struct cbvh8_node_t cbvh8_node;
+
+/* Binary tree node. Leaves have count > 0 and own prims [first, first+count) */
+struct build_node_t
+{
+    aabb box;
+    int left, right;
+    int first, count;
+};
+
+/* Collapsed node before it is packed into its SIMD layout */
+struct wide_node_t
+{
+    int lanes;
+    aabb box[8];
+    int child[8];
+    int count[8];
+};
+
+/*
+ * Wide nodes keep each bound of all children in one vector so a single slab
+ * test covers every child. Children are packed into the first `lanes` lanes.
+ * A lane with count > 0 is a leaf owning prims [child, child+count), otherwise
+ * child is the index of another node
+ */
+struct bvh4_node_t
+{
+    _Alignas(16) float bmin[3][4];
+    float bmax[3][4];
+    int child[4];
+    int count[4];
+    int lanes;
+};
+
+struct bvh8_node_t
+{
+    _Alignas(32) float bmin[3][8];
+    float bmax[3][8];
+    int child[8];
+    int count[8];
+    int lanes;
+};
+
+/*
+ * Compressed eight wide node, 80 bytes against 288 for bvh8_node. Child
+ * bounds are 8 bit steps of 2^exponent from origin, rounded outwards so they
+ * still enclose the children. Inner children are stored next to each other
+ * from child_base in lane order, and the prims of all leaf lanes likewise
+ * from prim_base. The meta byte of a leaf lane holds its prim offset from
+ * prim_base in the top 5 bits and its prim count in the low 3, and is 0 for
+ * unused lanes
+ */
+struct cbvh8_node_t
+{
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t inner_mask;
+    uint32_t child_base;
+    uint32_t prim_base;
+    uint8_t meta[8];
+    uint8_t qmin[3][8];
+    uint8_t qmax[3][8];
+};
+
+struct bvh_t
+{
+    enum bvh_layout layout;
+    int *prims;
+    int num_prims;
+    build_node *nodes;
+    int num_nodes;
+    void *wide;
+    int num_wide;
+    bool mapped;        /* The arrays live in memory the hierarchy does not
+                         * own */
+};
+
+typedef struct builder_t builder;
+
+struct builder_t
+{
+    const aabb *bounds;
+    vec3 *centroids;
+    int *prims;
+    build_node *nodes;
+    int num_nodes;
+};
+
+/* Traversal stack entry. count > 0 means a leaf, otherwise first is a node */
+struct stack_entry
+{
+    int first, count;
+    float t;
+};
+
+/* Makes a leaf out of prims [first, first+count) */
+static int
+make_leaf(builder *bld, int node, int first, int count)
+{
+    bld->nodes[node].first = first;
+    bld->nodes[node].count = count;
+    bld->nodes[node].left = bld->nodes[node].right = -1;
+
+    return node;
+}
+
+/* Reorders prims [first, first+count) so the kth has the kth smallest
+ * centroid along an axis, smaller ones before it and greater ones after */
+static void
+select_prim(builder *bld, int first, int count, int k, int axis)
+{
+    int *p = bld->prims + first;
+    int lo = 0, hi = count - 1, i, j, tmp;
+    float pivot;
+
+    while (hi > lo) {
+        pivot = bld->centroids[p[lo + (hi - lo) / 2]].e[axis];
+
+        for (i = lo, j = hi; i <= j; ) {
+            while (bld->centroids[p[i]].e[axis] < pivot) {
+                i++;
+            } /* while */
+
+            while (bld->centroids[p[j]].e[axis] > pivot) {
+                j--;
+            } /* while */
+
+            if (i <= j) {
+                tmp = p[i];
+                p[i++] = p[j];
+                p[j--] = tmp;
+            } /* if */
+        } /* for */
+
+        if (k <= j) {
+            hi = j;
+        } else if (k >= i) {
+            lo = i;
+        } else {
+            break;
+        } /* if */
+    } /* while */
+}
+
+/* Recursively builds the binary tree over prims [first, first+count), whose
+ * node is depth levels below the root */
+static int
+build_recursive(builder *bld, int first, int count, int depth)
+{
+    int node = bld->num_nodes++;
+    int i, b, axis, best_split = -1, mid;
+    float extent, lo, best_cost = FLT_MAX, leaf_cost;
+    aabb centroid_box, bin_box[SAH_BINS], left_box, right_box[SAH_BINS];
+    int bin_count[SAH_BINS], right_count[SAH_BINS], left_count;
+    build_node *n = &bld->nodes[node];
+
+    empty_aabb(&n->box);
+    empty_aabb(&centroid_box);
+
+    for (i = first; i < first + count; i++) {
+        merge_aabb(&n->box, &bld->bounds[bld->prims[i]]);
+        extend_aabb(&centroid_box, &bld->centroids[bld->prims[i]]);
+    } /* for */
+
+    if (count == 1) {
+        return make_leaf(bld, node, first, count);
+    } /* if */
+
+    axis = 0;
+
+    for (i = 1; i < 3; i++) {
+        if (centroid_box.max.e[i] - centroid_box.min.e[i]
+            > centroid_box.max.e[axis] - centroid_box.min.e[axis]) {
+            axis = i;
+        } /* if */
+    } /* for */
+
+    lo = centroid_box.min.e[axis];
+    extent = centroid_box.max.e[axis] - lo;
+
+    if (extent <= 0) {
+        if (count <= MAX_LEAF_SIZE) {
+            return make_leaf(bld, node, first, count);
+        } /* if */
+
+        /* All centroids coincide, any split is as good as another */
+        mid = first + count / 2;
+    } else if (depth >= MAX_SAH_DEPTH) {
+        if (count <= MAX_LEAF_SIZE) {
+            return make_leaf(bld, node, first, count);
+        } /* if */
+
+        mid = first + count / 2;
+        select_prim(bld, first, count, count / 2, axis);
+    } else {
+        for (b = 0; b < SAH_BINS; b++) {
+            empty_aabb(&bin_box[b]);
+            bin_count[b] = 0;
+        } /* for */
+
+        for (i = first; i < first + count; i++) {
+            int p = bld->prims[i];
+
+            b = (int)((bld->centroids[p].e[axis] - lo) / extent * SAH_BINS);
+            b = b < SAH_BINS ? b : SAH_BINS - 1;
+            merge_aabb(&bin_box[b], &bld->bounds[p]);
+            bin_count[b]++;
+        } /* for */
+
+        /* Sweep from the right to get the cost of every split in one pass */
+        empty_aabb(&right_box[SAH_BINS - 1]);
+        merge_aabb(&right_box[SAH_BINS - 1], &bin_box[SAH_BINS - 1]);
+        right_count[SAH_BINS - 1] = bin_count[SAH_BINS - 1];
+
+        for (b = SAH_BINS - 2; b >= 0; b--) {
+            right_box[b] = right_box[b + 1];
+            merge_aabb(&right_box[b], &bin_box[b]);
+            right_count[b] = right_count[b + 1] + bin_count[b];
+        } /* for */
+
+        empty_aabb(&left_box);
+        left_count = 0;
+
+        for (b = 0; b < SAH_BINS - 1; b++) {
+            float cost;
+
+            merge_aabb(&left_box, &bin_box[b]);
+            left_count += bin_count[b];
+
+            if (left_count == 0 || right_count[b + 1] == 0) {
+                continue;
+            } /* if */
+
+            cost = aabb_surface_area(&left_box) * (float)left_count
+                   + aabb_surface_area(&right_box[b + 1])
+                     * (float)right_count[b + 1];
+
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = b;
+            } /* if */
+        } /* for */
+
+        /* Traversing a node costs about as much as one primitive test */
+        leaf_cost = aabb_surface_area(&n->box) * (float)(count - 1);
+
+        if (count <= MAX_LEAF_SIZE
+            && (best_split < 0 || leaf_cost <= best_cost)) {
+            return make_leaf(bld, node, first, count);
+        } /* if */
+
+        if (best_split < 0) {
+            mid = first + count / 2;
+        } else {
+            int *lo_p = bld->prims + first;
+            int *hi_p = bld->prims + first + count - 1;
+
+            while (lo_p <= hi_p) {
+                int p = *lo_p;
+
+                b = (int)((bld->centroids[p].e[axis] - lo) / extent
+                          * SAH_BINS);
+                b = b < SAH_BINS ? b : SAH_BINS - 1;
+
+                if (b <= best_split) {
+                    lo_p++;
+                } else {
+                    *lo_p = *hi_p;
+                    *hi_p-- = p;
+                } /* if */
+            } /* while */
+
+            mid = (int)(lo_p - bld->prims);
+        } /* if */
+    } /* if */
+
+    n->count = 0;
+    n->first = -1;
+    n->left = build_recursive(bld, first, mid - first, depth + 1);
+    bld->nodes[node].right = build_recursive(bld, mid, first + count - mid,
+                                             depth + 1);
+
+    return node;
+}
+
+/* Collapses the binary subtree at node into wide nodes, returns its index */
+static int
+collapse(const bvh *b, int node, int width, wide_node **wide, int *num_wide,
+         int *cap)
+{
+    int kids[8], lanes, k, index;
+    wide_node w;
+
+    if (b->nodes[node].count > 0) {
+        /* A lone leaf root still needs a node around it */
+        kids[0] = node;
+        lanes = 1;
+    } else {
+        kids[0] = b->nodes[node].left;
+        kids[1] = b->nodes[node].right;
+        lanes = 2;
+    } /* if */
+
+    /* Open up the largest inner child until all lanes are used */
+    while (lanes < width) {
+        int best = -1;
+        float best_area = -1;
+
+        for (k = 0; k < lanes; k++) {
+            const build_node *c = &b->nodes[kids[k]];
+            float area = aabb_surface_area(&c->box);
+
+            if (c->count == 0 && area > best_area) {
+                best = k;
+                best_area = area;
+            } /* if */
+        } /* for */
+
+        if (best < 0) {
+            break;
+        } /* if */
+
+        kids[lanes++] = b->nodes[kids[best]].right;
+        kids[best] = b->nodes[kids[best]].left;
+    } /* while */
+
+    if (*num_wide == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        *wide = realloc(*wide, (size_t)*cap * sizeof(**wide));
+
+        if (!*wide) {
+            return -1;
+        } /* if */
+    } /* if */
+
+    index = (*num_wide)++;
+    w.lanes = lanes;
+
+    for (k = 0; k < lanes; k++) {
+        const build_node *c = &b->nodes[kids[k]];
+
+        w.box[k] = c->box;
+
+        if (c->count > 0) {
+            w.child[k] = c->first;
+            w.count[k] = c->count;
+        } else {
+            w.child[k] = collapse(b, kids[k], width, wide, num_wide, cap);
+            w.count[k] = 0;
+
+            if (w.child[k] < 0) {
+                return -1;
+            } /* if */
+        } /* if */
+    } /* for */
+
+    (*wide)[index] = w;
+
+    return index;
+}
+
+/* Copies collapsed nodes into the SoA layout of the given width */
+static void *
+pack_wide(const wide_node *wide, int num_wide, int width)
+{
+    size_t stride = width == 4 ? sizeof(bvh4_node) : sizeof(bvh8_node);
+    size_t size = stride * (size_t)num_wide;
+    char *out;
+    int i, k, axis;
+
+    /* aligned_alloc wants the size to be a multiple of the alignment */
+    size = (size + 63) & ~(size_t)63;
+    out = aligned_alloc(64, size);
+
+    if (!out) {
+        return NULL;
+    } /* if */
+
+    memset(out, 0, size);
+
+    for (i = 0; i < num_wide; i++) {
+        const wide_node *w = &wide[i];
+
+        for (k = 0; k < w->lanes; k++) {
+            for (axis = 0; axis < 3; axis++) {
+                if (width == 4) {
+                    bvh4_node *n = (bvh4_node *)(out + stride * i);
+
+                    n->bmin[axis][k] = w->box[k].min.e[axis];
+                    n->bmax[axis][k] = w->box[k].max.e[axis];
+                } else {
+                    bvh8_node *n = (bvh8_node *)(out + stride * i);
+
+                    n->bmin[axis][k] = w->box[k].min.e[axis];
+                    n->bmax[axis][k] = w->box[k].max.e[axis];
+                } /* if */
+            } /* for */
+        } /* for */
+
+        if (width == 4) {
+            bvh4_node *n = (bvh4_node *)(out + stride * i);
+
+            memcpy(n->child, w->child, sizeof(n->child));
+            memcpy(n->count, w->count, sizeof(n->count));
+            n->lanes = w->lanes;
+        } else {
+            bvh8_node *n = (bvh8_node *)(out + stride * i);
+
+            memcpy(n->child, w->child, sizeof(n->child));
+            memcpy(n->count, w->count, sizeof(n->count));
+            n->lanes = w->lanes;
+        } /* if */
+    } /* for */
+
+    return out;
+}
+
+/* Picks the smallest power of two step that spans an extent in 255 steps */
+static int
+quantize_exponent(float extent)
+{
+    int e;
+
+    if (!(extent > 0)) {
+        return -126;
+    } /* if */
+
+    e = (int)ceil(log2(extent / 255.0f));
+
+    while (ldexp(255.0f, e) < extent) {
+        e++;
+    } /* while */
+
+    return e < -126 ? -126 : (e > 127 ? 127 : e);
+}
+
+/* Quantizes one child bound, rounding down for a min and up for a max */
+static uint8_t
+quantize_bound(float value, float origin, float step, bool up)
+{
+    float q = up ? ceil((value - origin) / step) : floor((value - origin)
+                                                         / step);
+
+    /* Division rounding must not move the bound inwards */
+    if (up) {
+        while (q < 255 && origin + q * step < value) {
+            q++;
+        } /* while */
+    } else {
+        while (q > 0 && origin + q * step > value) {
+            q--;
+        } /* while */
+    } /* if */
+
+    return (uint8_t)(q < 0 ? 0 : (q > 255 ? 255 : q));
+}
+
+/*
+ * Packs collapsed nodes into compressed nodes, renumbering them breadth first
+ * so the inner children of every node are neighbours, and reorders the prims
+ * so the leaves of every node are too
+ */
+static void *
+pack_compressed(bvh *b, const wide_node *wide, int num_wide)
+{
+    size_t size = ((size_t)num_wide * sizeof(cbvh8_node) + 63)
+                  & ~(size_t)63;
+    cbvh8_node *out = aligned_alloc(64, size);
+    int *order = malloc((size_t)num_wide * sizeof(int));
+    int *prims = malloc((size_t)b->num_prims * sizeof(int));
+    int i, k, axis, next = 1, cursor = 0;
+
+    if (!out || !order || !prims) {
+        free(out);
+        free(order);
+        free(prims);
+        return NULL;
+    } /* if */
+
+    memset(out, 0, size);
+    order[0] = 0;
+
+    for (i = 0; i < num_wide; i++) {
+        const wide_node *w = &wide[order[i]];
+        cbvh8_node *n = &out[i];
+        float step[3];
+        aabb box;
+
+        empty_aabb(&box);
+
+        for (k = 0; k < w->lanes; k++) {
+            merge_aabb(&box, &w->box[k]);
+        } /* for */
+
+        for (axis = 0; axis < 3; axis++) {
+            n->origin[axis] = box.min.e[axis];
+            n->exponent[axis] = (int8_t)quantize_exponent(box.max.e[axis]
+                                                          - box.min.e[axis]);
+            step[axis] = ldexp(1.0f, n->exponent[axis]);
+        } /* for */
+
+        n->child_base = (uint32_t)next;
+        n->prim_base = (uint32_t)cursor;
+
+        for (k = 0; k < w->lanes; k++) {
+            for (axis = 0; axis < 3; axis++) {
+                n->qmin[axis][k] = quantize_bound(w->box[k].min.e[axis],
+                                                  n->origin[axis], step[axis],
+                                                  false);
+                n->qmax[axis][k] = quantize_bound(w->box[k].max.e[axis],
+                                                  n->origin[axis], step[axis],
+                                                  true);
+            } /* for */
+
+            if (w->count[k] > 0) {
+                n->meta[k] = (uint8_t)((cursor - (int)n->prim_base) << 3
+                                       | w->count[k]);
+                memcpy(prims + cursor, b->prims + w->child[k],
+                       (size_t)w->count[k] * sizeof(int));
+                cursor += w->count[k];
+            } else {
+                n->inner_mask |= (uint8_t)(1u << k);
+                order[next++] = w->child[k];
+            } /* if */
+        } /* for */
+    } /* for */
+
+    free(order);
+    free(b->prims);
+    b->prims = prims;
+
+    return out;
+}
+
+/* Builds a hierarchy over the given bounds */
+bvh *
+build_bvh(const aabb *bounds, int count, enum bvh_layout layout)
+{
+    bvh *b = calloc(1, sizeof(*b));
+    builder bld;
+    int i;
+
+    if (!b) {
+        return NULL;
+    } /* if */
+
+    b->layout = layout;
+    b->num_prims = count;
+    b->prims = malloc((size_t)(count > 0 ? count : 1) * sizeof(int));
+    b->nodes = malloc((size_t)(count > 0 ? 2 * count - 1 : 1)
+                      * sizeof(build_node));
+    bld.centroids = malloc((size_t)(count > 0 ? count : 1) * sizeof(vec3));
+
+    if (!b->prims || !b->nodes || !bld.centroids) {
+        free(bld.centroids);
+        delete_bvh(b);
+        return NULL;
+    } /* if */
+
+    for (i = 0; i < count; i++) {
+        b->prims[i] = i;
+        aabb_center(&bounds[i], &bld.centroids[i]);
+    } /* for */
+
+    bld.bounds = bounds;
+    bld.prims = b->prims;
+    bld.nodes = b->nodes;
+    bld.num_nodes = 0;
+
+    if (count > 0) {
+        build_recursive(&bld, 0, count, 0);
+    } /* if */
+
+    free(bld.centroids);
+    b->num_nodes = bld.num_nodes;
+
+    if (layout != BVH_BINARY && count > 0) {
+        wide_node *wide = NULL;
+        int cap = 0;
+        int width = layout == BVH_WIDE4 ? 4 : 8;
+
+        if (collapse(b, 0, width, &wide, &b->num_wide, &cap) < 0) {
+            free(wide);
+            delete_bvh(b);
+            return NULL;
+        } /* if */
+
+        b->wide = layout == BVH_COMPRESSED8
+                  ? pack_compressed(b, wide, b->num_wide)
+                  : pack_wide(wide, b->num_wide, width);
+
+        free(wide);
+        free(b->nodes);
+        b->nodes = NULL;
+
+        if (!b->wide) {
+            delete_bvh(b);
+            return NULL;
+        } /* if */
+    } /* if */
+
+    return b;
+}
+
+/* Gets the size of one node of a wide layout */
+static size_t
+wide_node_size(enum bvh_layout layout)
+{
+    switch (layout) {
+    case BVH_WIDE4:
+        return sizeof(bvh4_node);
+    case BVH_COMPRESSED8:
+        return sizeof(cbvh8_node);
+    default:
+        return sizeof(bvh8_node);
+    } /* switch */
+}
+
+/* Copies a hierarchy into memory allocated by the calling thread */
+bvh *
+copy_bvh(const bvh *src)
+{
+    bvh *b = calloc(1, sizeof(*b));
+    size_t stride = wide_node_size(src->layout);
+    size_t size;
+
+    if (!b) {
+        return NULL;
+    } /* if */
+
+    *b = *src;
+    b->mapped = false;
+    b->nodes = NULL;
+    b->wide = NULL;
+    b->prims = malloc((size_t)(src->num_prims > 0 ? src->num_prims : 1)
+                      * sizeof(int));
+
+    if (!b->prims) {
+        delete_bvh(b);
+        return NULL;
+    } /* if */
+
+    memcpy(b->prims, src->prims, (size_t)src->num_prims * sizeof(int));
+
+    if (src->nodes) {
+        size = (size_t)src->num_nodes * sizeof(build_node);
+        b->nodes = malloc(size > 0 ? size : 1);
+
+        if (!b->nodes) {
+            delete_bvh(b);
+            return NULL;
+        } /* if */
+
+        memcpy(b->nodes, src->nodes, size);
+    } /* if */
+
+    if (src->wide) {
+        size = (stride * (size_t)src->num_wide + 63) & ~(size_t)63;
+        b->wide = aligned_alloc(64, size);
+
+        if (!b->wide) {
+            delete_bvh(b);
+            return NULL;
+        } /* if */
+
+        memcpy(b->wide, src->wide, size);
+    } /* if */
+
+    return b;
+}
+
+/* Rounds a size up to the alignment of the parts of a saved hierarchy */
+static size_t
+saved_align(size_t size)
+{
+    return (size + SAVED_ALIGN - 1) & ~(size_t)(SAVED_ALIGN - 1);
+}
+
+/* Writes a block and pads it to the alignment */
+static int
+write_aligned(FILE *f, const void *data, size_t size)
+{
+    static const char zeros[SAVED_ALIGN];
+    size_t pad = saved_align(size) - size;
+
+    return fwrite(data, 1, size, f) == size
+           && fwrite(zeros, 1, pad, f) == pad ? 0 : -1;
+}
+
+/* Writes a hierarchy to a file */
+int
+save_bvh(const bvh *b, FILE *f)
+{
+    char header[SAVED_ALIGN];
+    int32_t counts[4];
+    size_t nodes;
+
+    nodes = b->nodes ? (size_t)b->num_nodes * sizeof(build_node)
+                     : (size_t)b->num_wide * wide_node_size(b->layout);
+    counts[0] = (int32_t)b->layout;
+    counts[1] = b->num_prims;
+    counts[2] = b->nodes ? b->num_nodes : 0;
+    counts[3] = b->wide ? b->num_wide : 0;
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, SAVED_MAGIC, 8);
+    memcpy(header + 8, counts, sizeof(counts));
+
+    return write_aligned(f, header, sizeof(header))
+           || write_aligned(f, b->prims, (size_t)b->num_prims * sizeof(int))
+           || write_aligned(f, b->nodes ? (const void *)b->nodes : b->wide,
+                            nodes) ? -1 : 0;
+}
+
+/* Checks one child of a saved node: a leaf must stay inside the prims, and
+ * an inner child must come after its parent and not be deeper than the
+ * traversal stack allows. Records the depth of inner children */
+static int
+check_saved_child(const bvh *b, int num_nodes, unsigned char *depth, int node,
+                  int64_t child, int count)
+{
+    if (count > 0) {
+        return child >= 0 && count <= b->num_prims
+               && child <= b->num_prims - count ? 0 : -1;
+    } /* if */
+
+    if (count < 0 || child <= node || child >= num_nodes
+        || depth[node] >= MAX_DEPTH) {
+        return -1;
+    } /* if */
+
+    if (depth[child] < depth[node] + 1) {
+        depth[child] = (unsigned char)(depth[node] + 1);
+    } /* if */
+
+    return 0;
+}
+
+/* Checks every index of a mapped hierarchy, so a damaged file can not send
+ * traversal outside its arrays or the primitives it indexes. Children are
+ * always stored after their parents, which rules out cycles too */
+static int
+check_saved(const bvh *b, int num_prims)
+{
+    int num_nodes = b->layout == BVH_BINARY ? b->num_nodes : b->num_wide;
+    int width = b->layout == BVH_WIDE4 ? 4 : 8;
+    unsigned char *depth;
+    int i, k, err = 0;
+
+    if (b->num_prims != num_prims || (num_prims > 0 && num_nodes == 0)) {
+        return -1;
+    } /* if */
+
+    for (i = 0; i < b->num_prims; i++) {
+        if (b->prims[i] < 0 || b->prims[i] >= num_prims) {
+            return -1;
+        } /* if */
+    } /* for */
+
+    depth = calloc((size_t)(num_nodes > 0 ? num_nodes : 1), 1);
+
+    if (!depth) {
+        return -1;
+    } /* if */
+
+    for (i = 0; i < num_nodes && !err; i++) {
+        if (b->layout == BVH_BINARY) {
+            const build_node *n = &b->nodes[i];
+
+            err = n->count > 0
+                  ? check_saved_child(b, num_nodes, depth, i, n->first,
+                                      n->count)
+                  : check_saved_child(b, num_nodes, depth, i, n->left, 0)
+                    || check_saved_child(b, num_nodes, depth, i, n->right,
+                                         0);
+        } else if (b->layout == BVH_COMPRESSED8) {
+            const cbvh8_node *n = (const cbvh8_node *)b->wide + i;
+            int inner = 0;
+
+            for (k = 0; k < 8 && !err; k++) {
+                if (n->inner_mask >> k & 1) {
+                    err = check_saved_child(b, num_nodes, depth, i,
+                                            (int64_t)n->child_base + inner++,
+                                            0);
+                } else if (n->meta[k] & 7) {
+                    err = check_saved_child(b, num_nodes, depth, i,
+                                            (int64_t)n->prim_base
+                                            + (n->meta[k] >> 3),
+                                            n->meta[k] & 7);
+                } /* if */
+            } /* for */
+        } else {
+            const int *child, *count;
+            int lanes;
+
+            if (width == 4) {
+                const bvh4_node *n = (const bvh4_node *)b->wide + i;
+
+                child = n->child;
+                count = n->count;
+                lanes = n->lanes;
+            } else {
+                const bvh8_node *n = (const bvh8_node *)b->wide + i;
+
+                child = n->child;
+                count = n->count;
+                lanes = n->lanes;
+            } /* if */
+
+            err = lanes < 0 || lanes > width;
+
+            for (k = 0; k < lanes && !err; k++) {
+                err = check_saved_child(b, num_nodes, depth, i, child[k],
+                                        count[k]);
+            } /* for */
+        } /* if */
+    } /* for */
+
+    free(depth);
+
+    return err ? -1 : 0;
+}
+
+/* Makes a hierarchy out of a saved one in place */
+bvh *
+map_bvh(const void *data, size_t size, int num_prims)
+{
+    const char *base = data;
+    size_t prims, nodes;
+    int32_t counts[4];
+    bvh *b;
+
+    if (size < SAVED_ALIGN || memcmp(base, SAVED_MAGIC, 8) != 0) {
+        return NULL;
+    } /* if */
+
+    memcpy(counts, base + 8, sizeof(counts));
+
+    if (counts[0] < BVH_BINARY || counts[0] > BVH_COMPRESSED8
+        || counts[1] < 0 || counts[2] < 0 || counts[3] < 0
+        || (counts[0] == BVH_BINARY ? counts[3] : counts[2]) != 0) {
+        return NULL;
+    } /* if */
+
+    prims = saved_align((size_t)counts[1] * sizeof(int));
+    nodes = counts[0] == BVH_BINARY
+            ? (size_t)counts[2] * sizeof(build_node)
+            : (size_t)counts[3] * wide_node_size((enum bvh_layout)counts[0]);
+
+    if (size < SAVED_ALIGN + prims + nodes) {
+        return NULL;
+    } /* if */
+
+    b = calloc(1, sizeof(*b));
+
+    if (!b) {
+        return NULL;
+    } /* if */
+
+    /* Traversal never writes, so the arrays may be read only pages */
+    b->layout = (enum bvh_layout)counts[0];
+    b->num_prims = counts[1];
+    b->prims = (int *)(base + SAVED_ALIGN);
+    b->mapped = true;
+
+    if (b->layout == BVH_BINARY) {
+        b->nodes = (build_node *)(base + SAVED_ALIGN + prims);
+        b->num_nodes = counts[2];
+    } else {
+        b->wide = (void *)(base + SAVED_ALIGN + prims);
+        b->num_wide = counts[3];
+    } /* if */
+
+    if (check_saved(b, num_prims) != 0) {
+        free(b);
+        return NULL;
+    } /* if */
+
+    return b;
+}
+
+/* Deletes a hierarchy */
+void
+delete_bvh(bvh *b)
+{
+    if (!b) {
+        return;
+    } /* if */
+
+    if (b->mapped) {
+        free(b);
+        return;
+    } /* if */
+
+    free(b->prims);
+    free(b->nodes);
+    free(b->wide);
+    free(b);
+}
+
+/* Tests a ray against one box, returns the entry distance through tnear */
+static bool
+slab_test(const aabb *box, const float *o, const float *inv, float t_min,
+          float t_max, float *tnear)
+{
+    int k;
+
+    for (k = 0; k < 3; k++) {
+        float t0 = (box->min.e[k] - o[k]) * inv[k];
+        float t1 = (box->max.e[k] - o[k]) * inv[k];
+
+        t_min = fmaxf(t_min, fminf(t0, t1));
+        t_max = fminf(t_max, fmaxf(t0, t1));
+    } /* for */
+
+    *tnear = t_min;
+
+    return t_min <= t_max;
+}
+
+/* Intersects the prims of a leaf, shrinking *closest on every hit. An any
+ * hit query stops at the first hit */
+static bool
+hit_leaf(const bvh *b, int first, int count, const ray *r, float t_min,
+         float *closest, bool any, prim_hit_fn hit, const void *data,
+         hit_record *rec)
+{
+    bool found = false;
+    int i;
+
+    for (i = first; i < first + count; i++) {
+        if (hit(data, b->prims[i], r, t_min, *closest, rec)) {
+            *closest = rec->t;
+            rec->prim = b->prims[i];
+            found = true;
+
+            if (any) {
+                break;
+            } /* if */
+        } /* if */
+    } /* for */
+
+    return found;
+}
+
+/* Sorts hit children nearest first and pushes them so the nearest pops next.
+ * Any hit queries skip the sort since every blocker is as good as another */
+static void
+push_sorted(struct stack_entry *stack, int *top, struct stack_entry *hits,
+            int num_hits, bool any)
+{
+    int i, j;
+
+    for (i = 1; i < num_hits && !any; i++) {
+        struct stack_entry e = hits[i];
+
+        for (j = i; j > 0 && hits[j - 1].t > e.t; j--) {
+            hits[j] = hits[j - 1];
+        } /* for */
+
+        hits[j] = e;
+    } /* for */
+
+    for (i = num_hits - 1; i >= 0; i--) {
+        stack[(*top)++] = hits[i];
+    } /* for */
+}
+
+/* Closest or any hit through the binary layout */
+static bool
+traverse_binary(const bvh *b, const ray *r, const float *o, const float *inv,
+                float t_min, float closest, bool any, prim_hit_fn hit,
+                const void *data, hit_record *rec)
+{
+    struct stack_entry stack[STACK_SIZE], hits[2];
+    int top = 0;
+    bool found = false;
+    float t;
+
+    if (!slab_test(&b->nodes[0].box, o, inv, t_min, closest, &t)) {
+        return false;
+    } /* if */
+
+    stack[top].first = 0;
+    stack[top].count = 0;
+    stack[top++].t = t;
+
+    while (top > 0) {
+        struct stack_entry e = stack[--top];
+        const build_node *n = &b->nodes[e.first];
+        int num_hits = 0;
+
+        if (e.t > closest) {
+            continue;
+        } /* if */
+
+        if (n->count > 0) {
+            found |= hit_leaf(b, n->first, n->count, r, t_min, &closest, any,
+                              hit, data, rec);
+
+            if (found && any) {
+                return true;
+            } /* if */
+
+            continue;
+        } /* if */
+
+        if (slab_test(&b->nodes[n->left].box, o, inv, t_min, closest, &t)) {
+            hits[num_hits].first = n->left;
+            hits[num_hits].count = 0;
+            hits[num_hits++].t = t;
+        } /* if */
+
+        if (slab_test(&b->nodes[n->right].box, o, inv, t_min, closest, &t)) {
+            hits[num_hits].first = n->right;
+            hits[num_hits].count = 0;
+            hits[num_hits++].t = t;
+        } /* if */
+
+        push_sorted(stack, &top, hits, num_hits, any);
+    } /* while */
+
+    return found;
+}
+
+/* Slab tests the ray against up to four children at once. Returns a bit mask
+ * of the lanes hit and their entry distances through tnear */
+static int
+slab_test4(const float (*bmin)[4], const float (*bmax)[4], const float *o,
+           const float *inv, float t_min, float t_max, float *tnear)
+{
+#if defined(__SSE__)
+    __m128 lo = _mm_set1_ps(t_min);
+    __m128 hi = _mm_set1_ps(t_max);
+    int k;
+
+    for (k = 0; k < 3; k++) {
+        __m128 ok = _mm_set1_ps(o[k]);
+        __m128 ik = _mm_set1_ps(inv[k]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bmin[k]), ok), ik);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bmax[k]), ok), ik);
+
+        lo = _mm_max_ps(lo, _mm_min_ps(t0, t1));
+        hi = _mm_min_ps(hi, _mm_max_ps(t0, t1));
+    } /* for */
+
+    _mm_storeu_ps(tnear, lo);
+
+    return _mm_movemask_ps(_mm_cmple_ps(lo, hi));
+#else
+    int k, lane, mask = 0;
+
+    for (lane = 0; lane < 4; lane++) {
+        float lo = t_min, hi = t_max;
+
+        for (k = 0; k < 3; k++) {
+            float t0 = (bmin[k][lane] - o[k]) * inv[k];
+            float t1 = (bmax[k][lane] - o[k]) * inv[k];
+
+            lo = fmaxf(lo, fminf(t0, t1));
+            hi = fminf(hi, fmaxf(t0, t1));
+        } /* for */
+
+        tnear[lane] = lo;
+        mask |= (lo <= hi) << lane;
+    } /* for */
+
+    return mask;
+#endif
+}
+
+/* Slab tests the ray against up to eight children at once */
+static int
+slab_test8(const bvh8_node *n, const float *o, const float *inv, float t_min,
+           float t_max, float *tnear)
+{
+#if defined(__AVX__)
+    __m256 lo = _mm256_set1_ps(t_min);
+    __m256 hi = _mm256_set1_ps(t_max);
+    int k;
+
+    for (k = 0; k < 3; k++) {
+        __m256 ok = _mm256_set1_ps(o[k]);
+        __m256 ik = _mm256_set1_ps(inv[k]);
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n->bmin[k]),
+                                                ok), ik);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(n->bmax[k]),
+                                                ok), ik);
+
+        lo = _mm256_max_ps(lo, _mm256_min_ps(t0, t1));
+        hi = _mm256_min_ps(hi, _mm256_max_ps(t0, t1));
+    } /* for */
+
+    _mm256_storeu_ps(tnear, lo);
+
+    return _mm256_movemask_ps(_mm256_cmp_ps(lo, hi, _CMP_LE_OQ));
+#else
+    float lo[3][4], hi[3][4];
+    int k, mask;
+
+    /* Two four wide tests, one per half of the node */
+    for (k = 0; k < 3; k++) {
+        memcpy(lo[k], n->bmin[k], sizeof(lo[k]));
+        memcpy(hi[k], n->bmax[k], sizeof(hi[k]));
+    } /* for */
+
+    mask = slab_test4((const float (*)[4])lo, (const float (*)[4])hi, o, inv,
+                      t_min, t_max, tnear);
+
+    for (k = 0; k < 3; k++) {
+        memcpy(lo[k], n->bmin[k] + 4, sizeof(lo[k]));
+        memcpy(hi[k], n->bmax[k] + 4, sizeof(hi[k]));
+    } /* for */
+
+    return mask | slab_test4((const float (*)[4])lo, (const float (*)[4])hi,
+                             o, inv, t_min, t_max, tnear + 4) << 4;
+#endif
+}
+
+/* Slab tests the ray against the dequantized children of a compressed node.
+ * Also decodes where each lane's subtree or prims are */
+static int
+slab_test_compressed(const cbvh8_node *n, const float *o, const float *inv,
+                     float t_min, float t_max, float *tnear, int *child,
+                     int *count)
+{
+    float step[3], base[3];
+    int k, lane, mask = 0, inner = 0;
+
+    for (k = 0; k < 3; k++) {
+        step[k] = ldexp(1.0f, n->exponent[k]);
+        base[k] = n->origin[k] - o[k];
+    } /* for */
+
+#if defined(__SSE2__)
+    for (lane = 0; lane < 8; lane += 4) {
+        __m128 lo = _mm_set1_ps(t_min);
+        __m128 hi = _mm_set1_ps(t_max);
+        __m128i zero = _mm_setzero_si128();
+
+        for (k = 0; k < 3; k++) {
+            __m128 sk = _mm_set1_ps(step[k]);
+            __m128 bk = _mm_set1_ps(base[k]);
+            __m128 ik = _mm_set1_ps(inv[k]);
+            int32_t qmin, qmax;
+            __m128 bmin, bmax, t0, t1;
+
+            memcpy(&qmin, n->qmin[k] + lane, sizeof(qmin));
+            memcpy(&qmax, n->qmax[k] + lane, sizeof(qmax));
+
+            /* Widen four bytes to four floats */
+            bmin = _mm_cvtepi32_ps(_mm_unpacklo_epi16(
+                       _mm_unpacklo_epi8(_mm_cvtsi32_si128(qmin), zero), zero));
+            bmax = _mm_cvtepi32_ps(_mm_unpacklo_epi16(
+                       _mm_unpacklo_epi8(_mm_cvtsi32_si128(qmax), zero), zero));
+            t0 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(bmin, sk), bk), ik);
+            t1 = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(bmax, sk), bk), ik);
+
+            lo = _mm_max_ps(lo, _mm_min_ps(t0, t1));
+            hi = _mm_min_ps(hi, _mm_max_ps(t0, t1));
+        } /* for */
+
+        _mm_storeu_ps(tnear + lane, lo);
+        mask |= _mm_movemask_ps(_mm_cmple_ps(lo, hi)) << lane;
+    } /* for */
+#else
+    for (lane = 0; lane < 8; lane++) {
+        float lo = t_min, hi = t_max;
+
+        for (k = 0; k < 3; k++) {
+            float t0 = ((float)n->qmin[k][lane] * step[k] + base[k]) * inv[k];
+            float t1 = ((float)n->qmax[k][lane] * step[k] + base[k]) * inv[k];
+
+            lo = fmaxf(lo, fminf(t0, t1));
+            hi = fminf(hi, fmaxf(t0, t1));
+        } /* for */
+
+        tnear[lane] = lo;
+        mask |= (lo <= hi) << lane;
+    } /* for */
+#endif
+
+    for (lane = 0; lane < 8; lane++) {
+        if (n->inner_mask >> lane & 1) {
+            child[lane] = (int)n->child_base + inner++;
+            count[lane] = 0;
+        } else {
+            child[lane] = (int)n->prim_base + (n->meta[lane] >> 3);
+            count[lane] = n->meta[lane] & 7;
+
+            /* Unused lanes have no prims */
+            if (count[lane] == 0) {
+                mask &= ~(1 << lane);
+            } /* if */
+        } /* if */
+    } /* for */
+
+    return mask;
+}
+
+/* Closest or any hit through a wide layout */
+static bool
+traverse_wide(const bvh *b, int width, const ray *r, const float *o,
+              const float *inv, float t_min, float closest, bool any,
+              prim_hit_fn hit, const void *data, hit_record *rec)
+{
+    struct stack_entry stack[STACK_SIZE], hits[8];
+    int top = 0;
+    bool found = false;
+
+    stack[top].first = 0;
+    stack[top].count = 0;
+    stack[top++].t = t_min;
+
+    while (top > 0) {
+        struct stack_entry e = stack[--top];
+        const int *child, *count;
+        int lane_child[8], lane_count[8];
+        float tnear[8];
+        int mask, lane, num_hits = 0;
+
+        if (e.t > closest) {
+            continue;
+        } /* if */
+
+        if (e.count > 0) {
+            found |= hit_leaf(b, e.first, e.count, r, t_min, &closest, any,
+                              hit, data, rec);
+
+            if (found && any) {
+                return true;
+            } /* if */
+
+            continue;
+        } /* if */
+
+        if (b->layout == BVH_COMPRESSED8) {
+            const cbvh8_node *n = (const cbvh8_node *)b->wide + e.first;
+
+            mask = slab_test_compressed(n, o, inv, t_min, closest, tnear,
+                                        lane_child, lane_count);
+            child = lane_child;
+            count = lane_count;
+        } else if (width == 4) {
+            const bvh4_node *n = (const bvh4_node *)b->wide + e.first;
+
+            mask = slab_test4(n->bmin, n->bmax, o, inv, t_min, closest, tnear);
+            mask &= (1 << n->lanes) - 1;
+            child = n->child;
+            count = n->count;
+        } else {
+            const bvh8_node *n = (const bvh8_node *)b->wide + e.first;
+
+            mask = slab_test8(n, o, inv, t_min, closest, tnear);
+            mask &= (1 << n->lanes) - 1;
+            child = n->child;
+            count = n->count;
+        } /* if */
+
+        for (lane = 0; mask; lane++, mask >>= 1) {
+            if (mask & 1) {
+                hits[num_hits].first = child[lane];
+                hits[num_hits].count = count[lane];
+                hits[num_hits++].t = tnear[lane];
+            } /* if */
+        } /* for */
+
+        push_sorted(stack, &top, hits, num_hits, any);
+    } /* while */
+
+    return found;
+}
+
+/* Runs a closest or any hit query through the hierarchy */
+static bool
+traverse(const bvh *b, const ray *r, float t_min, float t_max, bool any,
+         prim_hit_fn hit, const void *data, hit_record *rec)
+{
+    float o[3], inv[3];
+    int k;
+
+    if (b->num_prims == 0) {
+        return false;
+    } /* if */
+
+    for (k = 0; k < 3; k++) {
+        o[k] = origin(r)->e[k];
+        inv[k] = 1.0f / direction(r)->e[k];
+    } /* for */
+
+    switch (b->layout) {
+    case BVH_WIDE4:
+        return traverse_wide(b, 4, r, o, inv, t_min, t_max, any, hit, data,
+                             rec);
+    case BVH_WIDE8:
+    case BVH_COMPRESSED8:
+        return traverse_wide(b, 8, r, o, inv, t_min, t_max, any, hit, data,
+                             rec);
+    default:
+        return traverse_binary(b, r, o, inv, t_min, t_max, any, hit, data,
+                               rec);
+    } /* switch */
+}
+
+/* Finds the closest primitive a ray hits */
+bool
+bvh_closest_hit(const bvh *b, const ray *r, float t_min, float t_max,
+                prim_hit_fn hit, const void *data, hit_record *rec)
+{
+    return traverse(b, r, t_min, t_max, false, hit, data, rec);
+}
+
+/* Checks whether a ray hits any primitive */
+bool
+bvh_any_hit(const bvh *b, const ray *r, float t_min, float t_max,
+            prim_hit_fn hit, const void *data)
+{
+    hit_record rec;
+
+    return traverse(b, r, t_min, t_max, true, hit, data, &rec);
+}
+
+/* Gets the layout of a hierarchy */
+enum bvh_layout
+bvh_get_layout(const bvh *b)
+{
+    return b->layout;
+}
+
+/* Gets the node count */
+int
+bvh_node_count(const bvh *b)
+{
+    return b->layout == BVH_BINARY ? b->num_nodes : b->num_wide;
+}
+
+/* Gets the memory used by the hierarchy */
+size_t
+bvh_size_bytes(const bvh *b)
+{
+    size_t nodes;
+
+    if (b->layout == BVH_BINARY) {
+        nodes = (size_t)b->num_nodes * sizeof(build_node);
+    } else {
+        nodes = (size_t)b->num_wide * wide_node_size(b->layout);
+    } /* if */
+
+    return nodes + (size_t)b->num_prims * sizeof(int);
+}
+
+/* Gets the name of a layout */
+const char *
+bvh_layout_name(enum bvh_layout layout)
+{
+    switch (layout) {
+    case BVH_WIDE4:
+        return "bvh4";
+    case BVH_WIDE8:
+        return "bvh8";
+    case BVH_COMPRESSED8:
+        return "cbvh8";
+    default:
+        return "binary";
+    } /* switch */
+}
+
+/* Parses a layout name */
+int
+parse_bvh_layout(const char *name, enum bvh_layout *layout)
+{
+    if (strcmp(name, "binary") == 0) {
+        *layout = BVH_BINARY;
+    } else if (strcmp(name, "bvh4") == 0) {
+        *layout = BVH_WIDE4;
+    } else if (strcmp(name, "bvh8") == 0) {
+        *layout = BVH_WIDE8;
+    } else if (strcmp(name, "cbvh8") == 0) {
+        *layout = BVH_COMPRESSED8;
+    } else {
+        return -1;
+    } /* if */
+
+    return 0;
+}
+/* EOF */
@@ -0,0 +1,288 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/checkpoint.h"
+
+#define CHECKPOINT_MAGIC "RTWCKPT"
+#define CHECKPOINT_VERSION 4u
+
+/* Bytes before the pixel data: magic, version, nx, ny, sampler, seed and
+ * options */
+#define CHECKPOINT_HEADER_SIZE (8 + 4 * sizeof(uint32_t) + 2 * sizeof(uint64_t))
+
+/* Bytes of pixel data per pixel: the rgb sums and the sample count */
+#define CHECKPOINT_PIXEL_SIZE (3 * sizeof(float) + sizeof(uint32_t))
+
+struct checkpoint_writer_t
+{
+    char *filename;
+    framebuffer *snapshot;
+    pthread_t thread;
+    bool started;
+    atomic_bool busy;
+    int failures;
+};
+
+/* Writes a whole buffer or fails */
+static int
+write_all(FILE *f, const void *data, size_t size, size_t count)
+{
+    return fwrite(data, size, count, f) == count ? 0 : -1;
+}
+
+/* Reads a whole buffer or fails */
+static int
+read_all(FILE *f, void *data, size_t size, size_t count)
+{
+    return fread(data, size, count, f) == count ? 0 : -1;
+}
+
+/* Writes the framebuffer to a checkpoint file atomically */
+int
+save_checkpoint(const framebuffer *fb, const char *filename)
+{
+    size_t n = (size_t)fb->nx * (size_t)fb->ny;
+    size_t len = strlen(filename);
+    char *tmp = malloc(len + 5);
+    uint32_t header[4];
+    FILE *f;
+    int err = 0;
+
+    if (!tmp) {
+        return -1;
+    } /* if */
+
+    memcpy(tmp, filename, len);
+    memcpy(tmp + len, ".tmp", 5);
+
+    f = fopen(tmp, "wb");
+
+    if (!f) {
+        free(tmp);
+        return -1;
+    } /* if */
+
+    header[0] = CHECKPOINT_VERSION;
+    header[1] = (uint32_t)fb->nx;
+    header[2] = (uint32_t)fb->ny;
+    header[3] = (uint32_t)fb->sampler;
+
+    err |= write_all(f, CHECKPOINT_MAGIC, 1, 8);
+    err |= write_all(f, header, sizeof(header[0]), 4);
+    err |= write_all(f, &fb->seed, sizeof(fb->seed), 1);
+    err |= write_all(f, &fb->options, sizeof(fb->options), 1);
+    err |= write_all(f, fb->accum, sizeof(float), 3 * n);
+    err |= write_all(f, fb->samples, sizeof(uint32_t), n);
+    err |= fflush(f);
+
+    /* Make sure the data is on disk before the rename makes it visible */
+    if (!err) {
+        err |= fsync(fileno(f));
+    } /* if */
+
+    err |= fclose(f);
+
+    if (!err) {
+        err = rename(tmp, filename);
+    } /* if */
+
+    if (err) {
+        int saved = errno;
+
+        remove(tmp);
+        errno = saved;
+    } /* if */
+
+    free(tmp);
+
+    return err ? -1 : 0;
+}
+
+/* Reads a framebuffer from a checkpoint file */
+framebuffer *
+load_checkpoint(const char *filename)
+{
+    char magic[8];
+    uint32_t header[4];
+    uint64_t seed, options;
+    size_t n;
+    struct stat st;
+    framebuffer *fb;
+    FILE *f = fopen(filename, "rb");
+
+    if (!f) {
+        return NULL;
+    } /* if */
+
+    if (read_all(f, magic, 1, 8)
+        || memcmp(magic, CHECKPOINT_MAGIC, 8) != 0
+        || read_all(f, header, sizeof(header[0]), 4)
+        || header[0] != CHECKPOINT_VERSION
+        || header[1] == 0 || header[2] == 0
+        || header[1] > INT_MAX || header[2] > INT_MAX
+        || header[3] > SAMPLER_BLUE_NOISE
+        || read_all(f, &seed, sizeof(seed), 1)
+        || read_all(f, &options, sizeof(options), 1)) {
+        fclose(f);
+        errno = EINVAL;
+        return NULL;
+    } /* if */
+
+    /* Only allocate for a size the file actually holds, so a corrupt header
+     * can not ask for more memory than the checkpoint is worth */
+    n = (size_t)header[1] * (size_t)header[2];
+
+    if (fstat(fileno(f), &st) != 0
+        || n > (SIZE_MAX - CHECKPOINT_HEADER_SIZE) / CHECKPOINT_PIXEL_SIZE
+        || (uintmax_t)st.st_size
+           != CHECKPOINT_HEADER_SIZE + n * CHECKPOINT_PIXEL_SIZE) {
+        fclose(f);
+        errno = EINVAL;
+        return NULL;
+    } /* if */
+
+    fb = create_framebuffer((int)header[1], (int)header[2], seed,
+                            (enum sampler_type)header[3]);
+
+    if (!fb) {
+        fclose(f);
+        return NULL;
+    } /* if */
+
+    fb->options = options;
+
+    if (read_all(f, fb->accum, sizeof(float), 3 * n)
+        || read_all(f, fb->samples, sizeof(uint32_t), n)) {
+        delete_framebuffer(fb);
+        fclose(f);
+        errno = EINVAL;
+        return NULL;
+    } /* if */
+
+    fclose(f);
+
+    return fb;
+}
+
+/* Creates a background checkpoint writer */
+checkpoint_writer *
+create_checkpoint_writer(const char *filename)
+{
+    checkpoint_writer *w = malloc(sizeof(*w));
+
+    if (!w) {
+        return NULL;
+    } /* if */
+
+    w->filename = strdup(filename);
+    w->snapshot = NULL;
+    w->started = false;
+    w->failures = 0;
+    atomic_init(&w->busy, false);
+
+    if (!w->filename) {
+        free(w);
+        return NULL;
+    } /* if */
+
+    return w;
+}
+
+/* Background thread body */
+static void *
+write_snapshot(void *arg)
+{
+    checkpoint_writer *w = arg;
+
+    if (save_checkpoint(w->snapshot, w->filename) != 0) {
+        perror("Could not write checkpoint");
+        w->failures++;
+    } /* if */
+
+    atomic_store(&w->busy, false);
+
+    return NULL;
+}
+
+/* Reaps the previous writer thread, if there was one */
+static void
+join_writer(checkpoint_writer *w)
+{
+    if (w->started) {
+        pthread_join(w->thread, NULL);
+        w->started = false;
+    } /* if */
+}
+
+/* Snapshots the framebuffer and saves it in the background */
+bool
+request_checkpoint(checkpoint_writer *w, const framebuffer *fb)
+{
+    size_t n = (size_t)fb->nx * (size_t)fb->ny;
+    framebuffer *snap;
+
+    if (atomic_load(&w->busy)) {
+        return false;
+    } /* if */
+
+    join_writer(w);
+
+    snap = w->snapshot;
+
+    if (!snap || snap->nx != fb->nx || snap->ny != fb->ny) {
+        delete_framebuffer(snap);
+        snap = w->snapshot = create_framebuffer(fb->nx, fb->ny, fb->seed,
+                                                fb->sampler);
+
+        if (!snap) {
+            w->failures++;
+            return false;
+        } /* if */
+    } /* if */
+
+    snap->seed = fb->seed;
+    snap->sampler = fb->sampler;
+    snap->options = fb->options;
+    memcpy(snap->accum, fb->accum, 3 * n * sizeof(float));
+    memcpy(snap->samples, fb->samples, n * sizeof(uint32_t));
+
+    atomic_store(&w->busy, true);
+
+    if (pthread_create(&w->thread, NULL, write_snapshot, w) != 0) {
+        /* No thread to hand off to, so write it here instead */
+        write_snapshot(w);
+        return true;
+    } /* if */
+
+    w->started = true;
+
+    return true;
+}
+
+/* Waits for the writer to finish and deletes it */
+int
+delete_checkpoint_writer(checkpoint_writer *w)
+{
+    int failures;
+
+    if (!w) {
+        return 0;
+    } /* if */
+
+    join_writer(w);
+    failures = w->failures;
+
+    delete_framebuffer(w->snapshot);
+    free(w->filename);
+    free(w);
+
+    return failures ? -1 : 0;
+}
+/* EOF */
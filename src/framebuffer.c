@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <tgmath.h>
+
+#include "../include/framebuffer.h"
+
+/* Creates an empty framebuffer */
+framebuffer *
+create_framebuffer(int nx, int ny, uint64_t seed, enum sampler_type type)
+{
+    framebuffer *fb = malloc(sizeof(*fb));
+    size_t n = (size_t)nx * (size_t)ny;
+
+    if (!fb) {
+        return NULL;
+    } /* if */
+
+    fb->nx = nx;
+    fb->ny = ny;
+    fb->seed = seed;
+    fb->sampler = type;
+    fb->options = 0;
+    fb->accum = calloc(3 * n, sizeof(float));
+    fb->samples = calloc(n, sizeof(uint32_t));
+
+    if (!fb->accum || !fb->samples) {
+        delete_framebuffer(fb);
+        return NULL;
+    } /* if */
+
+    return fb;
+}
+
+/* Deletes a framebuffer */
+void
+delete_framebuffer(framebuffer *fb)
+{
+    if (!fb) {
+        return;
+    } /* if */
+
+    free(fb->accum);
+    free(fb->samples);
+    free(fb);
+}
+
+/* Adds one sample to a pixel */
+void
+add_sample(framebuffer *fb, int i, int j, const vec3 *col)
+{
+    size_t p = (size_t)j * fb->nx + i;
+
+    fb->accum[3 * p + 0] += get_r(col);
+    fb->accum[3 * p + 1] += get_g(col);
+    fb->accum[3 * p + 2] += get_b(col);
+    fb->samples[p]++;
+}
+
+/* Averages the samples of a pixel */
+void
+resolve_pixel(const framebuffer *fb, int i, int j, vec3 *col)
+{
+    size_t p = (size_t)j * fb->nx + i;
+    float inv;
+
+    if (fb->samples[p] == 0) {
+        zero_out_vector(col);
+        return;
+    } /* if */
+
+    inv = 1.0f / (float)fb->samples[p];
+    set_elems(col, fb->accum[3 * p + 0] * inv, fb->accum[3 * p + 1] * inv,
+              fb->accum[3 * p + 2] * inv);
+}
+
+/* Gets the sample count of a pixel */
+uint32_t
+pixel_samples(const framebuffer *fb, int i, int j)
+{
+    return fb->samples[(size_t)j * fb->nx + i];
+}
+
+/* Clamps a linear color channel and converts it to a gamma 2 byte */
+static int
+to_byte(float f)
+{
+    if (f < 0) {
+        f = 0;
+    } else if (f > 1) {
+        f = 1;
+    } /* if */
+
+    return (int)(255.99f * sqrtf(f));
+}
+
+/* Writes the resolved image */
+int
+write_ppm(const framebuffer *fb, const char *filename)
+{
+    int i, j;
+    vec3 col;
+    FILE *output_file = fopen(filename, "w");
+
+    if (!output_file) {
+        return -1;
+    } /* if */
+
+    fprintf(output_file, "P3\n%d %d\n255\n", fb->nx, fb->ny);
+
+    for (j = fb->ny - 1; j >= 0; j--) {
+        for (i = 0; i < fb->nx; i++) {
+            resolve_pixel(fb, i, j, &col);
+            fprintf(output_file, "%d %d %d\n", to_byte(get_r(&col)),
+                    to_byte(get_g(&col)), to_byte(get_b(&col)));
+        } /* for */
+    } /* for */
+
+    return fclose(output_file) == 0 ? 0 : -1;
+}
+/* EOF */
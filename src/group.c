@@ -0,0 +1,533 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tgmath.h>
+#include <unistd.h>
+
+#include "../include/group.h"
+
+#define GROUP_MAGIC "RTWGRP1"
+#define HEADER_SIZE 64
+
+enum group_state
+{
+    GROUP_UNLOADED,     /* Only the header is known */
+    GROUP_LOADING,
+    GROUP_READY,
+    GROUP_FAILED        /* Could not be mapped, rays miss it */
+};
+
+/*
+ * A group file starts with a HEADER_SIZE byte header, followed by the spheres
+ * and then, on a 64 byte boundary, the hierarchy as written by save_bvh
+ */
+struct group_header
+{
+    char magic[8];
+    int32_t num_spheres;
+    float bounds[6];
+    float uv_scale;
+    uint64_t bvh_offset;
+};
+
+struct group_t
+{
+    group_cache *cache;
+    group *next;
+    int id;
+    char *filename;
+    aabb bounds;
+    float uv_scale;
+    int num_spheres;
+    size_t size;            /* Of the whole file, which is what it maps */
+    size_t bvh_offset;
+
+    /* Guarded by the cache lock, except that a pinned group stays loaded */
+    atomic_int refs;
+    int state;
+    group *lru_prev, *lru_next;
+    void *map;
+    const sphere *spheres;
+    bvh *accel;
+};
+
+struct group_cache_t
+{
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;
+    group *lru_head, *lru_tail;     /* Most recently used at the head, only
+                                     * groups in memory */
+    group *groups;
+    int next_id;
+    group_stats stats;
+};
+
+struct group_context_t
+{
+    group_cache *cache;
+    group *front[GROUP_FRONT_SIZE];
+};
+
+/* Rounds a file offset up to a 64 byte boundary */
+static size_t
+align64(size_t size)
+{
+    return (size + 63) & ~(size_t)63;
+}
+
+/* Writes spheres and their hierarchy to a group file */
+int
+write_group(const char *filename, const sphere *spheres, int count,
+            enum bvh_layout layout)
+{
+    static const char zeros[64];
+    aabb *boxes = malloc((size_t)(count > 0 ? count : 1) * sizeof(*boxes));
+    struct group_header header;
+    char block[HEADER_SIZE];
+    size_t size = (size_t)count * sizeof(sphere), pad;
+    float radii = 0;
+    bvh *accel = NULL;
+    aabb all;
+    FILE *f;
+    int k, err = 0;
+
+    if (!boxes) {
+        return -1;
+    } /* if */
+
+    empty_aabb(&all);
+
+    for (k = 0; k < count; k++) {
+        sphere_bounds(&spheres[k], &boxes[k]);
+        merge_aabb(&all, &boxes[k]);
+        radii += fabsf(spheres[k].radius);
+    } /* for */
+
+    accel = build_bvh(boxes, count, layout);
+    free(boxes);
+
+    if (!accel) {
+        return -1;
+    } /* if */
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GROUP_MAGIC, 8);
+    header.num_spheres = count;
+    memcpy(header.bounds, all.min.e, sizeof(all.min.e));
+    memcpy(header.bounds + 3, all.max.e, sizeof(all.max.e));
+    header.uv_scale = count > 0 ? (float)M_PI * radii / (float)count : 1.0f;
+    header.bvh_offset = align64(HEADER_SIZE + size);
+    pad = header.bvh_offset - HEADER_SIZE - size;
+    memset(block, 0, sizeof(block));
+    memcpy(block, &header, sizeof(header));
+
+    f = fopen(filename, "wb");
+
+    if (!f) {
+        delete_bvh(accel);
+        return -1;
+    } /* if */
+
+    err |= fwrite(block, 1, sizeof(block), f) != sizeof(block);
+    err |= fwrite(spheres, 1, size, f) != size;
+    err |= fwrite(zeros, 1, pad, f) != pad;
+    err |= save_bvh(accel, f) != 0;
+    err |= fclose(f) != 0;
+    delete_bvh(accel);
+
+    return err ? -1 : 0;
+}
+
+/* Creates a group cache */
+group_cache *
+create_group_cache(size_t budget)
+{
+    group_cache *c = calloc(1, sizeof(*c));
+
+    if (!c) {
+        return NULL;
+    } /* if */
+
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->loaded, NULL);
+    c->stats.bytes_budget = budget;
+
+    return c;
+}
+
+/* Unmaps a group, leaving only what its header said */
+static void
+unload_group(group *g)
+{
+    delete_bvh(g->accel);
+    munmap(g->map, g->size);
+    g->accel = NULL;
+    g->spheres = NULL;
+    g->map = NULL;
+    g->state = GROUP_UNLOADED;
+}
+
+/* Deletes a cache and its groups */
+void
+delete_group_cache(group_cache *cache)
+{
+    group *g, *next;
+
+    if (!cache) {
+        return;
+    } /* if */
+
+    for (g = cache->groups; g; g = next) {
+        next = g->next;
+
+        if (g->state == GROUP_READY) {
+            unload_group(g);
+        } /* if */
+
+        free(g->filename);
+        free(g);
+    } /* for */
+
+    pthread_mutex_destroy(&cache->lock);
+    pthread_cond_destroy(&cache->loaded);
+    free(cache);
+}
+
+/* Opens a group file, reading only its header */
+group *
+open_group(group_cache *cache, const char *filename)
+{
+    struct group_header header;
+    struct stat st;
+    group *g;
+    FILE *f = fopen(filename, "rb");
+
+    if (!f) {
+        return NULL;
+    } /* if */
+
+    if (fread(&header, sizeof(header), 1, f) != 1
+        || memcmp(header.magic, GROUP_MAGIC, 8) != 0
+        || header.num_spheres < 0 || fstat(fileno(f), &st) != 0
+        || header.bvh_offset < HEADER_SIZE + (uint64_t)header.num_spheres
+                                             * sizeof(sphere)
+        || header.bvh_offset >= (uint64_t)st.st_size) {
+        fclose(f);
+        return NULL;
+    } /* if */
+
+    fclose(f);
+    g = calloc(1, sizeof(*g));
+
+    if (!g || !(g->filename = strdup(filename))) {
+        free(g);
+        return NULL;
+    } /* if */
+
+    g->cache = cache;
+    set_elems(&g->bounds.min, header.bounds[0], header.bounds[1],
+              header.bounds[2]);
+    set_elems(&g->bounds.max, header.bounds[3], header.bounds[4],
+              header.bounds[5]);
+    g->uv_scale = header.uv_scale;
+    g->num_spheres = header.num_spheres;
+    g->size = (size_t)st.st_size;
+    g->bvh_offset = (size_t)header.bvh_offset;
+    g->state = GROUP_UNLOADED;
+    atomic_init(&g->refs, 0);
+
+    pthread_mutex_lock(&cache->lock);
+    g->id = cache->next_id++;
+    g->next = cache->groups;
+    cache->groups = g;
+    cache->stats.groups_opened++;
+    pthread_mutex_unlock(&cache->lock);
+
+    return g;
+}
+
+/* Gets the bounds of a group */
+void
+group_bounds(const group *g, aabb *box)
+{
+    *box = g->bounds;
+}
+
+/* Gets the texture coordinate scale of a group's spheres */
+float
+group_uv_scale(const group *g)
+{
+    return g->uv_scale;
+}
+
+/* Unlinks a group from the LRU list */
+static void
+lru_remove(group_cache *c, group *g)
+{
+    if (g->lru_prev) {
+        g->lru_prev->lru_next = g->lru_next;
+    } else {
+        c->lru_head = g->lru_next;
+    } /* if */
+
+    if (g->lru_next) {
+        g->lru_next->lru_prev = g->lru_prev;
+    } else {
+        c->lru_tail = g->lru_prev;
+    } /* if */
+
+    g->lru_prev = g->lru_next = NULL;
+}
+
+/* Links a group at the most recently used end of the LRU list */
+static void
+lru_push(group_cache *c, group *g)
+{
+    g->lru_prev = NULL;
+    g->lru_next = c->lru_head;
+
+    if (c->lru_head) {
+        c->lru_head->lru_prev = g;
+    } else {
+        c->lru_tail = g;
+    } /* if */
+
+    c->lru_head = g;
+}
+
+/* Unmaps unpinned groups, oldest first, until size more bytes fit the
+ * budget */
+static void
+evict_for_space(group_cache *c, size_t size)
+{
+    group *g = c->lru_tail;
+
+    while (g && c->stats.bytes_used + size > c->stats.bytes_budget) {
+        group *prev = g->lru_prev;
+
+        if (atomic_load(&g->refs) == 0 && g->state == GROUP_READY) {
+            lru_remove(c, g);
+            unload_group(g);
+            c->stats.bytes_used -= g->size;
+            c->stats.groups_evicted++;
+        } /* if */
+
+        g = prev;
+    } /* while */
+}
+
+/* Maps a group file and the hierarchy in it. Returns 0 on success, -1 if
+ * the file could not be mapped */
+static int
+load_group(group *g)
+{
+    int fd = open(g->filename, O_RDONLY);
+    void *map = MAP_FAILED;
+
+    if (fd >= 0) {
+        map = mmap(NULL, g->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+    } /* if */
+
+    if (map != MAP_FAILED) {
+        g->accel = map_bvh((const char *)map + g->bvh_offset,
+                           g->size - g->bvh_offset, g->num_spheres);
+    } /* if */
+
+    if (map == MAP_FAILED || !g->accel) {
+        if (map != MAP_FAILED) {
+            munmap(map, g->size);
+        } /* if */
+
+        g->accel = NULL;
+        return -1;
+    } /* if */
+
+    g->map = map;
+    g->spheres = (const sphere *)((const char *)map + HEADER_SIZE);
+
+    return 0;
+}
+
+/* Makes sure a group is in memory and returns with a reference held.
+ * Returns false, holding no reference, if the group could not be mapped */
+static bool
+acquire_group(group_context *ctx, group *g)
+{
+    group_cache *c = ctx->cache;
+
+    pthread_mutex_lock(&c->lock);
+
+    /* A failed group is off the LRU list, so it must not be moved on it */
+    if (g->state == GROUP_FAILED) {
+        pthread_mutex_unlock(&c->lock);
+        return false;
+    } /* if */
+
+    atomic_fetch_add(&g->refs, 1);
+
+    if (g->state != GROUP_UNLOADED) {
+        lru_remove(c, g);
+        lru_push(c, g);
+
+        while (g->state == GROUP_LOADING) {
+            pthread_cond_wait(&c->loaded, &c->lock);
+        } /* while */
+
+        /* The load this thread waited on failed */
+        if (g->state == GROUP_FAILED) {
+            atomic_fetch_sub(&g->refs, 1);
+            pthread_mutex_unlock(&c->lock);
+            return false;
+        } /* if */
+
+        pthread_mutex_unlock(&c->lock);
+        return true;
+    } /* if */
+
+    evict_for_space(c, g->size);
+    g->state = GROUP_LOADING;
+    lru_push(c, g);
+    c->stats.bytes_used += g->size;
+
+    if (c->stats.bytes_used > c->stats.bytes_peak) {
+        c->stats.bytes_peak = c->stats.bytes_used;
+    } /* if */
+
+    /* The mapping happens unlocked, other threads only wait if they want
+     * this very group */
+    pthread_mutex_unlock(&c->lock);
+
+    if (load_group(g) != 0) {
+        /* Not retried, every ray would try the failing file again */
+        pthread_mutex_lock(&c->lock);
+        g->state = GROUP_FAILED;
+        lru_remove(c, g);
+        c->stats.bytes_used -= g->size;
+        c->stats.groups_failed++;
+        atomic_fetch_sub(&g->refs, 1);
+        pthread_cond_broadcast(&c->loaded);
+        pthread_mutex_unlock(&c->lock);
+        return false;
+    } /* if */
+
+    pthread_mutex_lock(&c->lock);
+    g->state = GROUP_READY;
+    c->stats.groups_loaded++;
+    pthread_cond_broadcast(&c->loaded);
+    pthread_mutex_unlock(&c->lock);
+
+    return true;
+}
+
+/* Gets a group into memory through the context's front cache. Returns NULL
+ * if the group could not be mapped */
+static const group *
+lookup_group(group_context *ctx, group *g)
+{
+    unsigned slot = (unsigned)g->id % GROUP_FRONT_SIZE;
+
+    if (ctx->front[slot] == g) {
+        return g;
+    } /* if */
+
+    if (!acquire_group(ctx, g)) {
+        return NULL;
+    } /* if */
+
+    if (ctx->front[slot]) {
+        atomic_fetch_sub(&ctx->front[slot]->refs, 1);
+    } /* if */
+
+    ctx->front[slot] = g;
+
+    return g;
+}
+
+/* Creates a per-thread context */
+group_context *
+create_group_context(group_cache *cache)
+{
+    group_context *ctx = calloc(1, sizeof(*ctx));
+
+    if (ctx) {
+        ctx->cache = cache;
+    } /* if */
+
+    return ctx;
+}
+
+/* Unpins a context's groups and deletes it */
+void
+delete_group_context(group_context *ctx)
+{
+    int k;
+
+    if (!ctx) {
+        return;
+    } /* if */
+
+    for (k = 0; k < GROUP_FRONT_SIZE; k++) {
+        if (ctx->front[k]) {
+            atomic_fetch_sub(&ctx->front[k]->refs, 1);
+        } /* if */
+    } /* for */
+
+    free(ctx);
+}
+
+/* Intersects one sphere of a group, for its hierarchy */
+static bool
+hit_group_sphere(const void *data, int prim, const ray *r, float t_min,
+                 float t_max, hit_record *rec)
+{
+    const sphere *spheres = data;
+
+    return hit_sphere(&spheres[prim], r, t_min, t_max, rec);
+}
+
+/* Finds the closest sphere of a group a ray hits */
+bool
+hit_group(group_context *ctx, group *g, const ray *r, float t_min,
+          float t_max, hit_record *rec)
+{
+    const group *loaded = lookup_group(ctx, g);
+
+    if (!loaded) {
+        return false;
+    } /* if */
+
+    return bvh_closest_hit(loaded->accel, r, t_min, t_max, hit_group_sphere,
+                           loaded->spheres, rec);
+}
+
+/* Checks whether a group blocks a ray */
+bool
+group_occluded(group_context *ctx, group *g, const ray *r, float t_min,
+               float t_max)
+{
+    const group *loaded = lookup_group(ctx, g);
+
+    if (!loaded) {
+        return false;
+    } /* if */
+
+    return bvh_any_hit(loaded->accel, r, t_min, t_max, hit_group_sphere,
+                       loaded->spheres);
+}
+
+/* Gets a snapshot of the cache counters */
+void
+get_group_stats(group_cache *cache, group_stats *stats)
+{
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
+/* EOF */
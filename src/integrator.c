@@ -0,0 +1,508 @@
+#include <float.h>
+#include <tgmath.h>
+
+#include "../include/integrator.h"
+
+/* Paths shorter than this are never cut short by russian roulette */
+#define ROULETTE_DEPTH 3
+
+/* Spread of the ray cone after a diffuse bounce, in radians. Only used to
+ * pick texture mip levels, so a rough value is enough */
+#define DIFFUSE_SPREAD 0.2f
+
+/* Share of paths that go on past a filled radiance cache cell, so the cell
+ * keeps averaging in new samples */
+#define CACHE_TRAIN_FRACTION 0.125f
+
+/* Gets the color of the sky gradient */
+void
+sky_color(const vec3 *dir, vec3 *col)
+{
+    vec3 unit_dir, first, second;
+    float t;
+
+    set_elems(&first, 1.0f, 1.0f, 1.0f);
+    set_elems(&second, 0.5f, 0.7f, 1.0f);
+
+    turn_into_unit_vector(&unit_dir, dir);
+
+    t = 0.5f * (get_y(&unit_dir) + 1.0f);
+
+    multiply_scalar(&first, (1.0f - t));
+    multiply_scalar(&second, t);
+    add_vec(col, &first, &second);
+}
+
+/* Where a path draws its sample coordinates from */
+typedef struct
+{
+    const sampler *smp;
+    uint32_t x, y, index;
+} path_samples;
+
+/* Gets one sample coordinate of a bounce */
+static float
+bounce_sample(const path_samples *ps, int depth, int offset)
+{
+    return get_sample(ps->smp, ps->x, ps->y, ps->index,
+                      (uint32_t)(SAMPLE_DIM_BOUNCE
+                                 + depth * SAMPLE_DIMS_PER_BOUNCE + offset));
+}
+
+/* Power heuristic weight of a sample drawn with density a against b */
+static float
+mis_weight(float a, float b)
+{
+    a *= a;
+    b *= b;
+
+    return a + b > 0 ? a / (a + b) : 0;
+}
+
+/* Gets the length in world units that texture coordinates span on a prim */
+static float
+uv_scale(const scene *s, int prim)
+{
+    int first_group = s->num_spheres + s->num_quads;
+    int first_sdf = first_group + s->num_groups;
+    vec3 extent;
+    aabb box;
+
+    if (prim < s->num_spheres) {
+        return (float)M_PI * s->spheres[prim].radius;
+    } /* if */
+
+    if (prim >= first_sdf) {
+        sdf_bounds(&s->sdfs[prim - first_sdf], &box);
+        subtract_vec(&extent, &box.max, &box.min);
+
+        return 0.5f * (float)M_PI
+               * fmaxf(get_x(&extent), fmaxf(get_y(&extent), get_z(&extent)));
+    } /* if */
+
+    if (prim >= first_group) {
+        return group_uv_scale(s->groups[prim - first_group]);
+    } /* if */
+
+    return sqrtf(s->quads[prim - s->num_spheres].area);
+}
+
+/* Gets the albedo of a diffuse hit, from its texture if it has one */
+static void
+surface_albedo(const scene *s, const material *mat, texture_context *tex_ctx,
+               const hit_record *rec, float cone_width, float cosine,
+               vec3 *albedo)
+{
+    float footprint;
+
+    if (!mat->albedo_texture || !tex_ctx) {
+        *albedo = mat->albedo;
+        return;
+    } /* if */
+
+    /* Grazing angles stretch the footprint along the surface */
+    footprint = cone_width / (fmaxf(cosine, 0.1f) * uv_scale(s, rec->prim));
+    sample_texture(tex_ctx, mat->albedo_texture, rec->u, rec->v, footprint,
+                   albedo);
+}
+
+/* Seeds the generator for the free flights of one bounce, which draw an
+ * unbounded number of random numbers and so can not use the sampler */
+static void
+seed_bounce_rng(const path_samples *ps, int depth, rng *g)
+{
+    uint64_t pixel = (uint64_t)ps->y << 32 | ps->x;
+
+    seed_rng(g, pixel ^ (uint64_t)ps->smp->seed * 0x9e3779b97f4a7c15ull,
+             (uint64_t)ps->index << 16 | (uint64_t)depth);
+}
+
+/*
+ * Samples one randomly picked light from p. The radiance comes back
+ * attenuated by the media in between and the pdf includes the pick. With a
+ * normal, lights behind the surface are skipped before any shadow ray
+ */
+static bool
+sample_direct(const render_settings *rs, const vec3 *p, const vec3 *normal,
+              const path_samples *ps, int depth, float time, rng *g,
+              light_sample *ls)
+{
+    const scene *s = rs->world;
+    int k = (int)(bounce_sample(ps, depth, SAMPLE_BOUNCE_LIGHT_PICK)
+                  * (float)s->num_lights);
+    float u1 = bounce_sample(ps, depth, SAMPLE_BOUNCE_LIGHT);
+    float u2 = bounce_sample(ps, depth, SAMPLE_BOUNCE_LIGHT + 1);
+    float transmittance;
+    vec3 from;
+    ray shadow;
+
+    k = k < s->num_lights ? k : s->num_lights - 1;
+
+    if (!sample_light(s, &s->lights[k], p, time, u1, u2, ls)) {
+        return false;
+    } /* if */
+
+    if (normal && dot_product(normal, &ls->wi) <= 0) {
+        return false;
+    } /* if */
+
+    from = *p;
+    set_ray_vectors(&shadow, &from, &ls->wi);
+    set_ray_time(&shadow, time);
+
+    if (scene_occluded(s, rs->groups, &shadow, 0.001f,
+                       ls->dist * (1.0f - 1e-3f))) {
+        return false;
+    } /* if */
+
+    transmittance = scene_transmittance(s, &shadow, ls->dist, g);
+
+    if (transmittance <= 0) {
+        return false;
+    } /* if */
+
+    multiply_scalar(&ls->radiance, transmittance);
+    ls->pdf /= (float)s->num_lights;
+
+    return true;
+}
+
+/* Adds a light sample, scattered by f, to the radiance of a path. The
+ * scatter pdf is how likely the next bounce is to pick the same direction */
+static void
+add_direct(path_state *path, const light_sample *ls, const vec3 *f,
+           float scatter_pdf)
+{
+    vec3 contrib;
+
+    entrywise_product(&contrib, f, &ls->radiance);
+    entrywise_product(&contrib, &contrib, &path->throughput);
+    multiply_scalar(&contrib, mis_weight(ls->pdf, scatter_pdf) / ls->pdf);
+    add_vec(&path->radiance, &path->radiance, &contrib);
+}
+
+/* Sends a path on from a scattering event, unless russian roulette ends it.
+ * The throughput must already include the scattering weight. Specular
+ * bounces keep the spread of the ray cone */
+static void
+continue_path(const render_settings *rs, const path_samples *ps,
+              path_state *path, const vec3 *p, const vec3 *wi, float pdf,
+              bool diffuse)
+{
+    int depth = path->depth;
+    float q;
+
+    path->prev_pdf = pdf;
+    path->prev_diffuse = diffuse;
+    path->prev_p = *p;
+
+    if (depth >= ROULETTE_DEPTH) {
+        q = fmaxf(get_r(&path->throughput),
+                  fmaxf(get_g(&path->throughput), get_b(&path->throughput)));
+        q = fminf(q, 0.95f);
+
+        if (bounce_sample(ps, depth, SAMPLE_BOUNCE_ROULETTE) >= q) {
+            return;
+        } /* if */
+
+        divide_scalar(&path->throughput, q);
+    } /* if */
+
+    path->o = *p;
+    path->d = *wi;
+
+    if (diffuse) {
+        path->cone_spread = DIFFUSE_SPREAD;
+    } /* if */
+
+    path->depth = depth + 1;
+    path->active = path->depth < rs->max_depth;
+}
+
+/* Scatters a path at a collision t along its ray inside a medium */
+static void
+scatter_in_medium(const render_settings *rs, const path_samples *ps,
+                  path_state *path, const medium *m, float t, rng *g)
+{
+    const scene *s = rs->world;
+    float dlen = length(&path->d), phase, pdf;
+    light_sample ls;
+    vec3 p, f, wi;
+
+    p = path->d;
+    multiply_scalar(&p, t);
+    add_vec(&p, &p, &path->o);
+    divide_scalar(&path->d, dlen);
+    path->cone_width += t * dlen * path->cone_spread;
+
+    if (rs->light_sampling && s->num_lights > 0
+        && sample_direct(rs, &p, NULL, ps, path->depth, path->time, g, &ls)) {
+        phase = phase_function(m, &path->d, &ls.wi);
+        f = m->albedo;
+        multiply_scalar(&f, phase);
+        add_direct(path, &ls, &f, phase);
+    } /* if */
+
+    /* The phase function is its own pdf, only the albedo is left */
+    pdf = sample_phase(m, &path->d,
+                       bounce_sample(ps, path->depth, SAMPLE_BOUNCE_BSDF),
+                       bounce_sample(ps, path->depth, SAMPLE_BOUNCE_BSDF + 1),
+                       &wi);
+    entrywise_product(&path->throughput, &path->throughput, &m->albedo);
+    path->after_diffuse = false;
+    continue_path(rs, ps, path, &p, &wi, pdf, true);
+}
+
+/* Sets up a path for a camera ray */
+void
+start_path(const render_settings *rs, const ray *primary, uint32_t x,
+           uint32_t y, uint32_t index, path_state *path)
+{
+    path->o = *origin(primary);
+    path->d = *direction(primary);
+    set_elems(&path->throughput, 1, 1, 1);
+    zero_out_vector(&path->radiance);
+    zero_out_vector(&path->prev_p);
+    path->cone_width = 0;
+    path->cone_spread = rs->pixel_spread;
+    path->prev_pdf = 0;
+    path->time = ray_time(primary);
+    path->x = x;
+    path->y = y;
+    path->index = index;
+    path->depth = 0;
+    path->cache_cell = -1;
+    path->prev_diffuse = false;
+    path->after_diffuse = false;
+    path->active = rs->max_depth > 0;
+}
+
+/* Adds what a path gathered after its cached hit to the cache. Everything it
+ * gathered from there on was scaled by the weight, which comes off again */
+static void
+feed_cache(const render_settings *rs, path_state *path)
+{
+    const vec3 *w = &path->cache_weight;
+    vec3 gathered;
+
+    subtract_vec(&gathered, &path->radiance, &path->cache_base);
+    set_elems(&gathered,
+              get_r(w) > 0 ? get_r(&gathered) / get_r(w) : 0,
+              get_g(w) > 0 ? get_g(&gathered) / get_g(w) : 0,
+              get_b(w) > 0 ? get_b(&gathered) / get_b(w) : 0);
+    radiance_cache_add(rs->cache, path->cache_cell, &gathered);
+    path->cache_cell = -1;
+}
+
+/* Checks the radiance cache at a diffuse hit. Returns whether the cache
+ * ended the path, otherwise the path may be set up to feed the cache */
+static bool
+use_cache(const render_settings *rs, path_state *path, const vec3 *p,
+          const vec3 *normal, const vec3 *albedo, rng *g)
+{
+    vec3 cached;
+    int cell;
+
+    if (!rs->cache || path->depth != rs->cache_depth) {
+        return false;
+    } /* if */
+
+    cell = radiance_cache_cell(rs->cache, p, normal);
+
+    if (cell < 0) {
+        return false;
+    } /* if */
+
+    if (rng_float(g) >= CACHE_TRAIN_FRACTION
+        && radiance_cache_lookup(rs->cache, cell, &cached)) {
+        entrywise_product(&cached, &cached, albedo);
+        entrywise_product(&cached, &cached, &path->throughput);
+        add_vec(&path->radiance, &path->radiance, &cached);
+        return true;
+    } /* if */
+
+    path->cache_cell = cell;
+    entrywise_product(&path->cache_weight, &path->throughput, albedo);
+    path->cache_base = path->radiance;
+
+    return false;
+}
+
+/* Shades the hit of a path's current ray, see extend_path */
+static void
+shade_hit(const render_settings *rs, const sampler *smp,
+          texture_context *tex_ctx, path_state *path, const hit_record *rec)
+{
+    const scene *s = rs->world;
+    const path_samples ps = {smp, path->x, path->y, path->index};
+    int depth = path->depth;
+    vec3 normal, albedo, contrib, t, b, wi, o, d;
+    const material *mat;
+    float dlen, cosine, r1, r2, t_medium;
+    light_sample ls;
+    bool front;
+    ray r;
+    rng g;
+    int k;
+
+    path->active = false;
+    seed_bounce_rng(&ps, depth, &g);
+
+    /* The ray may scatter in a medium before it gets to what it hit */
+    if (s->num_media > 0) {
+        o = path->o;
+        d = path->d;
+        set_ray_vectors(&r, &o, &d);
+        set_ray_time(&r, path->time);
+        k = scene_sample_media(s, &r, rec ? rec->t : FLT_MAX, &g, &t_medium);
+
+        if (k >= 0) {
+            scatter_in_medium(rs, &ps, path, s->media[k], t_medium, &g);
+            return;
+        } /* if */
+    } /* if */
+
+    if (!rec) {
+        if (rs->sky) {
+            sky_color(&path->d, &contrib);
+            entrywise_product(&contrib, &contrib, &path->throughput);
+            add_vec(&path->radiance, &path->radiance, &contrib);
+        } /* if */
+
+        return;
+    } /* if */
+
+    dlen = length(&path->d);
+    divide_scalar(&path->d, dlen);
+    path->cone_width += rec->t * dlen * path->cone_spread;
+    mat = &s->materials[rec->material];
+    front = dot_product(&path->d, &rec->normal) < 0;
+    normal = rec->normal;
+
+    if (!front) {
+        negate(&normal);
+    } /* if */
+
+    if (mat->type == MATERIAL_LIGHT) {
+        float weight = 1.0f;
+
+        if (!front) {
+            return;
+        } /* if */
+
+        /* The photon map holds the light that took this way through glass
+         * to a diffuse surface */
+        if (rs->photons && path->after_diffuse && !path->prev_diffuse) {
+            return;
+        } /* if */
+
+        /* Light sampling could have found this hit too, so the two
+         * estimates share it */
+        if (rs->light_sampling && path->prev_diffuse) {
+            k = find_light(s, rec);
+
+            if (k >= 0) {
+                weight = mis_weight(path->prev_pdf,
+                                    light_pdf(s, &s->lights[k], &path->prev_p,
+                                              path->time, rec, &path->d)
+                                    / (float)s->num_lights);
+            } /* if */
+        } /* if */
+
+        entrywise_product(&contrib, &mat->emission, &path->throughput);
+        multiply_scalar(&contrib, weight);
+        add_vec(&path->radiance, &path->radiance, &contrib);
+        return;
+    } /* if */
+
+    if (mat->type == MATERIAL_DIELECTRIC) {
+        scatter_dielectric(mat, &path->d, &rec->normal,
+                           bounce_sample(&ps, depth, SAMPLE_BOUNCE_BSDF), &wi);
+        continue_path(rs, &ps, path, &rec->p, &wi, 0, false);
+        return;
+    } /* if */
+
+    cosine = -dot_product(&path->d, &normal);
+    surface_albedo(s, mat, tex_ctx, rec, path->cone_width, cosine, &albedo);
+
+    if (rs->photons && photon_estimate(rs->photons, &rec->p, &normal,
+                                       &contrib)) {
+        entrywise_product(&contrib, &contrib, &albedo);
+        entrywise_product(&contrib, &contrib, &path->throughput);
+        add_vec(&path->radiance, &path->radiance, &contrib);
+    } /* if */
+
+    if (use_cache(rs, path, &rec->p, &normal, &albedo, &g)) {
+        return;
+    } /* if */
+
+    if (rs->light_sampling && s->num_lights > 0
+        && sample_direct(rs, &rec->p, &normal, &ps, depth, path->time, &g,
+                         &ls)) {
+        cosine = dot_product(&normal, &ls.wi) / (float)M_PI;
+        contrib = albedo;
+        multiply_scalar(&contrib, cosine);
+        add_direct(path, &ls, &contrib, cosine);
+    } /* if */
+
+    /* Cosine weighted bounce, the cosine and 1 / pi cancel the pdf */
+    r1 = 2.0f * (float)M_PI * bounce_sample(&ps, depth, SAMPLE_BOUNCE_BSDF);
+    r2 = bounce_sample(&ps, depth, SAMPLE_BOUNCE_BSDF + 1);
+    orthonormal_basis(&normal, &t, &b);
+    multiply_scalar(&t, cosf(r1) * sqrtf(r2));
+    multiply_scalar(&b, sinf(r1) * sqrtf(r2));
+    wi = normal;
+    multiply_scalar(&wi, sqrtf(1.0f - r2));
+    add_vec(&wi, &wi, &t);
+    add_vec(&wi, &wi, &b);
+
+    entrywise_product(&path->throughput, &path->throughput, &albedo);
+    path->after_diffuse = true;
+    continue_path(rs, &ps, path, &rec->p, &wi, sqrtf(1.0f - r2) / (float)M_PI,
+                  true);
+}
+
+/* Advances a path past the hit of its current ray */
+void
+extend_path(const render_settings *rs, const sampler *smp,
+            texture_context *tex_ctx, path_state *path, const hit_record *rec)
+{
+    shade_hit(rs, smp, tex_ctx, path, rec);
+
+    if (!path->active && path->cache_cell >= 0) {
+        feed_cache(rs, path);
+    } /* if */
+}
+
+/* Finds what the current ray of a path hits */
+bool
+path_hit(const render_settings *rs, const path_state *path, hit_record *rec)
+{
+    ray r;
+    vec3 o = path->o, d = path->d;
+
+    set_ray_vectors(&r, &o, &d);
+    set_ray_time(&r, path->time);
+
+    return hit_scene(rs->world, rs->groups, &r, 0.001f, FLT_MAX, rec);
+}
+
+/* Estimates the radiance along a camera ray */
+void
+trace_path(const render_settings *rs, texture_context *tex_ctx,
+           const ray *primary, const sampler *smp, uint32_t x, uint32_t y,
+           uint32_t index, vec3 *radiance)
+{
+    path_state path;
+    hit_record rec;
+
+    start_path(rs, primary, x, y, index, &path);
+
+    while (path.active) {
+        extend_path(rs, smp, tex_ctx, &path,
+                    path_hit(rs, &path, &rec) ? &rec : NULL);
+    } /* while */
+
+    *radiance = path.radiance;
+}
+/* EOF */
@@ -0,0 +1,199 @@
+#include <tgmath.h>
+
+#include "../include/light.h"
+#include "../include/scene.h"
+
+/* Gets 1 - cos of the half angle of the cone a sphere subtends. Computed
+ * from sin^2 directly, since 1 - sqrt(1 - sin^2) rounds to 0 for small or
+ * distant lights and their density would become infinite */
+static float
+cone_one_minus_cos(float sin2_max)
+{
+    return sin2_max / (1.0f + sqrtf(1.0f - sin2_max));
+}
+
+/* Samples the cone of directions a sphere subtends as seen from p */
+static bool
+sample_sphere_light(const scene *s, const sphere *sp, const vec3 *p,
+                    float time, float u1, float u2, light_sample *ls)
+{
+    vec3 axis, t, b, from, center;
+    float dist2, sin2_max, one_minus_cos, cos_theta, sin_theta, phi, dc;
+    hit_record rec;
+    ray r;
+
+    sphere_center(sp, time, &center);
+    subtract_vec(&axis, &center, p);
+    dist2 = squared_length(&axis);
+    sin2_max = sp->radius * sp->radius / dist2;
+
+    /* Points inside the light can not sample it this way, and a light too
+     * small to subtend any angle can not be sampled at all */
+    if (sin2_max >= 1.0f || !(sin2_max > 0.0f)) {
+        return false;
+    } /* if */
+
+    dc = sqrtf(dist2);
+    divide_scalar(&axis, dc);
+    one_minus_cos = cone_one_minus_cos(sin2_max);
+    cos_theta = 1.0f - u1 * one_minus_cos;
+    sin_theta = sqrtf(fmaxf(0.0f, 1.0f - cos_theta * cos_theta));
+    phi = 2.0f * (float)M_PI * u2;
+
+    orthonormal_basis(&axis, &t, &b);
+    multiply_scalar(&t, sin_theta * cosf(phi));
+    multiply_scalar(&b, sin_theta * sinf(phi));
+    multiply_scalar(&axis, cos_theta);
+    add_vec(&ls->wi, &t, &b);
+    add_vec(&ls->wi, &ls->wi, &axis);
+
+    /* Directions right at the rim can numerically miss, clamp to the center
+     * distance rather than dropping the sample */
+    from = *p;
+    set_ray_vectors(&r, &from, &ls->wi);
+    set_ray_time(&r, time);
+
+    if (hit_sphere(sp, &r, 0, dc, &rec)) {
+        ls->dist = rec.t;
+    } else {
+        ls->dist = dc - sp->radius;
+    } /* if */
+
+    ls->pdf = 1.0f / (2.0f * (float)M_PI * one_minus_cos);
+    ls->radiance = s->materials[sp->material].emission;
+
+    return true;
+}
+
+/* Samples a point uniformly on a quad and converts to solid angle density */
+static bool
+sample_quad_light(const scene *s, const quad *q, const vec3 *p, float u1,
+                  float u2, light_sample *ls)
+{
+    vec3 point, eu, ev;
+    float dist2, cos_light;
+
+    eu = q->edge_u;
+    ev = q->edge_v;
+    multiply_scalar(&eu, u1);
+    multiply_scalar(&ev, u2);
+    add_vec(&point, &q->corner, &eu);
+    add_vec(&point, &point, &ev);
+
+    subtract_vec(&ls->wi, &point, p);
+    dist2 = squared_length(&ls->wi);
+    ls->dist = sqrtf(dist2);
+    divide_scalar(&ls->wi, ls->dist);
+
+    /* Quads only emit from their front side */
+    cos_light = -dot_product(&q->normal, &ls->wi);
+
+    if (cos_light <= 0) {
+        return false;
+    } /* if */
+
+    ls->pdf = dist2 / (cos_light * q->area);
+    ls->radiance = s->materials[q->material].emission;
+
+    return true;
+}
+
+/* Samples a direction towards a light */
+bool
+sample_light(const scene *s, const light *l, const vec3 *p, float time,
+             float u1, float u2, light_sample *ls)
+{
+    if (l->type == LIGHT_SPHERE) {
+        return sample_sphere_light(s, &s->spheres[l->index], p, time, u1, u2,
+                                   ls);
+    } /* if */
+
+    return sample_quad_light(s, &s->quads[l->index], p, u1, u2, ls);
+}
+
+/* Samples a ray leaving a light */
+void
+sample_emission(const scene *s, const light *l, float time, float u1,
+                float u2, float u3, float u4, light_emission *le)
+{
+    vec3 normal, t, b;
+    float area, z, r, phi;
+    int mat;
+
+    if (l->type == LIGHT_SPHERE) {
+        const sphere *sp = &s->spheres[l->index];
+
+        /* Uniform over the sphere */
+        z = 1.0f - 2.0f * u1;
+        r = sqrtf(fmaxf(0.0f, 1.0f - z * z));
+        phi = 2.0f * (float)M_PI * u2;
+        set_elems(&normal, r * cosf(phi), r * sinf(phi), z);
+        sphere_center(sp, time, &le->p);
+        t = normal;
+        multiply_scalar(&t, sp->radius);
+        add_vec(&le->p, &le->p, &t);
+        area = 4.0f * (float)M_PI * sp->radius * sp->radius;
+        mat = sp->material;
+    } else {
+        const quad *q = &s->quads[l->index];
+
+        t = q->edge_u;
+        b = q->edge_v;
+        multiply_scalar(&t, u1);
+        multiply_scalar(&b, u2);
+        add_vec(&le->p, &q->corner, &t);
+        add_vec(&le->p, &le->p, &b);
+        normal = q->normal;
+        area = q->area;
+        mat = q->material;
+    } /* if */
+
+    r = sqrtf(u4);
+    phi = 2.0f * (float)M_PI * u3;
+    orthonormal_basis(&normal, &t, &b);
+    multiply_scalar(&t, r * cosf(phi));
+    multiply_scalar(&b, r * sinf(phi));
+    le->dir = normal;
+    multiply_scalar(&le->dir, sqrtf(fmaxf(0.0f, 1.0f - u4)));
+    add_vec(&le->dir, &le->dir, &t);
+    add_vec(&le->dir, &le->dir, &b);
+
+    /* A diffuse emitter sends out pi times its radiance per unit area */
+    le->power = s->materials[mat].emission;
+    multiply_scalar(&le->power, (float)M_PI * area);
+}
+
+/* Gets the density sample_light gives a direction that hit the light */
+float
+light_pdf(const scene *s, const light *l, const vec3 *p, float time,
+          const hit_record *rec, const vec3 *dir)
+{
+    if (l->type == LIGHT_SPHERE) {
+        const sphere *sp = &s->spheres[l->index];
+        vec3 axis, center;
+        float sin2_max;
+
+        sphere_center(sp, time, &center);
+        subtract_vec(&axis, &center, p);
+        sin2_max = sp->radius * sp->radius / squared_length(&axis);
+
+        if (sin2_max >= 1.0f || !(sin2_max > 0.0f)) {
+            return 0;
+        } /* if */
+
+        return 1.0f / (2.0f * (float)M_PI * cone_one_minus_cos(sin2_max));
+    } else {
+        const quad *q = &s->quads[l->index];
+        float cos_light = -dot_product(&q->normal, dir);
+        vec3 d;
+
+        if (cos_light <= 0) {
+            return 0;
+        } /* if */
+
+        subtract_vec(&d, &rec->p, p);
+
+        return squared_length(&d) / (cos_light * q->area);
+    } /* if */
+}
+/* EOF */
@@ -0,0 +1,77 @@
+#include <stddef.h>
+#include <tgmath.h>
+
+#include "../include/material.h"
+
+/* Sets up a diffuse material */
+void
+make_lambertian(material *mat, const vec3 *albedo)
+{
+    mat->type = MATERIAL_LAMBERTIAN;
+    mat->albedo = *albedo;
+    zero_out_vector(&mat->emission);
+    mat->albedo_texture = NULL;
+    mat->ior = 1.0f;
+}
+
+/* Sets up an emissive material */
+void
+make_light(material *mat, const vec3 *emission)
+{
+    mat->type = MATERIAL_LIGHT;
+    zero_out_vector(&mat->albedo);
+    mat->emission = *emission;
+    mat->albedo_texture = NULL;
+    mat->ior = 1.0f;
+}
+
+/* Sets up a clear dielectric material */
+void
+make_dielectric(material *mat, float ior)
+{
+    mat->type = MATERIAL_DIELECTRIC;
+    set_elems(&mat->albedo, 1.0f, 1.0f, 1.0f);
+    zero_out_vector(&mat->emission);
+    mat->albedo_texture = NULL;
+    mat->ior = ior;
+}
+
+/* Picks whether light is reflected or refracted by a dielectric */
+void
+scatter_dielectric(const material *mat, const vec3 *dir, const vec3 *normal,
+                   float u, vec3 *wi)
+{
+    float cos_i = -dot_product(dir, normal);
+    float eta = 1.0f / mat->ior;
+    float r0, cos_t2, cosine, fresnel;
+    vec3 n = *normal, t;
+
+    /* Leaving the surface, from the inside */
+    if (cos_i < 0) {
+        cos_i = -cos_i;
+        eta = mat->ior;
+        negate(&n);
+    } /* if */
+
+    cos_t2 = 1.0f - eta * eta * (1.0f - cos_i * cos_i);
+    r0 = (1.0f - mat->ior) / (1.0f + mat->ior);
+    r0 *= r0;
+
+    /* Schlick takes the angle on the less dense side */
+    cosine = eta > 1.0f ? sqrtf(fmaxf(cos_t2, 0)) : cos_i;
+    fresnel = r0 + (1.0f - r0) * powf(1.0f - cosine, 5.0f);
+
+    if (cos_t2 <= 0 || u < fresnel) {
+        t = n;
+        multiply_scalar(&t, 2.0f * cos_i);
+        add_vec(wi, dir, &t);
+        return;
+    } /* if */
+
+    *wi = *dir;
+    multiply_scalar(wi, eta);
+    t = n;
+    multiply_scalar(&t, eta * cos_i - sqrtf(cos_t2));
+    add_vec(wi, wi, &t);
+}
+/* EOF */
@@ -0,0 +1,426 @@
+#include <float.h>
+#include <stdlib.h>
+#include <tgmath.h>
+
+#include "../include/medium.h"
+
+/* Below this transmittance, ratio tracking plays russian roulette */
+#define ROULETTE_TRANSMITTANCE 0.1f
+
+typedef struct majorant_walk_t majorant_walk;
+
+/* A 3D DDA over the majorant cells a ray passes through */
+struct majorant_walk_t
+{
+    int cell[3], step[3], dims[3];
+    float next[3], delta[3];
+    float t, t_end;
+};
+
+/* Allocates a medium and its majorant grid */
+static medium *
+alloc_medium(enum medium_type type, const aabb *bounds, int nx, int ny,
+             int nz, float sigma_t, const vec3 *albedo, float g)
+{
+    medium *m = calloc(1, sizeof(*m));
+    size_t voxels = (size_t)nx * (size_t)ny * (size_t)nz;
+
+    if (!m) {
+        return NULL;
+    } /* if */
+
+    m->type = type;
+    m->bounds = *bounds;
+    m->sigma_t = fmaxf(sigma_t, 0);
+    m->albedo = *albedo;
+    m->g = fminf(fmaxf(g, -0.99f), 0.99f);
+    m->nx = nx;
+    m->ny = ny;
+    m->nz = nz;
+    m->mx = (nx + MEDIUM_MAJORANT_VOXELS - 1) / MEDIUM_MAJORANT_VOXELS;
+    m->my = (ny + MEDIUM_MAJORANT_VOXELS - 1) / MEDIUM_MAJORANT_VOXELS;
+    m->mz = (nz + MEDIUM_MAJORANT_VOXELS - 1) / MEDIUM_MAJORANT_VOXELS;
+    m->density = malloc(voxels * sizeof(*m->density));
+    m->majorant = malloc((size_t)m->mx * (size_t)m->my * (size_t)m->mz
+                         * sizeof(*m->majorant));
+
+    if (!m->density || !m->majorant) {
+        delete_medium(m);
+        return NULL;
+    } /* if */
+
+    return m;
+}
+
+/* Sets each majorant cell to the highest density that can be interpolated
+ * inside it, which includes the voxels just past its edges */
+static void
+build_majorants(medium *m)
+{
+    int cx, cy, cz, i, j, k;
+
+    for (cz = 0; cz < m->mz; cz++) {
+        for (cy = 0; cy < m->my; cy++) {
+            for (cx = 0; cx < m->mx; cx++) {
+                int i0 = cx * MEDIUM_MAJORANT_VOXELS - 1;
+                int j0 = cy * MEDIUM_MAJORANT_VOXELS - 1;
+                int k0 = cz * MEDIUM_MAJORANT_VOXELS - 1;
+                float hi = 0;
+
+                for (k = k0; k <= k0 + MEDIUM_MAJORANT_VOXELS + 1; k++) {
+                    for (j = j0; j <= j0 + MEDIUM_MAJORANT_VOXELS + 1; j++) {
+                        for (i = i0; i <= i0 + MEDIUM_MAJORANT_VOXELS + 1;
+                             i++) {
+                            if (i >= 0 && i < m->nx && j >= 0 && j < m->ny
+                                && k >= 0 && k < m->nz) {
+                                hi = fmaxf(hi, m->density[((size_t)k * m->ny
+                                                           + j) * m->nx + i]);
+                            } /* if */
+                        } /* for */
+                    } /* for */
+                } /* for */
+
+                m->majorant[((size_t)cz * m->my + cy) * m->mx + cx] = hi;
+            } /* for */
+        } /* for */
+    } /* for */
+}
+
+/* Creates a medium of constant density */
+medium *
+create_homogeneous_medium(const aabb *bounds, float sigma_t,
+                          const vec3 *albedo, float g)
+{
+    medium *m = alloc_medium(MEDIUM_HOMOGENEOUS, bounds, 1, 1, 1, sigma_t,
+                             albedo, g);
+
+    if (m) {
+        m->density[0] = 1.0f;
+        m->majorant[0] = 1.0f;
+    } /* if */
+
+    return m;
+}
+
+/* Creates a medium from a density grid */
+medium *
+create_grid_medium(const aabb *bounds, int nx, int ny, int nz,
+                   const float *density, float sigma_t, const vec3 *albedo,
+                   float g)
+{
+    medium *m;
+    size_t v, voxels;
+
+    if (nx <= 0 || ny <= 0 || nz <= 0) {
+        return NULL;
+    } /* if */
+
+    m = alloc_medium(MEDIUM_GRID, bounds, nx, ny, nz, sigma_t, albedo, g);
+
+    if (!m) {
+        return NULL;
+    } /* if */
+
+    voxels = (size_t)nx * (size_t)ny * (size_t)nz;
+
+    for (v = 0; v < voxels; v++) {
+        m->density[v] = fminf(fmaxf(density[v], 0), 1.0f);
+    } /* for */
+
+    build_majorants(m);
+
+    return m;
+}
+
+/* Deletes a medium */
+void
+delete_medium(medium *m)
+{
+    if (!m) {
+        return;
+    } /* if */
+
+    free(m->density);
+    free(m->majorant);
+    free(m);
+}
+
+/* Gets the density of a medium at a point */
+float
+medium_density(const medium *m, const vec3 *p)
+{
+    const int dims[3] = {m->nx, m->ny, m->nz};
+    int lo[3], hi[3], a;
+    float f[3], c00, c01, c10, c11;
+
+    for (a = 0; a < 3; a++) {
+        float base = m->bounds.min.e[a], extent = m->bounds.max.e[a] - base;
+        float u;
+
+        if (!(p->e[a] >= base && p->e[a] <= base + extent)) {
+            return 0;
+        } /* if */
+
+        if (m->type == MEDIUM_HOMOGENEOUS) {
+            continue;
+        } /* if */
+
+        /* Voxel centers sit half a voxel in from the box faces */
+        u = extent > 0 ? (p->e[a] - base) / extent * (float)dims[a] - 0.5f
+                         : 0;
+        lo[a] = (int)floor(u);
+        f[a] = u - (float)lo[a];
+        hi[a] = lo[a] + 1 < dims[a] ? lo[a] + 1 : dims[a] - 1;
+        lo[a] = lo[a] < 0 ? 0 : lo[a];
+        hi[a] = hi[a] < 0 ? 0 : hi[a];
+    } /* for */
+
+    if (m->type == MEDIUM_HOMOGENEOUS) {
+        return m->density[0];
+    } /* if */
+
+#define VOXEL(i, j, k) \
+    m->density[((size_t)(k) * m->ny + (j)) * m->nx + (i)]
+
+    c00 = VOXEL(lo[0], lo[1], lo[2])
+          + f[0] * (VOXEL(hi[0], lo[1], lo[2]) - VOXEL(lo[0], lo[1], lo[2]));
+    c10 = VOXEL(lo[0], hi[1], lo[2])
+          + f[0] * (VOXEL(hi[0], hi[1], lo[2]) - VOXEL(lo[0], hi[1], lo[2]));
+    c01 = VOXEL(lo[0], lo[1], hi[2])
+          + f[0] * (VOXEL(hi[0], lo[1], hi[2]) - VOXEL(lo[0], lo[1], hi[2]));
+    c11 = VOXEL(lo[0], hi[1], hi[2])
+          + f[0] * (VOXEL(hi[0], hi[1], hi[2]) - VOXEL(lo[0], hi[1], hi[2]));
+
+#undef VOXEL
+
+    c00 += f[1] * (c10 - c00);
+    c01 += f[1] * (c11 - c01);
+
+    return c00 + f[2] * (c01 - c00);
+}
+
+/* Clips a ray against the box of a medium and sets up the walk over the
+ * majorant cells inside it */
+static bool
+start_walk(const medium *m, const ray *r, float t_max, majorant_walk *w)
+{
+    const vec3 *o = origin(r), *d = direction(r);
+    float t0 = 0, t1 = t_max;
+    int a;
+
+    w->dims[0] = m->mx;
+    w->dims[1] = m->my;
+    w->dims[2] = m->mz;
+
+    for (a = 0; a < 3; a++) {
+        float inv = 1.0f / d->e[a];
+        float near = (m->bounds.min.e[a] - o->e[a]) * inv;
+        float far = (m->bounds.max.e[a] - o->e[a]) * inv;
+
+        if (near > far) {
+            float swap = near;
+
+            near = far;
+            far = swap;
+        } /* if */
+
+        /* NaN from 0 * inf leaves the limits as they are */
+        t0 = near > t0 ? near : t0;
+        t1 = far < t1 ? far : t1;
+    } /* for */
+
+    if (!(t0 < t1)) {
+        return false;
+    } /* if */
+
+    w->t = t0;
+    w->t_end = t1;
+
+    for (a = 0; a < 3; a++) {
+        float lo = m->bounds.min.e[a];
+        float size = (m->bounds.max.e[a] - lo) / (float)w->dims[a];
+        float p = o->e[a] + t0 * d->e[a];
+        int cell = size > 0 ? (int)floor((p - lo) / size) : 0;
+
+        cell = cell < 0 ? 0 : cell;
+        cell = cell >= w->dims[a] ? w->dims[a] - 1 : cell;
+        w->cell[a] = cell;
+
+        if (d->e[a] > 0) {
+            w->step[a] = 1;
+            w->next[a] = (lo + (float)(cell + 1) * size - o->e[a]) / d->e[a];
+            w->delta[a] = size / d->e[a];
+        } else if (d->e[a] < 0) {
+            w->step[a] = -1;
+            w->next[a] = (lo + (float)cell * size - o->e[a]) / d->e[a];
+            w->delta[a] = -size / d->e[a];
+        } else {
+            w->step[a] = 0;
+            w->next[a] = FLT_MAX;
+            w->delta[a] = FLT_MAX;
+        } /* if */
+    } /* for */
+
+    return true;
+}
+
+/* Gets the next stretch of a ray that lies in one majorant cell */
+static bool
+next_segment(const medium *m, majorant_walk *w, float *t0, float *t1,
+             float *majorant)
+{
+    int axis;
+
+    if (!(w->t < w->t_end)) {
+        return false;
+    } /* if */
+
+    axis = w->next[0] < w->next[1] ? 0 : 1;
+    axis = w->next[2] < w->next[axis] ? 2 : axis;
+
+    *t0 = w->t;
+    *t1 = w->next[axis] < w->t_end ? w->next[axis] : w->t_end;
+    *majorant = m->majorant[((size_t)w->cell[2] * m->my + w->cell[1]) * m->mx
+                            + w->cell[0]];
+
+    w->t = *t1;
+    w->cell[axis] += w->step[axis];
+    w->next[axis] += w->delta[axis];
+
+    if (w->cell[axis] < 0 || w->cell[axis] >= w->dims[axis]) {
+        w->t = w->t_end;
+    } /* if */
+
+    return true;
+}
+
+/*
+ * Walks a ray through a medium, stopping at tentative collisions drawn
+ * against the majorants. Delta tracking ends at the first real collision,
+ * ratio tracking weighs the transmittance at each one instead
+ */
+static bool
+track(const medium *m, const ray *r, float t_max, rng *g, bool ratio,
+      float *t_hit, float *transmittance)
+{
+    float dlen = length(direction(r));
+    float t0, t1, majorant, tau;
+    majorant_walk w;
+
+    *transmittance = 1.0f;
+
+    if (m->sigma_t <= 0 || !start_walk(m, r, t_max, &w)) {
+        return false;
+    } /* if */
+
+    tau = -log(1.0f - rng_float(g));
+
+    while (next_segment(m, &w, &t0, &t1, &majorant)) {
+        float sigma = majorant * m->sigma_t * dlen;
+        float t = t0;
+
+        /* Empty cells are crossed in one step */
+        while (sigma > 0 && tau < sigma * (t1 - t)) {
+            vec3 p = *direction(r);
+            float density;
+
+            t += tau / sigma;
+            multiply_scalar(&p, t);
+            add_vec(&p, &p, origin(r));
+            density = medium_density(m, &p);
+
+            if (!ratio && rng_float(g) * majorant < density) {
+                *t_hit = t;
+                return true;
+            } /* if */
+
+            if (ratio) {
+                *transmittance *= fmaxf(1.0f - density / majorant, 0);
+
+                if (*transmittance < ROULETTE_TRANSMITTANCE) {
+                    if (rng_float(g) >= 0.5f) {
+                        *transmittance = 0;
+                        return false;
+                    } /* if */
+
+                    *transmittance *= 2.0f;
+                } /* if */
+            } /* if */
+
+            tau = -log(1.0f - rng_float(g));
+        } /* while */
+
+        if (sigma > 0) {
+            tau -= sigma * (t1 - t);
+        } /* if */
+    } /* while */
+
+    return false;
+}
+
+/* Samples where a ray first scatters in a medium */
+bool
+sample_medium(const medium *m, const ray *r, float t_max, rng *g, float *t)
+{
+    float transmittance;
+
+    return track(m, r, t_max, g, false, t, &transmittance);
+}
+
+/* Estimates the transmittance of a medium along a ray */
+float
+medium_transmittance(const medium *m, const ray *r, float t_max, rng *g)
+{
+    float t, transmittance;
+
+    track(m, r, t_max, g, true, &t, &transmittance);
+
+    return transmittance;
+}
+
+/* Evaluates the Henyey-Greenstein phase function for a cosine */
+static float
+henyey_greenstein(float g, float cosine)
+{
+    float denom = 1.0f + g * g - 2.0f * g * cosine;
+
+    return (1.0f - g * g) / (4.0f * (float)M_PI * denom * sqrtf(denom));
+}
+
+/* Picks a scattered direction from the phase function */
+float
+sample_phase(const medium *m, const vec3 *dir, float u1, float u2, vec3 *wi)
+{
+    float g = m->g, cosine, sine, phi;
+    vec3 t, b;
+
+    if (fabsf(g) < 1e-3f) {
+        cosine = 1.0f - 2.0f * u1;
+    } else {
+        float s = (1.0f - g * g) / (1.0f + g - 2.0f * g * u1);
+
+        cosine = (1.0f + g * g - s * s) / (2.0f * g);
+    } /* if */
+
+    cosine = fminf(fmaxf(cosine, -1.0f), 1.0f);
+    sine = sqrtf(fmaxf(0, 1.0f - cosine * cosine));
+    phi = 2.0f * (float)M_PI * u2;
+
+    orthonormal_basis(dir, &t, &b);
+    multiply_scalar(&t, sine * cosf(phi));
+    multiply_scalar(&b, sine * sinf(phi));
+    *wi = *dir;
+    multiply_scalar(wi, cosine);
+    add_vec(wi, wi, &t);
+    add_vec(wi, wi, &b);
+
+    return henyey_greenstein(g, cosine);
+}
+
+/* Evaluates the phase function */
+float
+phase_function(const medium *m, const vec3 *dir, const vec3 *wi)
+{
+    return henyey_greenstein(m->g, dot_product(dir, wi));
+}
+/* EOF */
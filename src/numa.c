@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/numa.h"
+
+#define NODE_DIR "/sys/devices/system/node"
+#define BITS_PER_LONG (8 * sizeof(long))
+
+/* Marks a processor as part of a node */
+static void
+add_cpu(numa_topology *topo, int node, int cpu)
+{
+    if (cpu < 0 || cpu >= NUMA_MAX_CPUS
+        || numa_node_has_cpu(topo, node, cpu)) {
+        return;
+    } /* if */
+
+    topo->cpus[node][cpu / BITS_PER_LONG] |= 1ul << (cpu % BITS_PER_LONG);
+    topo->num_cpus[node]++;
+}
+
+/* Reads a cpulist file ("0-3,8-11") into a node, keeping allowed processors */
+static int
+read_cpulist(const char *path, const cpu_set_t *allowed, numa_topology *topo,
+             int node)
+{
+    FILE *f = fopen(path, "r");
+    int first, last, cpu;
+    char sep;
+
+    if (!f) {
+        return -1;
+    } /* if */
+
+    while (fscanf(f, "%d", &first) == 1) {
+        last = first;
+
+        if (fscanf(f, "%c", &sep) == 1 && sep == '-') {
+            if (fscanf(f, "%d", &last) != 1) {
+                break;
+            } /* if */
+
+            if (fscanf(f, "%c", &sep) != 1) {
+                sep = '\n';
+            } /* if */
+        } /* if */
+
+        for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, allowed)) {
+                add_cpu(topo, node, cpu);
+            } /* if */
+        } /* for */
+
+        if (sep != ',') {
+            break;
+        } /* if */
+    } /* while */
+
+    fclose(f);
+
+    return 0;
+}
+
+/* Orders node numbers */
+static int
+compare_ints(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/* Finds the NUMA nodes of the host */
+int
+discover_numa(numa_topology *topo)
+{
+    int ids[NUMA_MAX_NODES];
+    int num_ids = 0, k, cpu, id;
+    char path[128];
+    cpu_set_t allowed;
+    struct dirent *entry;
+    DIR *dir;
+
+    memset(topo, 0, sizeof(*topo));
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return -1;
+    } /* if */
+
+    dir = opendir(NODE_DIR);
+
+    while (dir && (entry = readdir(dir)) && num_ids < NUMA_MAX_NODES) {
+        char end;
+
+        if (sscanf(entry->d_name, "node%d%c", &id, &end) == 1) {
+            ids[num_ids++] = id;
+        } /* if */
+    } /* while */
+
+    if (dir) {
+        closedir(dir);
+    } /* if */
+
+    qsort(ids, (size_t)num_ids, sizeof(ids[0]), compare_ints);
+
+    /* Nodes with memory but no usable processors get no workers */
+    for (k = 0; k < num_ids; k++) {
+        int node = topo->num_nodes;
+
+        snprintf(path, sizeof(path), NODE_DIR "/node%d/cpulist", ids[k]);
+
+        if (read_cpulist(path, &allowed, topo, node) == 0
+            && topo->num_cpus[node] > 0) {
+            topo->id[node] = ids[k];
+            topo->num_nodes++;
+        } else {
+            memset(topo->cpus[node], 0, sizeof(topo->cpus[node]));
+            topo->num_cpus[node] = 0;
+        } /* if */
+    } /* for */
+
+    if (topo->num_nodes == 0) {
+        topo->num_nodes = 1;
+        topo->id[0] = 0;
+
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                add_cpu(topo, 0, cpu);
+            } /* if */
+        } /* for */
+    } /* if */
+
+    return 0;
+}
+
+/* Checks whether a processor belongs to a node */
+bool
+numa_node_has_cpu(const numa_topology *topo, int node, int cpu)
+{
+    return (topo->cpus[node][cpu / BITS_PER_LONG]
+            >> (cpu % BITS_PER_LONG)) & 1;
+}
+
+/* Restricts the calling thread to one node */
+int
+bind_to_numa_node(const numa_topology *topo, int node)
+{
+    cpu_set_t set;
+    int cpu;
+
+    CPU_ZERO(&set);
+
+    for (cpu = 0; cpu < NUMA_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+        if (numa_node_has_cpu(topo, node, cpu)) {
+            CPU_SET(cpu, &set);
+        } /* if */
+    } /* for */
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0
+           ? 0 : -1;
+}
+
+/* Faults in every page of a range from the calling thread */
+void
+touch_pages(void *data, size_t size)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    volatile char *p = data;
+    size_t offset;
+
+    page = page > 0 ? page : 4096;
+
+    for (offset = 0; offset < size; offset += (size_t)page) {
+        p[offset] = p[offset];
+    } /* for */
+
+    if (size > 0) {
+        p[size - 1] = p[size - 1];
+    } /* if */
+}
+/* EOF */
@@ -0,0 +1,486 @@
+#include <float.h>
+#include <stdlib.h>
+#include <tgmath.h>
+
+#include "../include/light.h"
+#include "../include/photon.h"
+#include "../include/rng.h"
+
+/* Subtrees smaller than this are never split further into tasks */
+#define MIN_TASK_PHOTONS 256
+
+typedef struct photon_t photon;
+typedef struct photon_task_t photon_task;
+typedef struct nearest_photons_t nearest_photons;
+
+/* Light that landed on a diffuse surface. Kept small, so the nodes a lookup
+ * walks through share cache lines */
+struct photon_t
+{
+    float pos[3];
+    float power[3];     /* Flux the photon carries, per channel */
+    float dir[3];       /* Unit direction it travelled in */
+    int axis;           /* Split axis in the tree, -1 marks an empty slot */
+};
+
+/* A subtree of the kd-tree left to build, and the photons that go in it */
+struct photon_task_t
+{
+    int node;
+    int lo, hi;
+};
+
+struct photon_map_t
+{
+    photon *photons;    /* One slot per emitted photon, then compacted */
+    int num_emitted;
+    int num_stored;
+    photon *heap;       /* The tree, node k at heap[k] from 1 up */
+    photon_task *tasks;
+    int num_tasks;
+};
+
+/* The closest photons found so far, a max heap on the distance */
+struct nearest_photons_t
+{
+    float p[3];
+    float r2;           /* Squared search radius, shrinks once full */
+    int found;
+    float dist2[PHOTON_NEAREST];
+    const photon *near[PHOTON_NEAREST];
+};
+
+/* Creates an empty caustic photon map */
+photon_map *
+create_photon_map(int num_emitted)
+{
+    photon_map *pm = calloc(1, sizeof(*pm));
+
+    if (!pm) {
+        return NULL;
+    } /* if */
+
+    pm->photons = malloc((size_t)(num_emitted > 0 ? num_emitted : 1)
+                         * sizeof(*pm->photons));
+
+    if (!pm->photons) {
+        free(pm);
+        return NULL;
+    } /* if */
+
+    pm->num_emitted = num_emitted;
+
+    return pm;
+}
+
+/* Deletes a photon map */
+void
+delete_photon_map(photon_map *pm)
+{
+    if (!pm) {
+        return;
+    } /* if */
+
+    free(pm->photons);
+    free(pm->heap);
+    free(pm->tasks);
+    free(pm);
+}
+
+/* Traces one photon, storing it where it first lands on a diffuse surface
+ * after passing through glass */
+static void
+trace_photon(photon_map *pm, const scene *s, group_context *ctx, int index,
+             uint64_t seed, float time0, float time1)
+{
+    photon *out = &pm->photons[index];
+    const material *mat;
+    light_emission le;
+    bool specular = false;
+    hit_record rec;
+    vec3 o, d, wi;
+    float time, u1, u2, u3, u4;
+    int k, bounce;
+    ray r;
+    rng g;
+
+    out->axis = -1;
+    seed_rng(&g, seed ^ 0x6a09e667f3bcc909ull, (uint64_t)index);
+    k = (int)(rng_float(&g) * (float)s->num_lights);
+    k = k < s->num_lights ? k : s->num_lights - 1;
+    time = time0 + rng_float(&g) * (time1 - time0);
+    u1 = rng_float(&g);
+    u2 = rng_float(&g);
+    u3 = rng_float(&g);
+    u4 = rng_float(&g);
+    sample_emission(s, &s->lights[k], time, u1, u2, u3, u4, &le);
+
+    /* Each photon carries its share of the flux of all lights */
+    multiply_scalar(&le.power, (float)s->num_lights / (float)pm->num_emitted);
+    o = le.p;
+    d = le.dir;
+
+    for (bounce = 0; bounce < PHOTON_MAX_BOUNCES; bounce++) {
+        set_ray_vectors(&r, &o, &d);
+        set_ray_time(&r, time);
+
+        if (!hit_scene(s, ctx, &r, 0.001f, FLT_MAX, &rec)) {
+            return;
+        } /* if */
+
+        mat = &s->materials[rec.material];
+
+        if (mat->type == MATERIAL_DIELECTRIC) {
+            scatter_dielectric(mat, &d, &rec.normal, rng_float(&g), &wi);
+            o = rec.p;
+            d = wi;
+            specular = true;
+            continue;
+        } /* if */
+
+        /* Light reaching diffuse surfaces straight away is sampled directly
+         * by the path tracer */
+        if (mat->type == MATERIAL_LIGHT || !specular) {
+            return;
+        } /* if */
+
+        out->pos[0] = rec.p.e[0];
+        out->pos[1] = rec.p.e[1];
+        out->pos[2] = rec.p.e[2];
+        out->power[0] = le.power.e[0];
+        out->power[1] = le.power.e[1];
+        out->power[2] = le.power.e[2];
+        out->dir[0] = d.e[0];
+        out->dir[1] = d.e[1];
+        out->dir[2] = d.e[2];
+        out->axis = 0;
+        return;
+    } /* for */
+}
+
+/* Emits a run of photons and traces them through the scene */
+void
+emit_photons(photon_map *pm, const scene *s, group_context *ctx, int first,
+             int count, uint64_t seed, float time0, float time1)
+{
+    int k;
+
+    for (k = first; k < first + count && k < pm->num_emitted; k++) {
+        if (s->num_lights > 0) {
+            trace_photon(pm, s, ctx, k, seed, time0, time1);
+        } else {
+            pm->photons[k].axis = -1;
+        } /* if */
+    } /* for */
+}
+
+/* Gets how many of n nodes go left of the root of a left balanced tree */
+static int
+left_size(int n)
+{
+    int full = 1, last, half;
+
+    if (n <= 1) {
+        return 0;
+    } /* if */
+
+    while (2 * full <= n) {
+        full *= 2;
+    } /* while */
+
+    /* All levels are full but the last, which fills from the left */
+    last = n - (full - 1);
+    half = full / 2;
+
+    return half - 1 + (last < half ? last : half);
+}
+
+/* Reorders photons so the kth is where it would be if they were sorted along
+ * an axis, with none greater before it and none smaller after it */
+static void
+select_photon(photon *p, int n, int k, int axis)
+{
+    int lo = 0, hi = n - 1, i, j;
+    float a, b, c, pivot;
+    photon tmp;
+
+    while (hi > lo) {
+        a = p[lo].pos[axis];
+        b = p[lo + (hi - lo) / 2].pos[axis];
+        c = p[hi].pos[axis];
+        pivot = fmaxf(fminf(a, b), fminf(fmaxf(a, b), c));
+
+        for (i = lo, j = hi; i <= j; ) {
+            while (p[i].pos[axis] < pivot) {
+                i++;
+            } /* while */
+
+            while (p[j].pos[axis] > pivot) {
+                j--;
+            } /* while */
+
+            if (i <= j) {
+                tmp = p[i];
+                p[i++] = p[j];
+                p[j--] = tmp;
+            } /* if */
+        } /* for */
+
+        if (k <= j) {
+            hi = j;
+        } else if (k >= i) {
+            lo = i;
+        } else {
+            break;
+        } /* if */
+    } /* while */
+}
+
+/* Places the median of photons lo to hi along their longest side at a node
+ * of the tree. Returns where the median ended up */
+static int
+place_median(photon_map *pm, int node, int lo, int hi)
+{
+    photon *p = pm->photons;
+    float lower[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+    float upper[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    int k, a, axis = 0, mid;
+
+    for (k = lo; k < hi; k++) {
+        for (a = 0; a < 3; a++) {
+            lower[a] = fminf(lower[a], p[k].pos[a]);
+            upper[a] = fmaxf(upper[a], p[k].pos[a]);
+        } /* for */
+    } /* for */
+
+    for (a = 1; a < 3; a++) {
+        if (upper[a] - lower[a] > upper[axis] - lower[axis]) {
+            axis = a;
+        } /* if */
+    } /* for */
+
+    mid = lo + left_size(hi - lo);
+    select_photon(p + lo, hi - lo, mid - lo, axis);
+    p[mid].axis = axis;
+    pm->heap[node] = p[mid];
+
+    return mid;
+}
+
+/* Builds the subtree at a node from photons lo to hi */
+static void
+build_subtree(photon_map *pm, int node, int lo, int hi)
+{
+    int mid;
+
+    if (lo >= hi) {
+        return;
+    } /* if */
+
+    mid = place_median(pm, node, lo, hi);
+    build_subtree(pm, 2 * node, lo, mid);
+    build_subtree(pm, 2 * node + 1, mid + 1, hi);
+}
+
+/* Builds the top levels of the tree, leaving the subtrees below as tasks */
+static void
+split_tree(photon_map *pm, int node, int lo, int hi, int levels)
+{
+    photon_task *task;
+    int mid;
+
+    if (lo >= hi) {
+        return;
+    } /* if */
+
+    if (levels == 0 || hi - lo <= MIN_TASK_PHOTONS) {
+        task = &pm->tasks[pm->num_tasks++];
+        task->node = node;
+        task->lo = lo;
+        task->hi = hi;
+        return;
+    } /* if */
+
+    mid = place_median(pm, node, lo, hi);
+    split_tree(pm, 2 * node, lo, mid, levels - 1);
+    split_tree(pm, 2 * node + 1, mid + 1, hi, levels - 1);
+}
+
+/* Starts building the kd-tree of a map */
+int
+prepare_photon_tree(photon_map *pm, int min_tasks)
+{
+    int k, n = 0, levels = 0;
+
+    /* Most emitted photons never make it through glass */
+    for (k = 0; k < pm->num_emitted; k++) {
+        if (pm->photons[k].axis >= 0) {
+            pm->photons[n++] = pm->photons[k];
+        } /* if */
+    } /* for */
+
+    while ((1 << levels) < min_tasks && levels < 16) {
+        levels++;
+    } /* while */
+
+    pm->num_stored = n;
+    pm->num_tasks = 0;
+    free(pm->heap);
+    free(pm->tasks);
+    pm->heap = malloc((size_t)(n + 1) * sizeof(*pm->heap));
+    pm->tasks = malloc(((size_t)1 << levels) * sizeof(*pm->tasks));
+
+    if (!pm->heap || !pm->tasks) {
+        free(pm->heap);
+        free(pm->tasks);
+        pm->heap = NULL;
+        pm->tasks = NULL;
+        pm->num_stored = 0;
+        return -1;
+    } /* if */
+
+    split_tree(pm, 1, 0, n, levels);
+
+    return pm->num_tasks;
+}
+
+/* Builds one subtree left by prepare_photon_tree */
+void
+build_photon_subtree(photon_map *pm, int task)
+{
+    const photon_task *t = &pm->tasks[task];
+
+    build_subtree(pm, t->node, t->lo, t->hi);
+}
+
+/* Adds a photon to the closest ones, which it is closer than the farthest of */
+static void
+add_nearest(nearest_photons *np, const photon *p, float d2)
+{
+    int k, c;
+
+    if (np->found < PHOTON_NEAREST) {
+        for (k = np->found++; k > 0 && np->dist2[(k - 1) / 2] < d2;
+             k = (k - 1) / 2) {
+            np->dist2[k] = np->dist2[(k - 1) / 2];
+            np->near[k] = np->near[(k - 1) / 2];
+        } /* for */
+
+        np->dist2[k] = d2;
+        np->near[k] = p;
+
+        if (np->found == PHOTON_NEAREST) {
+            np->r2 = np->dist2[0];
+        } /* if */
+
+        return;
+    } /* if */
+
+    /* Full, the photon takes the place of the farthest one */
+    for (k = 0; (c = 2 * k + 1) < PHOTON_NEAREST; k = c) {
+        if (c + 1 < PHOTON_NEAREST && np->dist2[c + 1] > np->dist2[c]) {
+            c++;
+        } /* if */
+
+        if (np->dist2[c] <= d2) {
+            break;
+        } /* if */
+
+        np->dist2[k] = np->dist2[c];
+        np->near[k] = np->near[c];
+    } /* for */
+
+    np->dist2[k] = d2;
+    np->near[k] = p;
+    np->r2 = np->dist2[0];
+}
+
+/* Looks for the closest photons in the subtree at a node, visiting the side
+ * of the split the point is on first */
+static void
+locate_photons(const photon_map *pm, int node, nearest_photons *np)
+{
+    const photon *p = &pm->heap[node];
+    float delta, dx, dy, dz, d2;
+    int first;
+
+    if (2 * node <= pm->num_stored) {
+        delta = np->p[p->axis] - p->pos[p->axis];
+        first = delta < 0 ? 2 * node : 2 * node + 1;
+
+        if (first <= pm->num_stored) {
+            locate_photons(pm, first, np);
+        } /* if */
+
+        if (delta * delta < np->r2 && (first ^ 1) <= pm->num_stored) {
+            locate_photons(pm, first ^ 1, np);
+        } /* if */
+    } /* if */
+
+    dx = np->p[0] - p->pos[0];
+    dy = np->p[1] - p->pos[1];
+    dz = np->p[2] - p->pos[2];
+    d2 = dx * dx + dy * dy + dz * dz;
+
+    if (d2 < np->r2) {
+        add_nearest(np, p, d2);
+    } /* if */
+}
+
+/* Estimates the caustic light arriving at a diffuse surface point */
+bool
+photon_estimate(const photon_map *pm, const vec3 *p, const vec3 *normal,
+                vec3 *radiance)
+{
+    float r2, sum[3] = {0, 0, 0};
+    nearest_photons np;
+    const photon *q;
+    int k;
+
+    if (!pm->heap || pm->num_stored == 0) {
+        return false;
+    } /* if */
+
+    np.p[0] = p->e[0];
+    np.p[1] = p->e[1];
+    np.p[2] = p->e[2];
+    np.r2 = PHOTON_MAX_RADIUS * PHOTON_MAX_RADIUS;
+    np.found = 0;
+    locate_photons(pm, 1, &np);
+
+    if (np.found == 0) {
+        return false;
+    } /* if */
+
+    for (k = 0; k < np.found; k++) {
+        q = np.near[k];
+
+        if (q->dir[0] * normal->e[0] + q->dir[1] * normal->e[1]
+            + q->dir[2] * normal->e[2] < 0) {
+            sum[0] += q->power[0];
+            sum[1] += q->power[1];
+            sum[2] += q->power[2];
+        } /* if */
+    } /* for */
+
+    /* Flux over the disc the photons were found in is the irradiance, and a
+     * diffuse surface sends out 1 / pi of it per unit albedo */
+    r2 = np.found == PHOTON_NEAREST ? np.r2
+                                    : PHOTON_MAX_RADIUS * PHOTON_MAX_RADIUS;
+    set_elems(radiance, sum[0], sum[1], sum[2]);
+    divide_scalar(radiance, (float)(M_PI * M_PI) * r2);
+
+    return true;
+}
+
+/* Counts the photons of a map */
+int
+photon_map_count(const photon_map *pm, int *stored)
+{
+    if (stored) {
+        *stored = pm->num_stored;
+    } /* if */
+
+    return pm->num_emitted;
+}
+/* EOF */
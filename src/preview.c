@@ -0,0 +1,330 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <tgmath.h>
+#include <unistd.h>
+
+#include "../include/preview.h"
+
+/* How long a write may make no progress before the frame is given up on */
+#define WRITE_TIMEOUT_MS 100
+
+typedef struct preview_frame_t preview_frame;
+
+/* One P6 image, header included */
+struct preview_frame_t
+{
+    unsigned char *data;
+    size_t size, cap;
+};
+
+struct preview_t
+{
+    char *path;
+    bool socket;
+    int max_width;
+    int fd;                 /* The viewer connection, -1 while there is none */
+    preview_frame front;    /* Owned by the writer thread */
+    preview_frame back;     /* The newest frame, guarded by lock */
+    bool pending;           /* Whether back holds a frame not yet sent */
+    bool quit;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+};
+
+/* Tone maps a linear channel with extended Reinhard and gamma 2 */
+static unsigned char
+tone_map(float f)
+{
+    const float white = 4.0f;
+
+    f = f > 0 ? f : 0;
+    f = f * (1.0f + f / (white * white)) / (1.0f + f);
+
+    return (unsigned char)(255.99f * sqrtf(fminf(f, 1.0f)));
+}
+
+/* Resolves the framebuffer into a frame, averaging factor^2 pixel blocks */
+static int
+resolve_frame(preview_frame *frame, const framebuffer *fb, int factor)
+{
+    int w = fb->nx / factor, h = fb->ny / factor;
+    int header, i, j, di, dj;
+    size_t size;
+    unsigned char *out;
+    char text[32];
+
+    w = w > 0 ? w : 1;
+    h = h > 0 ? h : 1;
+    header = snprintf(text, sizeof(text), "P6\n%d %d\n255\n", w, h);
+    size = (size_t)header + 3 * (size_t)w * (size_t)h;
+
+    if (size > frame->cap) {
+        out = realloc(frame->data, size);
+
+        if (!out) {
+            return -1;
+        } /* if */
+
+        frame->data = out;
+        frame->cap = size;
+    } /* if */
+
+    memcpy(frame->data, text, (size_t)header);
+    out = frame->data + header;
+
+    /* Rows go out top first, the framebuffer keeps them bottom first */
+    for (j = h - 1; j >= 0; j--) {
+        for (i = 0; i < w; i++) {
+            float sum[3] = {0, 0, 0};
+            int n = 0;
+
+            for (dj = 0; dj < factor && j * factor + dj < fb->ny; dj++) {
+                for (di = 0; di < factor && i * factor + di < fb->nx; di++) {
+                    size_t p = (size_t)(j * factor + dj) * fb->nx
+                               + (size_t)(i * factor + di);
+                    float inv;
+
+                    if (fb->samples[p] == 0) {
+                        continue;
+                    } /* if */
+
+                    inv = 1.0f / (float)fb->samples[p];
+                    sum[0] += fb->accum[3 * p + 0] * inv;
+                    sum[1] += fb->accum[3 * p + 1] * inv;
+                    sum[2] += fb->accum[3 * p + 2] * inv;
+                    n++;
+                } /* for */
+            } /* for */
+
+            for (di = 0; di < 3; di++) {
+                *out++ = tone_map(n > 0 ? sum[di] / (float)n : 0);
+            } /* for */
+        } /* for */
+    } /* for */
+
+    frame->size = size;
+
+    return 0;
+}
+
+/* Connects to the viewer. Fails quietly while nobody is listening */
+static int
+open_viewer(const preview *p)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (!p->socket) {
+        /* Without O_NONBLOCK this would wait for a reader to show up */
+        return open(p->path, O_WRONLY | O_NONBLOCK);
+    } /* if */
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0) {
+        return -1;
+    } /* if */
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, p->path, sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+        close(fd);
+        return -1;
+    } /* if */
+
+    return fd;
+}
+
+/* Writes a whole frame, waiting for the viewer to drain the pipe. A viewer
+ * that stalls for WRITE_TIMEOUT_MS during shutdown loses the frame */
+static int
+send_frame(preview *p, const preview_frame *frame)
+{
+    struct pollfd pfd = {p->fd, POLLOUT, 0};
+    size_t done = 0;
+    bool quit;
+
+    while (done < frame->size) {
+        ssize_t n = write(p->fd, frame->data + done, frame->size - done);
+
+        if (n > 0) {
+            done += (size_t)n;
+            continue;
+        } /* if */
+
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK
+            && errno != EINTR) {
+            return -1;
+        } /* if */
+
+        if (poll(&pfd, 1, WRITE_TIMEOUT_MS) == 0) {
+            pthread_mutex_lock(&p->lock);
+            quit = p->quit;
+            pthread_mutex_unlock(&p->lock);
+
+            if (quit) {
+                return -1;
+            } /* if */
+        } /* if */
+    } /* while */
+
+    return 0;
+}
+
+/* Background thread body: sends the newest frame whenever there is one */
+static void *
+write_frames(void *arg)
+{
+    preview *p = arg;
+    preview_frame swap;
+    sigset_t pipe_set;
+
+    /* A viewer going away must not kill the renderer, the write fails with
+     * EPIPE instead */
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, NULL);
+
+    pthread_mutex_lock(&p->lock);
+
+    for (;;) {
+        while (!p->pending && !p->quit) {
+            pthread_cond_wait(&p->wake, &p->lock);
+        } /* while */
+
+        if (!p->pending) {
+            break;
+        } /* if */
+
+        swap = p->front;
+        p->front = p->back;
+        p->back = swap;
+        p->pending = false;
+        pthread_mutex_unlock(&p->lock);
+
+        if (p->fd < 0) {
+            p->fd = open_viewer(p);
+        } /* if */
+
+        if (p->fd >= 0 && send_frame(p, &p->front) != 0) {
+            close(p->fd);
+            p->fd = -1;
+        } /* if */
+
+        pthread_mutex_lock(&p->lock);
+    } /* for */
+
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+/* Creates a preview stream */
+preview *
+create_preview(const char *path, int max_width)
+{
+    preview *p;
+    struct stat st;
+
+    if (stat(path, &st) != 0) {
+        if (errno != ENOENT || mkfifo(path, 0644) != 0
+            || stat(path, &st) != 0) {
+            return NULL;
+        } /* if */
+    } /* if */
+
+    if (!S_ISFIFO(st.st_mode) && !S_ISSOCK(st.st_mode)) {
+        errno = EINVAL;
+        return NULL;
+    } /* if */
+
+    p = calloc(1, sizeof(*p));
+
+    if (!p) {
+        return NULL;
+    } /* if */
+
+    p->path = strdup(path);
+    p->socket = S_ISSOCK(st.st_mode);
+    p->max_width = max_width > 0 ? max_width : 1;
+    p->fd = -1;
+
+    if (!p->path) {
+        free(p);
+        return NULL;
+    } /* if */
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+
+    if (pthread_create(&p->thread, NULL, write_frames, p) != 0) {
+        pthread_cond_destroy(&p->wake);
+        pthread_mutex_destroy(&p->lock);
+        free(p->path);
+        free(p);
+        return NULL;
+    } /* if */
+
+    return p;
+}
+
+/* Hands a downscaled snapshot of the framebuffer to the writer thread */
+int
+request_preview(preview *p, const framebuffer *fb)
+{
+    int factor = (fb->nx + p->max_width - 1) / p->max_width;
+    int err;
+
+    /* The writer only holds the lock to swap buffers, never while writing */
+    pthread_mutex_lock(&p->lock);
+    err = resolve_frame(&p->back, fb, factor > 0 ? factor : 1);
+
+    if (!err) {
+        p->pending = true;
+        pthread_cond_signal(&p->wake);
+    } /* if */
+
+    pthread_mutex_unlock(&p->lock);
+
+    return err;
+}
+
+/* Flushes and deletes a preview stream */
+void
+delete_preview(preview *p)
+{
+    if (!p) {
+        return;
+    } /* if */
+
+    pthread_mutex_lock(&p->lock);
+    p->quit = true;
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+
+    if (p->fd >= 0) {
+        close(p->fd);
+    } /* if */
+
+    pthread_cond_destroy(&p->wake);
+    pthread_mutex_destroy(&p->lock);
+    free(p->front.data);
+    free(p->back.data);
+    free(p->path);
+    free(p);
+}
+/* EOF */
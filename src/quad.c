@@ -0,0 +1,67 @@
+#include <tgmath.h>
+
+#include "../include/quad.h"
+
+/* Sets up a quad */
+void
+make_quad(quad *q, const vec3 *corner, const vec3 *edge_u, const vec3 *edge_v,
+          int material)
+{
+    vec3 n;
+
+    q->corner = *corner;
+    q->edge_u = *edge_u;
+    q->edge_v = *edge_v;
+    q->material = material;
+
+    cross_product(&n, edge_u, edge_v);
+    q->area = length(&n);
+    turn_into_unit_vector(&q->normal, &n);
+}
+
+/* Intersects a ray with a quad */
+bool
+hit_quad(const quad *q, const ray *r, float t_min, float t_max,
+         hit_record *rec)
+{
+    float denom = dot_product(&q->normal, direction(r));
+    float t, a, b, uu, uv, vv, pu, pv, det;
+    vec3 rel, p;
+
+    if (fabsf(denom) < 1e-8f) {
+        return false;
+    } /* if */
+
+    subtract_vec(&rel, &q->corner, origin(r));
+    t = dot_product(&q->normal, &rel) / denom;
+
+    if (t <= t_min || t >= t_max) {
+        return false;
+    } /* if */
+
+    /* Solve p - corner = a * edge_u + b * edge_v in the plane */
+    point_at_parameter(r, t, &p);
+    subtract_vec(&rel, &p, &q->corner);
+    uu = dot_product(&q->edge_u, &q->edge_u);
+    uv = dot_product(&q->edge_u, &q->edge_v);
+    vv = dot_product(&q->edge_v, &q->edge_v);
+    pu = dot_product(&rel, &q->edge_u);
+    pv = dot_product(&rel, &q->edge_v);
+    det = uu * vv - uv * uv;
+    a = (pu * vv - pv * uv) / det;
+    b = (pv * uu - pu * uv) / det;
+
+    if (a < 0 || a > 1 || b < 0 || b > 1) {
+        return false;
+    } /* if */
+
+    rec->t = t;
+    rec->p = p;
+    rec->normal = q->normal;
+    rec->u = a;
+    rec->v = b;
+    rec->material = q->material;
+
+    return true;
+}
+/* EOF */
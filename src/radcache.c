@@ -0,0 +1,218 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+
+#include "../include/radcache.h"
+
+/* Bits of each quantized coordinate in a key */
+#define COORD_BITS 19
+
+typedef struct cache_cell_t cache_cell;
+
+/* A slot of the table. A key of 0 marks a free slot, the sums are the bits
+ * of floats so they can be updated with a compare and swap */
+struct cache_cell_t
+{
+    atomic_uint_fast64_t key;
+    atomic_uint sum[3];
+    atomic_uint count;
+};
+
+struct radiance_cache_t
+{
+    cache_cell *cells;
+    uint64_t mask;
+    float inv_cell_size;
+};
+
+/* Creates a radiance cache */
+radiance_cache *
+create_radiance_cache(int log2_cells, float cell_size)
+{
+    radiance_cache *c = calloc(1, sizeof(*c));
+    size_t n = (size_t)1 << log2_cells;
+    size_t k;
+
+    if (!c) {
+        return NULL;
+    } /* if */
+
+    c->cells = malloc(n * sizeof(*c->cells));
+
+    if (!c->cells) {
+        free(c);
+        return NULL;
+    } /* if */
+
+    for (k = 0; k < n; k++) {
+        atomic_init(&c->cells[k].key, 0);
+        atomic_init(&c->cells[k].sum[0], 0);
+        atomic_init(&c->cells[k].sum[1], 0);
+        atomic_init(&c->cells[k].sum[2], 0);
+        atomic_init(&c->cells[k].count, 0);
+    } /* for */
+
+    c->mask = n - 1;
+    c->inv_cell_size = 1.0f / cell_size;
+
+    return c;
+}
+
+/* Deletes a radiance cache */
+void
+delete_radiance_cache(radiance_cache *c)
+{
+    if (!c) {
+        return;
+    } /* if */
+
+    free(c->cells);
+    free(c);
+}
+
+/* Quantizes a coordinate to the grid, wrapping far away cells onto near
+ * ones, which only costs a collision */
+static uint64_t
+quantize_coord(float x, float inv_cell_size)
+{
+    int64_t q = (int64_t)floorf(x * inv_cell_size);
+
+    return (uint64_t)q & (((uint64_t)1 << COORD_BITS) - 1);
+}
+
+/* Quantizes a normal component to one of 3 levels */
+static uint64_t
+quantize_normal(float n)
+{
+    int q = (int)((n + 1.0f) * 1.5f);
+
+    return (uint64_t)(q < 0 ? 0 : q > 2 ? 2 : q);
+}
+
+/* Scrambles a key into a well spread table index, the splitmix64 finalizer */
+static uint64_t
+hash_key(uint64_t key)
+{
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebull;
+
+    return key ^ (key >> 31);
+}
+
+/* Finds the cell a surface point falls in */
+int
+radiance_cache_cell(radiance_cache *c, const vec3 *p, const vec3 *normal)
+{
+    uint64_t key, slot, seen;
+    int k;
+
+    /* The top bit keeps real keys away from the free marker */
+    key = (uint64_t)1 << 63
+          | (quantize_normal(get_x(normal)) * 9
+             + quantize_normal(get_y(normal)) * 3
+             + quantize_normal(get_z(normal))) << (3 * COORD_BITS)
+          | quantize_coord(get_x(p), c->inv_cell_size) << (2 * COORD_BITS)
+          | quantize_coord(get_y(p), c->inv_cell_size) << COORD_BITS
+          | quantize_coord(get_z(p), c->inv_cell_size);
+    slot = hash_key(key);
+
+    for (k = 0; k <= RADIANCE_CACHE_PROBES; k++) {
+        cache_cell *cell = &c->cells[(slot + (uint64_t)k) & c->mask];
+
+        seen = atomic_load_explicit(&cell->key, memory_order_relaxed);
+
+        /* A lost race is fine as long as the winner claimed the same key */
+        if (seen == 0) {
+            atomic_compare_exchange_strong(&cell->key, &seen, key);
+
+            if (seen == 0) {
+                seen = key;
+            } /* if */
+        } /* if */
+
+        if (seen == key) {
+            return (int)((slot + (uint64_t)k) & c->mask);
+        } /* if */
+    } /* for */
+
+    return -1;
+}
+
+/* Gets the average light that arrived in a cell */
+bool
+radiance_cache_lookup(radiance_cache *c, int cell, vec3 *radiance)
+{
+    cache_cell *e = &c->cells[cell];
+    unsigned count = atomic_load_explicit(&e->count, memory_order_acquire);
+    unsigned bits[3];
+    float sum[3];
+    int k;
+
+    if (count < RADIANCE_CACHE_MIN_SAMPLES) {
+        return false;
+    } /* if */
+
+    /* Samples added since the count was read may already be in the sums,
+     * which stays within a few samples of the true average */
+    for (k = 0; k < 3; k++) {
+        bits[k] = atomic_load_explicit(&e->sum[k], memory_order_relaxed);
+    } /* for */
+
+    memcpy(sum, bits, sizeof(sum));
+    set_elems(radiance, sum[0] / (float)count, sum[1] / (float)count,
+              sum[2] / (float)count);
+
+    return true;
+}
+
+/* Adds to a float stored as bits */
+static void
+atomic_add_float(atomic_uint *a, float value)
+{
+    unsigned seen = atomic_load_explicit(a, memory_order_relaxed);
+    unsigned next;
+    float f;
+
+    do {
+        memcpy(&f, &seen, sizeof(f));
+        f += value;
+        memcpy(&next, &f, sizeof(next));
+    } while (!atomic_compare_exchange_weak_explicit(a, &seen, next,
+                                                    memory_order_relaxed,
+                                                    memory_order_relaxed));
+}
+
+/* Adds a sample to a cell */
+void
+radiance_cache_add(radiance_cache *c, int cell, const vec3 *radiance)
+{
+    cache_cell *e = &c->cells[cell];
+
+    atomic_add_float(&e->sum[0], get_r(radiance));
+    atomic_add_float(&e->sum[1], get_g(radiance));
+    atomic_add_float(&e->sum[2], get_b(radiance));
+    atomic_fetch_add_explicit(&e->count, 1, memory_order_release);
+}
+
+/* Counts the cells of a cache that hold samples */
+size_t
+radiance_cache_cells_used(radiance_cache *c, size_t *total)
+{
+    size_t k, used = 0;
+
+    for (k = 0; k <= c->mask; k++) {
+        used += atomic_load_explicit(&c->cells[k].count,
+                                     memory_order_relaxed) > 0;
+    } /* for */
+
+    if (total) {
+        *total = (size_t)c->mask + 1;
+    } /* if */
+
+    return used;
+}
+/* EOF */
@@ -0,0 +1,430 @@
+#include <float.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+
+#include "../include/raster.h"
+
+/* How far past its projected bounds a prim is drawn, in pixels */
+#define RASTER_MARGIN 0.05f
+
+typedef struct raster_entry_t raster_entry;
+typedef struct projection_t projection;
+
+/* A prim binned to a tile */
+struct raster_entry_t
+{
+    float near;         /* No ray can hit the prim closer than this */
+    int prim;
+    float bounds[4];    /* Lowest and highest x and y in the image, in pixels,
+                         * of a ray that can hit the prim */
+    uint8_t rect[4];    /* First and last pixel column and row covered,
+                         * within the tile */
+    sphere shape;       /* Copy of the prim if it is a sphere, so a tile's
+                         * prims are read in order */
+};
+
+/* Maps points to image coordinates. The ray through (u, v) is
+ * lower_left + u * horizontal + v * vertical - origin, and a point at depth s
+ * along the image plane normal is at ray parameter s on its ray */
+struct projection_t
+{
+    vec3 origin, to_plane, horizontal, vertical, normal;
+    float inv_depth;        /* 1 over the plane's distance along normal */
+    float hh, hv, vv, det;  /* For solving for u and v */
+};
+
+struct raster_bins_t
+{
+    projection proj;
+    int nx, ny;
+    int tiles_x, num_tiles;
+    int *tile_start;        /* Entries of tile t are [tile_start[t],
+                             * tile_start[t + 1]) */
+    raster_entry *entries;
+};
+
+/* Sets up the projection of a camera */
+static void
+make_projection(projection *proj, const camera *cam)
+{
+    proj->origin = cam->origin;
+    proj->horizontal = cam->horizontal;
+    proj->vertical = cam->vertical;
+    subtract_vec(&proj->to_plane, &cam->lower_left, &cam->origin);
+    cross_product(&proj->normal, &cam->horizontal, &cam->vertical);
+    proj->inv_depth = 1.0f / dot_product(&proj->to_plane, &proj->normal);
+    proj->hh = dot_product(&cam->horizontal, &cam->horizontal);
+    proj->hv = dot_product(&cam->horizontal, &cam->vertical);
+    proj->vv = dot_product(&cam->vertical, &cam->vertical);
+    proj->det = proj->hh * proj->vv - proj->hv * proj->hv;
+}
+
+/* Projects a point. Returns its depth, u and v are only set in front of the
+ * image plane's origin */
+static float
+project_point(const projection *proj, const vec3 *p, float *u, float *v)
+{
+    vec3 d;
+    float s, qh, qv;
+
+    subtract_vec(&d, p, &proj->origin);
+    s = dot_product(&d, &proj->normal) * proj->inv_depth;
+
+    if (s <= 0) {
+        return s;
+    } /* if */
+
+    multiply_scalar(&d, 1.0f / s);
+    subtract_vec(&d, &d, &proj->to_plane);
+    qh = dot_product(&d, &proj->horizontal);
+    qv = dot_product(&d, &proj->vertical);
+    *u = (proj->vv * qh - proj->hv * qv) / proj->det;
+    *v = (proj->hh * qv - proj->hv * qh) / proj->det;
+
+    return s;
+}
+
+/* Finds where in the image the rays hitting a convex hull of points pass,
+ * with a little to spare on every side for rounding, and the pixels that
+ * covers. Returns false if no ray can hit it */
+static bool
+project_hull(const raster_bins *b, const vec3 *points, int count,
+             float *bounds, int *rect, float *near)
+{
+    float umin = FLT_MAX, umax = -FLT_MAX, vmin = FLT_MAX, vmax = -FLT_MAX;
+    float far = -FLT_MAX, s, u = 0, v = 0;
+    bool behind = false;
+    int k;
+
+    *near = FLT_MAX;
+
+    for (k = 0; k < count; k++) {
+        s = project_point(&b->proj, &points[k], &u, &v);
+        *near = s < *near ? s : *near;
+        far = s > far ? s : far;
+
+        if (s <= 0) {
+            behind = true;
+            continue;
+        } /* if */
+
+        umin = u < umin ? u : umin;
+        umax = u > umax ? u : umax;
+        vmin = v < vmin ? v : vmin;
+        vmax = v > vmax ? v : vmax;
+    } /* for */
+
+    /* Camera rays only count hits past 0.001 */
+    if (far <= 0.001f) {
+        return false;
+    } /* if */
+
+    /* Straddling the camera, the hull may cover any pixel */
+    if (behind) {
+        umin = vmin = -1.0f;
+        umax = (float)b->nx;
+        vmax = (float)b->ny;
+    } else {
+        umin = fmax(umin * (float)b->nx - RASTER_MARGIN, -1.0f);
+        umax = fmin(umax * (float)b->nx + RASTER_MARGIN, (float)b->nx);
+        vmin = fmax(vmin * (float)b->ny - RASTER_MARGIN, -1.0f);
+        vmax = fmin(vmax * (float)b->ny + RASTER_MARGIN, (float)b->ny);
+    } /* if */
+
+    bounds[0] = umin;
+    bounds[1] = vmin;
+    bounds[2] = umax;
+    bounds[3] = vmax;
+    rect[0] = umin > 0 ? (int)umin : 0;
+    rect[1] = vmin > 0 ? (int)vmin : 0;
+    rect[2] = umax < (float)(b->nx - 1) ? (int)umax : b->nx - 1;
+    rect[3] = vmax < (float)(b->ny - 1) ? (int)vmax : b->ny - 1;
+
+    return umax >= 0 && vmax >= 0 && rect[0] <= rect[2]
+           && rect[1] <= rect[3];
+}
+
+/* Finds the pixels and nearest depth of a prim */
+static bool
+project_prim(const raster_bins *b, const scene *s, int prim, float *bounds,
+             int *rect, float *near)
+{
+    vec3 points[8];
+    aabb box;
+    int k;
+
+    if (prim >= s->num_spheres) {
+        const quad *q = &s->quads[prim - s->num_spheres];
+
+        points[0] = q->corner;
+        add_vec(&points[1], &q->corner, &q->edge_u);
+        add_vec(&points[2], &q->corner, &q->edge_v);
+        add_vec(&points[3], &points[1], &q->edge_v);
+
+        return project_hull(b, points, 4, bounds, rect, near);
+    } /* if */
+
+    sphere_bounds(&s->spheres[prim], &box);
+
+    for (k = 0; k < 8; k++) {
+        set_elems(&points[k], k & 1 ? get_x(&box.max) : get_x(&box.min),
+                  k & 2 ? get_y(&box.max) : get_y(&box.min),
+                  k & 4 ? get_z(&box.max) : get_z(&box.min));
+    } /* for */
+
+    return project_hull(b, points, 8, bounds, rect, near);
+}
+
+/* Orders entries nearest first, then by prim */
+static int
+compare_entries(const void *a, const void *b)
+{
+    const raster_entry *ea = a, *eb = b;
+
+    if (ea->near != eb->near) {
+        return ea->near < eb->near ? -1 : 1;
+    } /* if */
+
+    return ea->prim - eb->prim;
+}
+
+/* Sorts the prims of a scene into tiles */
+raster_bins *
+create_raster_bins(const scene *s, const camera *cam, int nx, int ny)
+{
+    raster_bins *b = calloc(1, sizeof(*b));
+    int num_prims = s->num_spheres + s->num_quads;
+    float *near = NULL, *bounds = NULL;
+    bool *binned = NULL;
+    int prim, t, tx, ty, *rects = NULL, *cursor = NULL;
+
+    if (!b) {
+        return NULL;
+    } /* if */
+
+    b->nx = nx;
+    b->ny = ny;
+    b->tiles_x = (nx + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    b->num_tiles = b->tiles_x * ((ny + RENDER_TILE_SIZE - 1)
+                                 / RENDER_TILE_SIZE);
+    b->tile_start = calloc((size_t)b->num_tiles + 1, sizeof(int));
+    rects = malloc(4 * ((size_t)num_prims + 1) * sizeof(int));
+    bounds = malloc(4 * ((size_t)num_prims + 1) * sizeof(float));
+    near = malloc(((size_t)num_prims + 1) * sizeof(float));
+    binned = malloc(((size_t)num_prims + 1) * sizeof(bool));
+    cursor = malloc((size_t)b->num_tiles * sizeof(int));
+
+    if (!b->tile_start || !rects || !bounds || !near || !binned || !cursor) {
+        goto fail;
+    } /* if */
+
+    make_projection(&b->proj, cam);
+
+    /* Count the prims of each tile, then lay the tiles out back to back */
+    for (prim = 0; prim < num_prims; prim++) {
+        int *rect = &rects[4 * prim];
+
+        binned[prim] = project_prim(b, s, prim, &bounds[4 * prim], rect,
+                                    &near[prim]);
+
+        if (!binned[prim]) {
+            continue;
+        } /* if */
+
+        for (ty = rect[1] / RENDER_TILE_SIZE;
+             ty <= rect[3] / RENDER_TILE_SIZE; ty++) {
+            for (tx = rect[0] / RENDER_TILE_SIZE;
+                 tx <= rect[2] / RENDER_TILE_SIZE; tx++) {
+                b->tile_start[ty * b->tiles_x + tx + 1]++;
+            } /* for */
+        } /* for */
+    } /* for */
+
+    for (t = 0; t < b->num_tiles; t++) {
+        b->tile_start[t + 1] += b->tile_start[t];
+        cursor[t] = b->tile_start[t];
+    } /* for */
+
+    b->entries = malloc(((size_t)b->tile_start[b->num_tiles] + 1)
+                        * sizeof(raster_entry));
+
+    if (!b->entries) {
+        goto fail;
+    } /* if */
+
+    for (prim = 0; prim < num_prims; prim++) {
+        const int *rect = &rects[4 * prim];
+
+        if (!binned[prim]) {
+            continue;
+        } /* if */
+
+        for (ty = rect[1] / RENDER_TILE_SIZE;
+             ty <= rect[3] / RENDER_TILE_SIZE; ty++) {
+            for (tx = rect[0] / RENDER_TILE_SIZE;
+                 tx <= rect[2] / RENDER_TILE_SIZE; tx++) {
+                raster_entry *e = &b->entries[cursor[ty * b->tiles_x + tx]++];
+                int x = tx * RENDER_TILE_SIZE, y = ty * RENDER_TILE_SIZE;
+
+                e->near = near[prim];
+                e->prim = prim;
+                memcpy(e->bounds, &bounds[4 * prim], sizeof(e->bounds));
+
+                if (prim < s->num_spheres) {
+                    e->shape = s->spheres[prim];
+                } /* if */
+                e->rect[0] = (uint8_t)(rect[0] > x ? rect[0] - x : 0);
+                e->rect[1] = (uint8_t)(rect[1] > y ? rect[1] - y : 0);
+                e->rect[2] = (uint8_t)(rect[2] < x + RENDER_TILE_SIZE - 1
+                                       ? rect[2] - x : RENDER_TILE_SIZE - 1);
+                e->rect[3] = (uint8_t)(rect[3] < y + RENDER_TILE_SIZE - 1
+                                       ? rect[3] - y : RENDER_TILE_SIZE - 1);
+            } /* for */
+        } /* for */
+    } /* for */
+
+    /* Front to back, prims hidden behind what is already drawn are skipped
+     * without being tested */
+    for (t = 0; t < b->num_tiles; t++) {
+        qsort(&b->entries[b->tile_start[t]],
+              (size_t)(b->tile_start[t + 1] - b->tile_start[t]),
+              sizeof(raster_entry), compare_entries);
+    } /* for */
+
+    free(rects);
+    free(bounds);
+    free(near);
+    free(binned);
+    free(cursor);
+
+    return b;
+
+fail:
+    free(rects);
+    free(bounds);
+    free(near);
+    free(binned);
+    free(cursor);
+    delete_raster_bins(b);
+
+    return NULL;
+}
+
+/* Deletes tile bins */
+void
+delete_raster_bins(raster_bins *b)
+{
+    if (!b) {
+        return;
+    } /* if */
+
+    free(b->tile_start);
+    free(b->entries);
+    free(b);
+}
+
+/* Finds how far along a ray it hits a prim */
+static bool
+prim_distance(const scene *s, const raster_entry *entry, const ray *r,
+              float t_max, float *t)
+{
+    int prim = entry->prim;
+    hit_record rec;
+
+    if (prim < s->num_spheres) {
+        return sphere_distance(&entry->shape, r, 0.001f, t_max, t);
+    } /* if */
+
+    if (!hit_quad(&s->quads[prim - s->num_spheres], r, 0.001f, t_max, &rec)) {
+        return false;
+    } /* if */
+
+    *t = rec.t;
+
+    return true;
+}
+
+/* Gets the furthest depth left in a visibility buffer */
+static float
+farthest_depth(const raster_pixel *pixels, int count)
+{
+    float far = 0;
+    int k;
+
+    for (k = 0; k < count; k++) {
+        far = pixels[k].depth > far ? pixels[k].depth : far;
+    } /* for */
+
+    return far;
+}
+
+/* Fills the visibility buffer of one tile */
+void
+raster_tile(const raster_bins *b, const scene *s, int tile,
+            raster_pixel *pixels)
+{
+    int x = (tile % b->tiles_x) * RENDER_TILE_SIZE;
+    int y = (tile / b->tiles_x) * RENDER_TILE_SIZE;
+    int width = b->nx - x < RENDER_TILE_SIZE ? b->nx - x : RENDER_TILE_SIZE;
+    int height = b->ny - y < RENDER_TILE_SIZE ? b->ny - y : RENDER_TILE_SIZE;
+    float far = farthest_depth(pixels, width * height), t, u = 0, v = 0;
+    float at[2][RENDER_TILE_SIZE * RENDER_TILE_SIZE];
+    int e, i, j;
+    vec3 p;
+    ray r;
+
+    /* Where in the image each ray passes, so it can be checked against the
+     * bounds of a prim before the prim itself. Camera rays end on the image
+     * plane, which is always in front */
+    for (i = 0; i < width * height; i++) {
+        pixels[i].prim = -1;
+        at[0][i] = at[1][i] = -2.0f;
+
+        if (pixels[i].depth > 0) {
+            add_vec(&p, &pixels[i].origin, &pixels[i].dir);
+            project_point(&b->proj, &p, &u, &v);
+            at[0][i] = u * (float)b->nx;
+            at[1][i] = v * (float)b->ny;
+        } /* if */
+    } /* for */
+
+    for (e = b->tile_start[tile]; e < b->tile_start[tile + 1]; e++) {
+        const raster_entry *entry = &b->entries[e];
+
+        /* The far depth only shrinks, so it is only brought up to date once
+         * the prims get past it. Beyond that no prim is left to draw */
+        if (entry->near > far) {
+            far = farthest_depth(pixels, width * height);
+
+            if (entry->near > far) {
+                break;
+            } /* if */
+        } /* if */
+
+        for (j = entry->rect[1]; j <= entry->rect[3]; j++) {
+            for (i = entry->rect[0]; i <= entry->rect[2]; i++) {
+                int k = j * width + i;
+                raster_pixel *px = &pixels[k];
+
+                if (entry->near > px->depth
+                    || at[0][k] < entry->bounds[0]
+                    || at[0][k] > entry->bounds[2]
+                    || at[1][k] < entry->bounds[1]
+                    || at[1][k] > entry->bounds[3]) {
+                    continue;
+                } /* if */
+
+                set_ray_vectors(&r, &px->origin, &px->dir);
+                set_ray_time(&r, px->time);
+
+                if (prim_distance(s, entry, &r, px->depth, &t)) {
+                    px->depth = t;
+                    px->prim = entry->prim;
+                } /* if */
+            } /* for */
+        } /* for */
+    } /* for */
+}
+/* EOF */
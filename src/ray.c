@@ -10,6 +10,7 @@ create_empty_ray(void)
 
     r->A = create_empty_vector();
     r->B = create_empty_vector();
+    r->time = 0;
 
     return r;
 }
@@ -22,6 +23,7 @@ create_ray(vec3 *a, vec3 *b)
 
     r->A = a;
     r->B = b;
+    r->time = 0;
 
     return r;
 }
@@ -32,6 +34,21 @@ set_ray_vectors(ray *r, vec3 *a, vec3 *b)
 {
     r->A = a;
     r->B = b;
+    r->time = 0;
+}
+
+/* Sets the time of a ray */
+void
+set_ray_time(ray *r, float time)
+{
+    r->time = time;
+}
+
+/* Gets the time of a ray */
+float
+ray_time(const ray *r)
+{
+    return r->time;
 }
 
 /* Deletes a ray */
@@ -71,7 +88,7 @@ point_at_parameter(const ray *r, float f, vec3 *vec)
 vec3 *
 point_at_parameter_new(const ray *r, float f)
 {
-    vec3 *vec = malloc(sizeof(vec3 *));
+    vec3 *vec = malloc(sizeof(*vec));
 
     vec->e[0] = r->A->e[0] + f * r->B->e[0];
     vec->e[1] = r->A->e[1] + f * r->B->e[1];
@@ -0,0 +1,95 @@
+#include <string.h>
+
+#include "../include/raysort.h"
+
+/* Spreads the low 10 bits of a value out to every third bit */
+static uint32_t
+spread_bits(uint32_t x)
+{
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+
+    return x;
+}
+
+/* Maps a coordinate to a grid cell along one axis of the bounds */
+static uint32_t
+quantize(float value, float lo, float hi)
+{
+    const float cells = (float)(1 << RAY_SORT_MORTON_BITS);
+    float f = hi > lo ? (value - lo) / (hi - lo) * cells : 0;
+
+    if (!(f > 0)) {
+        return 0;
+    } /* if */
+
+    return f >= cells ? (1u << RAY_SORT_MORTON_BITS) - 1 : (uint32_t)f;
+}
+
+/* Makes a sort key from the direction octant and origin cell */
+uint32_t
+ray_sort_key(const aabb *bounds, const vec3 *o, const vec3 *d)
+{
+    uint32_t octant = (get_x(d) < 0) | (get_y(d) < 0) << 1
+                      | (get_z(d) < 0) << 2;
+    uint32_t x = quantize(get_x(o), get_x(&bounds->min), get_x(&bounds->max));
+    uint32_t y = quantize(get_y(o), get_y(&bounds->min), get_y(&bounds->max));
+    uint32_t z = quantize(get_z(o), get_z(&bounds->min), get_z(&bounds->max));
+
+    return octant << (3 * RAY_SORT_MORTON_BITS) | spread_bits(x) << 2
+           | spread_bits(y) << 1 | spread_bits(z);
+}
+
+/* Sorts items by key, least significant byte first */
+void
+sort_rays(uint32_t *keys, uint32_t *items, uint32_t *scratch, int count)
+{
+    uint32_t *src_keys = keys, *src_items = items;
+    uint32_t *dst_keys = scratch, *dst_items = scratch + count;
+    uint32_t *swap;
+    int offsets[256];
+    int shift, k, sum;
+
+    for (shift = 0; shift < 32; shift += 8) {
+        memset(offsets, 0, sizeof(offsets));
+
+        for (k = 0; k < count; k++) {
+            offsets[(src_keys[k] >> shift) & 0xff]++;
+        } /* for */
+
+        /* Every key has the same byte here, nothing would move */
+        if (count == 0 || offsets[(src_keys[0] >> shift) & 0xff] == count) {
+            continue;
+        } /* if */
+
+        for (k = 0, sum = 0; k < 256; k++) {
+            int n = offsets[k];
+
+            offsets[k] = sum;
+            sum += n;
+        } /* for */
+
+        for (k = 0; k < count; k++) {
+            int slot = offsets[(src_keys[k] >> shift) & 0xff]++;
+
+            dst_keys[slot] = src_keys[k];
+            dst_items[slot] = src_items[k];
+        } /* for */
+
+        swap = src_keys;
+        src_keys = dst_keys;
+        dst_keys = swap;
+        swap = src_items;
+        src_items = dst_items;
+        dst_items = swap;
+    } /* for */
+
+    if (src_keys != keys) {
+        memcpy(keys, src_keys, (size_t)count * sizeof(*keys));
+        memcpy(items, src_items, (size_t)count * sizeof(*items));
+    } /* if */
+}
+/* EOF */
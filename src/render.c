@@ -0,0 +1,893 @@
+#include <errno.h>
+#include <float.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/rtweekend.h"
+
+/* Groups along each side of the grid the clutter is split into with
+ * --groups */
+#define GROUP_CELLS 8
+
+typedef struct checkpoint_timer_t checkpoint_timer;
+typedef struct preview_timer_t preview_timer;
+typedef struct pass_hooks_t pass_hooks;
+
+/* Saves a checkpoint every interval seconds, between passes */
+struct checkpoint_timer_t
+{
+    checkpoint_writer *writer;
+    long interval;
+    time_t last;
+};
+
+/* Sends a preview frame every interval milliseconds, between passes */
+struct preview_timer_t
+{
+    preview *stream;
+    long interval;
+    struct timespec last;
+};
+
+/* Everything that runs between passes */
+struct pass_hooks_t
+{
+    checkpoint_timer *checkpoint;
+    preview_timer *preview;
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+/* Asks the render loop to stop after the current pass */
+static void
+handle_interrupt(int sig)
+{
+    (void)sig;
+    interrupted = 1;
+}
+
+/* Starts a background checkpoint once the interval has passed */
+static void
+checkpoint_pass(const framebuffer *fb, int pass, void *user)
+{
+    checkpoint_timer *timer = user;
+
+    (void)pass;
+
+    if (timer->interval > 0 && time(NULL) - timer->last >= timer->interval) {
+        if (request_checkpoint(timer->writer, fb)) {
+            timer->last = time(NULL);
+        } /* if */
+    } /* if */
+}
+
+/* Sends a preview frame once the interval has passed */
+static void
+preview_pass(const framebuffer *fb, int pass, void *user)
+{
+    preview_timer *timer = user;
+    struct timespec now;
+    long elapsed;
+
+    (void)pass;
+
+    if (!timer->stream) {
+        return;
+    } /* if */
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (long)(now.tv_sec - timer->last.tv_sec) * 1000
+              + (now.tv_nsec - timer->last.tv_nsec) / 1000000;
+
+    if (elapsed >= timer->interval && request_preview(timer->stream, fb) == 0) {
+        timer->last = now;
+    } /* if */
+}
+
+/* Runs the checkpoint and preview hooks after a pass */
+static void
+run_pass_hooks(const framebuffer *fb, int pass, void *user)
+{
+    pass_hooks *hooks = user;
+
+    checkpoint_pass(fb, pass, hooks->checkpoint);
+    preview_pass(fb, pass, hooks->preview);
+}
+
+/**
+ * Fills the scene: the chapter spheres, optional clutter and optional lights
+ * @param world The scene
+ * @param num_spheres The number of small spheres to scatter
+ * @param seed The seed for their placement
+ * @param lights Whether to add a sphere light and a quad light
+ * @param motion Whether the center sphere slides and the clutter hops
+ * @param tex The texture for the center sphere, or NULL
+ * @return 0 on success, -1 if the scene could not be allocated
+ */
+static int
+build_world(scene *world, int num_spheres, uint64_t seed, bool lights,
+            bool motion, texture *tex)
+{
+    material mat;
+    vec3 v1, v2, v3;
+    int center, ground, clutter, lamp;
+    int err = 0;
+
+    set_elems(&v1, 0.7f, 0.3f, 0.3f);
+    make_lambertian(&mat, &v1);
+    mat.albedo_texture = tex;
+    center = add_material(world, &mat);
+
+    set_elems(&v1, 0.8f, 0.8f, 0.0f);
+    make_lambertian(&mat, &v1);
+    ground = add_material(world, &mat);
+
+    set_elems(&v1, 0.6f, 0.6f, 0.6f);
+    make_lambertian(&mat, &v1);
+    clutter = add_material(world, &mat);
+
+    set_elems(&v1, 0, 0, -1);
+    set_elems(&v2, motion ? 0.3f : 0, 0, -1);
+    err |= add_moving_sphere(world, &v1, &v2, 0.5f, center) < 0;
+    set_elems(&v1, 0, -100.5f, -1);
+    err |= add_sphere(world, &v1, 100.0f, ground) < 0;
+    err |= add_random_spheres(world, num_spheres, seed, clutter,
+                              motion ? 0.25f : 0) != 0;
+
+    if (lights) {
+        set_elems(&v1, 8.0f, 7.0f, 6.0f);
+        make_light(&mat, &v1);
+        lamp = add_material(world, &mat);
+        set_elems(&v1, 1.0f, 0.6f, -0.8f);
+        err |= add_sphere(world, &v1, 0.15f, lamp) < 0;
+
+        /* Faces down, lighting the left side of the scene */
+        set_elems(&v1, 2.0f, 2.5f, 3.0f);
+        make_light(&mat, &v1);
+        lamp = add_material(world, &mat);
+        set_elems(&v1, -2.0f, 1.2f, -2.0f);
+        set_elems(&v2, 1.0f, 0, 0);
+        set_elems(&v3, 0, 0, 1.0f);
+        err |= add_quad(world, &v1, &v2, &v3, lamp) < 0;
+    } /* if */
+
+    return err || center < 0 || ground < 0 || clutter < 0 ? -1 : 0;
+}
+
+/**
+ * Fills a density grid with a plume of smoke rising behind the center
+ * sphere, made of overlapping soft blobs along a wavy column
+ * @param density The voxels, n * n * n of them
+ * @param n The number of voxels along each axis
+ */
+static void
+smoke_density(float *density, int n)
+{
+    const int blobs = 24;
+    int i, j, k, b;
+
+    for (k = 0; k < n; k++) {
+        for (j = 0; j < n; j++) {
+            for (i = 0; i < n; i++) {
+                float x = ((float)i + 0.5f) / (float)n;
+                float y = ((float)j + 0.5f) / (float)n;
+                float z = ((float)k + 0.5f) / (float)n;
+                float sum = 0;
+
+                for (b = 0; b < blobs; b++) {
+                    float h = 0.1f + 0.8f * (float)b / (float)(blobs - 1);
+                    float cx = 0.5f + 0.15f * sinf(9.0f * h);
+                    float cz = 0.5f + 0.1f * cosf(7.0f * h);
+                    float r = 0.05f + 0.12f * h;
+                    float dx = x - cx, dy = y - h, dz = z - cz;
+
+                    sum += expf(-(dx * dx + dy * dy + dz * dz) / (r * r));
+                } /* for */
+
+                density[((size_t)k * n + j) * n + i] = fminf(0.6f * sum, 1.0f);
+            } /* for */
+        } /* for */
+    } /* for */
+}
+
+/**
+ * Adds the optional media to the scene
+ * @param world The scene
+ * @param fog Whether to fill the view with thin fog
+ * @param smoke Whether to add a smoke plume behind the center sphere
+ * @param media The array receiving the media, which outlive the scene
+ * @return 0 on success, -1 if the media could not be allocated
+ */
+static int
+build_media(scene *world, bool fog, bool smoke, medium *media[2])
+{
+    const int n = 64;
+    float *density;
+    vec3 albedo;
+    aabb box;
+
+    if (fog) {
+        set_elems(&box.min, -8.0f, -0.5f, -12.0f);
+        set_elems(&box.max, 8.0f, 4.0f, 0.5f);
+        set_elems(&albedo, 0.9f, 0.9f, 0.9f);
+        media[0] = create_homogeneous_medium(&box, 0.08f, &albedo, 0.3f);
+
+        if (!media[0] || add_medium(world, media[0]) < 0) {
+            return -1;
+        } /* if */
+    } /* if */
+
+    if (smoke) {
+        density = malloc((size_t)n * n * n * sizeof(*density));
+
+        if (!density) {
+            return -1;
+        } /* if */
+
+        smoke_density(density, n);
+        set_elems(&box.min, -1.5f, -0.5f, -2.8f);
+        set_elems(&box.max, 1.5f, 2.5f, -0.2f);
+        set_elems(&albedo, 0.7f, 0.7f, 0.75f);
+        media[1] = create_grid_medium(&box, n, n, n, density, 12.0f, &albedo,
+                                      0.5f);
+        free(density);
+
+        if (!media[1] || add_medium(world, media[1]) < 0) {
+            return -1;
+        } /* if */
+    } /* if */
+
+    return 0;
+}
+
+/**
+ * Adds signed distance shapes on either side of the center sphere: a rounded
+ * box blended into a sphere on the left and a mandelbulb on the right
+ * @param world The scene
+ * @return 0 on success, -1 if the shapes could not be added
+ */
+static int
+build_sdfs(scene *world)
+{
+    material mat;
+    sdf shape;
+    vec3 v1, v2;
+    int err = 0;
+
+    set_elems(&v1, 0.8f, 0.5f, 0.3f);
+    make_lambertian(&mat, &v1);
+    make_sdf(&shape, 0.2f, add_material(world, &mat));
+    set_elems(&v1, -1.3f, -0.25f, -1.4f);
+    set_elems(&v2, 0.25f, 0.12f, 0.25f);
+    err |= sdf_add_rounded_box(&shape, &v1, &v2, 0.08f);
+    set_elems(&v1, -1.3f, 0.1f, -1.4f);
+    err |= sdf_add_sphere(&shape, &v1, 0.2f);
+    err |= shape.material < 0 || add_sdf(world, &shape) < 0;
+
+    set_elems(&v1, 0.4f, 0.5f, 0.8f);
+    make_lambertian(&mat, &v1);
+    make_sdf(&shape, 0, add_material(world, &mat));
+    set_elems(&v1, 1.3f, 0.05f, -1.5f);
+    err |= sdf_add_mandelbulb(&shape, &v1, 0.45f, 8.0f);
+    err |= shape.material < 0 || add_sdf(world, &shape) < 0;
+
+    return err ? -1 : 0;
+}
+
+/**
+ * Adds a glass ball hovering below and to the left of the sphere light, so
+ * it focuses the light into a caustic on the ground
+ * @param world The scene
+ * @return 0 on success, -1 if the ball could not be added
+ */
+static int
+build_glass(scene *world)
+{
+    material mat;
+    vec3 center;
+    int glass;
+
+    make_dielectric(&mat, 1.5f);
+    glass = add_material(world, &mat);
+    set_elems(&center, 0.86f, -0.15f, -1.0f);
+
+    return glass < 0 || add_sphere(world, &center, 0.2f, glass) < 0 ? -1 : 0;
+}
+
+/**
+ * Scatters the clutter over a grid of group files instead of the scene, in
+ * the same area add_random_spheres uses. Each cell is generated and written
+ * on its own, so only one cell of spheres is ever in memory, and the groups
+ * are then opened with nothing but their headers read
+ * @param world The scene
+ * @param cache The cache to open the groups in
+ * @param dir The directory receiving the group files
+ * @param num_spheres The number of small spheres to scatter
+ * @param seed The seed for their placement
+ * @param hop The highest a sphere rises, 0 for static spheres
+ * @param layout The node layout of the group hierarchies
+ * @return 0 on success, -1 if a group could not be written or opened
+ */
+static int
+build_groups(scene *world, group_cache *cache, const char *dir,
+             long num_spheres, uint64_t seed, float hop,
+             enum bvh_layout layout)
+{
+    const int cells = GROUP_CELLS * GROUP_CELLS;
+    char path[4096];
+    sphere *spheres;
+    material mat;
+    vec3 albedo;
+    group *g;
+    rng gen;
+    int c, k, count, clutter;
+
+    set_elems(&albedo, 0.6f, 0.6f, 0.6f);
+    make_lambertian(&mat, &albedo);
+    clutter = add_material(world, &mat);
+    spheres = malloc((size_t)(num_spheres / cells + 1) * sizeof(*spheres));
+
+    if (clutter < 0 || !spheres) {
+        free(spheres);
+        return -1;
+    } /* if */
+
+    for (c = 0; c < cells; c++) {
+        float x0 = -6.0f + 12.0f * (float)(c % GROUP_CELLS) / GROUP_CELLS;
+        float z0 = -0.5f - 8.0f * (float)(c / GROUP_CELLS) / GROUP_CELLS;
+
+        count = (int)(num_spheres * (c + 1) / cells - num_spheres * c / cells);
+        seed_rng(&gen, seed, 0x6209 + (uint64_t)c);
+
+        for (k = 0; k < count; k++) {
+            sphere *sp = &spheres[k];
+
+            sp->radius = 0.02f + 0.06f * rng_float(&gen);
+            set_elems(&sp->center,
+                      x0 + 12.0f / GROUP_CELLS * rng_float(&gen),
+                      -0.5f + sp->radius,
+                      z0 - 8.0f / GROUP_CELLS * rng_float(&gen));
+            set_elems(&sp->motion, 0, hop * rng_float(&gen), 0);
+            sp->material = clutter;
+        } /* for */
+
+        snprintf(path, sizeof(path), "%s/clutter_%03d.rtg", dir, c);
+
+        if (write_group(path, spheres, count, layout) != 0
+            || !(g = open_group(cache, path)) || add_group(world, g) < 0) {
+            free(spheres);
+            return -1;
+        } /* if */
+    } /* for */
+
+    free(spheres);
+
+    return 0;
+}
+
+/* Prints the command line options */
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --width N          Image width (default 200)\n"
+            "  --height N         Image height (default 100)\n"
+            "  --spp N            Samples per pixel to reach (default 64)\n"
+            "  --seed N           Random seed for a new render (default 1)\n"
+            "  --output FILE      Output image (default render.ppm)\n"
+            "  --checkpoint FILE  Checkpoint file (default render.ckpt)\n"
+            "  --interval SECS    Seconds between checkpoints (default 60,\n"
+            "                     0 disables periodic checkpoints)\n"
+            "  --resume           Continue from the checkpoint file\n"
+            "  --texture FILE     Binary ppm mapped onto the center sphere\n"
+            "  --texture-budget MB  Texture tile memory budget (default 64)\n"
+            "  --spheres N        Scatter N small spheres on the ground\n"
+            "  --groups DIR       Write the spheres to group files in DIR and\n"
+            "                     load each when a ray first reaches it\n"
+            "  --geometry-budget MB  Group memory budget (default 256)\n"
+            "  --accel LAYOUT     binary, bvh4, bvh8 or cbvh8 (default bvh4)\n"
+            "  --lights           Add a sphere light and a quad light\n"
+            "  --sdf              Add a blended rounded box and a mandelbulb\n"
+            "  --glass            Add a glass ball below the sphere light\n"
+            "  --motion           Move spheres during the shutter interval\n"
+            "  --fog              Fill the view with thin fog\n"
+            "  --smoke            Add a smoke plume behind the center sphere\n"
+            "  --no-sky           Turn the sky gradient off\n"
+            "  --no-nee           Only find lights by chance, no light sampling\n"
+            "  --max-depth N      Most bounces per path (default 8)\n"
+            "  --radiance-cache   End paths early with cached diffuse light\n"
+            "  --cache-depth N    Bounces before cache lookups (default 1)\n"
+            "  --photons N        Emit N photons for a caustic photon map\n"
+            "  --sampler NAME     random, sobol or bluenoise (default sobol)\n"
+            "  --threads N        Worker threads (default one per processor)\n"
+            "  --ray-order ORDER  depth, wavefront or sorted (default depth)\n"
+            "  --raster           Resolve camera rays with a raster pass\n"
+            "  --numa             Pin workers per NUMA node and report each\n"
+            "  --replicate        With --numa, copy the scene to every node\n"
+            "  --preview PATH     Stream P6 preview frames to a named pipe or\n"
+            "                     unix socket (created as a pipe if missing)\n"
+            "  --preview-interval MS  Milliseconds between frames (default\n"
+            "                     500)\n"
+            "  --preview-width N  Widest preview frame (default 320)\n",
+            prog);
+}
+
+/* Folds a string into a 64-bit FNV-1a hash */
+static uint64_t
+hash_string(uint64_t h, const char *s)
+{
+    while (*s) {
+        h = (h ^ (unsigned char)*s++) * 0x100000001b3u;
+    } /* while */
+
+    return h;
+}
+
+/* Parses a non-negative integer option no larger than max, the largest
+ * value the variable it ends up in can hold */
+static long
+parse_count(const char *prog, const char *opt, const char *arg,
+            unsigned long max)
+{
+    char *end;
+    long value;
+
+    if (!arg) {
+        fprintf(stderr, "%s needs a value\n", opt);
+        usage(prog);
+        exit(EXIT_FAILURE);
+    } /* if */
+
+    errno = 0;
+    value = strtol(arg, &end, 10);
+
+    if (errno || *end || value < 0 || (unsigned long)value > max) {
+        fprintf(stderr, "Invalid value for %s: %s\n", opt, arg);
+        exit(EXIT_FAILURE);
+    } /* if */
+
+    return value;
+}
+
+int
+main(int argc, char **argv)
+{
+    int a;
+    int nx = 200;
+    int ny = 100;
+    long spp = 64;
+    long threads = 0;
+    uint64_t seed = 1;
+    bool resume = false;
+    char *filename = "render.ppm";
+    char *checkpoint_file = "render.ckpt";
+    char *texture_file = NULL;
+    long texture_budget = 64;
+    texture_cache *textures = NULL;
+    texture_stats tex_stats;
+    long num_spheres = 0;
+    char *group_dir = NULL;
+    long group_budget = 256;
+    group_cache *groups = NULL;
+    group_stats grp_stats;
+    enum bvh_layout layout = BVH_WIDE4;
+    bool lights = false;
+    bool motion = false;
+    bool fog = false;
+    bool smoke = false;
+    bool shapes = false;
+    bool glass = false;
+    medium *media[2] = {NULL, NULL};
+    bool sky = true;
+    bool light_sampling = true;
+    scene *world;
+    texture *sphere_texture = NULL;
+    render_desc desc;
+    render_job *job;
+    render_progress progress;
+    enum render_status status;
+    checkpoint_timer timer = {NULL, 60, 0};
+    preview_timer preview = {NULL, 500, {0, 0}};
+    pass_hooks hooks = {&timer, &preview};
+    char *preview_path = NULL;
+    long preview_width = 320;
+    framebuffer *fb;
+    long max_depth = 8;
+    bool use_cache = false;
+    long cache_depth = 1;
+    radiance_cache *cache = NULL;
+    size_t cache_used, cache_total;
+    long photons = 0;
+    render_photon_stats photon_stats;
+    enum sampler_type sampler_kind = SAMPLER_SOBOL;
+    bool sampler_given = false;
+    char scene_options[256];
+    uint64_t options;
+    enum ray_order order = RAY_ORDER_DEPTH_FIRST;
+    bool numa = false;
+    bool replicate = false;
+    bool raster = false;
+    render_node_stats node_stats;
+    struct timespec started, ended;
+    double wall;
+    struct timespec poll_delay = {0, 50000000};
+
+    for (a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--width") == 0) {
+            nx = (int)parse_count(argv[0], argv[a], argv[a + 1], INT_MAX);
+            a++;
+        } else if (strcmp(argv[a], "--height") == 0) {
+            ny = (int)parse_count(argv[0], argv[a], argv[a + 1], INT_MAX);
+            a++;
+        } else if (strcmp(argv[a], "--spp") == 0) {
+            spp = parse_count(argv[0], argv[a], argv[a + 1], UINT32_MAX);
+            a++;
+        } else if (strcmp(argv[a], "--seed") == 0) {
+            seed = (uint64_t)parse_count(argv[0], argv[a], argv[a + 1],
+                                         LONG_MAX);
+            a++;
+        } else if (strcmp(argv[a], "--output") == 0 && a + 1 < argc) {
+            filename = argv[++a];
+        } else if (strcmp(argv[a], "--checkpoint") == 0 && a + 1 < argc) {
+            checkpoint_file = argv[++a];
+        } else if (strcmp(argv[a], "--interval") == 0) {
+            timer.interval = parse_count(argv[0], argv[a], argv[a + 1],
+                                         LONG_MAX);
+            a++;
+        } else if (strcmp(argv[a], "--preview") == 0 && a + 1 < argc) {
+            preview_path = argv[++a];
+        } else if (strcmp(argv[a], "--preview-interval") == 0) {
+            preview.interval = parse_count(argv[0], argv[a], argv[a + 1],
+                                           LONG_MAX);
+            a++;
+        } else if (strcmp(argv[a], "--preview-width") == 0) {
+            preview_width = parse_count(argv[0], argv[a], argv[a + 1], INT_MAX);
+            a++;
+        } else if (strcmp(argv[a], "--resume") == 0) {
+            resume = true;
+        } else if (strcmp(argv[a], "--texture") == 0 && a + 1 < argc) {
+            texture_file = argv[++a];
+        } else if (strcmp(argv[a], "--spheres") == 0) {
+            num_spheres = parse_count(argv[0], argv[a], argv[a + 1], INT_MAX);
+            a++;
+        } else if (strcmp(argv[a], "--groups") == 0 && a + 1 < argc) {
+            group_dir = argv[++a];
+        } else if (strcmp(argv[a], "--accel") == 0 && a + 1 < argc) {
+            if (parse_bvh_layout(argv[++a], &layout) != 0) {
+                fprintf(stderr, "Unknown layout %s\n", argv[a]);
+                exit(EXIT_FAILURE);
+            } /* if */
+        } else if (strcmp(argv[a], "--lights") == 0) {
+            lights = true;
+        } else if (strcmp(argv[a], "--sdf") == 0) {
+            shapes = true;
+        } else if (strcmp(argv[a], "--glass") == 0) {
+            glass = true;
+        } else if (strcmp(argv[a], "--motion") == 0) {
+            motion = true;
+        } else if (strcmp(argv[a], "--fog") == 0) {
+            fog = true;
+        } else if (strcmp(argv[a], "--smoke") == 0) {
+            smoke = true;
+        } else if (strcmp(argv[a], "--no-sky") == 0) {
+            sky = false;
+        } else if (strcmp(argv[a], "--no-nee") == 0) {
+            light_sampling = false;
+        } else if (strcmp(argv[a], "--max-depth") == 0) {
+            max_depth = parse_count(argv[0], argv[a], argv[a + 1], INT_MAX);
+            a++;
+        } else if (strcmp(argv[a], "--radiance-cache") == 0) {
+            use_cache = true;
+        } else if (strcmp(argv[a], "--cache-depth") == 0) {
+            cache_depth = parse_count(argv[0], argv[a], argv[a + 1], INT_MAX);
+            a++;
+        } else if (strcmp(argv[a], "--photons") == 0) {
+            photons = parse_count(argv[0], argv[a], argv[a + 1], INT_MAX);
+            a++;
+        } else if (strcmp(argv[a], "--sampler") == 0 && a + 1 < argc) {
+            if (parse_sampler_type(argv[++a], &sampler_kind) != 0) {
+                fprintf(stderr, "Unknown sampler %s\n", argv[a]);
+                exit(EXIT_FAILURE);
+            } /* if */
+
+            sampler_given = true;
+        } else if (strcmp(argv[a], "--ray-order") == 0 && a + 1 < argc) {
+            if (parse_ray_order(argv[++a], &order) != 0) {
+                fprintf(stderr, "Unknown ray order %s\n", argv[a]);
+                exit(EXIT_FAILURE);
+            } /* if */
+        } else if (strcmp(argv[a], "--numa") == 0) {
+            numa = true;
+        } else if (strcmp(argv[a], "--replicate") == 0) {
+            replicate = true;
+        } else if (strcmp(argv[a], "--raster") == 0) {
+            raster = true;
+        } else if (strcmp(argv[a], "--threads") == 0) {
+            threads = parse_count(argv[0], argv[a], argv[a + 1], INT_MAX);
+            a++;
+        } else if (strcmp(argv[a], "--texture-budget") == 0) {
+            texture_budget = parse_count(argv[0], argv[a], argv[a + 1],
+                                         SIZE_MAX >> 20);
+            a++;
+        } else if (strcmp(argv[a], "--geometry-budget") == 0) {
+            group_budget = parse_count(argv[0], argv[a], argv[a + 1],
+                                       SIZE_MAX >> 20);
+            a++;
+        } else {
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        } /* if */
+    } /* for */
+
+    /* Everything the samples depend on besides the seed and sampler, so a
+     * resumed render can not mix samples of two different scenes. Options that
+     * only change how fast the image converges are left out */
+    snprintf(scene_options, sizeof(scene_options),
+             "spheres=%ld groups=%d lights=%d sdf=%d glass=%d motion=%d "
+             "fog=%d smoke=%d sky=%d nee=%d depth=%ld cache=%ld photons=%ld "
+             "texture=", num_spheres, group_dir != NULL, lights, shapes,
+             glass, motion, fog, smoke, sky, light_sampling, max_depth,
+             use_cache ? cache_depth : -1, photons);
+    options = hash_string(hash_string(0xcbf29ce484222325u, scene_options),
+                          texture_file ? texture_file : "");
+
+    if (resume) {
+        fb = load_checkpoint(checkpoint_file);
+
+        if (!fb) {
+            perror("Could not load checkpoint. Aborting.\n");
+            exit(EXIT_FAILURE);
+        } /* if */
+
+        /* Mixing patterns would break the stratification of both */
+        if (sampler_given && fb->sampler != sampler_kind) {
+            fprintf(stderr, "Checkpoint was rendered with the %s sampler\n",
+                    sampler_type_name(fb->sampler));
+            exit(EXIT_FAILURE);
+        } /* if */
+
+        if (fb->options != options) {
+            fprintf(stderr, "Checkpoint was rendered with different scene "
+                    "options\n");
+            exit(EXIT_FAILURE);
+        } /* if */
+
+        nx = fb->nx;
+        ny = fb->ny;
+        seed = fb->seed;
+    } else {
+        if (nx <= 0 || ny <= 0) {
+            fprintf(stderr, "Image size must be positive\n");
+            exit(EXIT_FAILURE);
+        } /* if */
+
+        fb = create_framebuffer(nx, ny, seed, sampler_kind);
+
+        if (!fb) {
+            perror("Could not allocate framebuffer. Aborting.\n");
+            exit(EXIT_FAILURE);
+        } /* if */
+
+        fb->options = options;
+    } /* if */
+
+    timer.writer = create_checkpoint_writer(checkpoint_file);
+
+    if (!timer.writer) {
+        perror("Could not create checkpoint writer. Aborting.\n");
+        exit(EXIT_FAILURE);
+    } /* if */
+
+    if (preview_path) {
+        preview.stream = create_preview(preview_path, (int)preview_width);
+
+        if (!preview.stream) {
+            perror("Could not open preview stream. Aborting.\n");
+            exit(EXIT_FAILURE);
+        } /* if */
+    } /* if */
+
+    if (texture_file) {
+        textures = create_texture_cache((size_t)texture_budget << 20);
+        sphere_texture = textures ? open_texture(textures, texture_file)
+                                  : NULL;
+
+        if (!sphere_texture) {
+            fprintf(stderr, "Could not open texture %s. Aborting.\n",
+                    texture_file);
+            exit(EXIT_FAILURE);
+        } /* if */
+    } /* if */
+
+    world = create_scene();
+
+    if (group_dir) {
+        groups = create_group_cache((size_t)group_budget << 20);
+
+        if (!groups || !world
+            || build_groups(world, groups, group_dir, num_spheres, seed,
+                            motion ? 0.25f : 0, layout) != 0) {
+            perror("Could not write geometry groups. Aborting.\n");
+            exit(EXIT_FAILURE);
+        } /* if */
+
+        num_spheres = 0;
+    } /* if */
+
+    if (!world
+        || build_world(world, (int)num_spheres, seed, lights, motion,
+                       sphere_texture) != 0
+        || (shapes && build_sdfs(world) != 0)
+        || (glass && build_glass(world) != 0)
+        || build_media(world, fog, smoke, media) != 0
+        || build_scene(world, layout) != 0) {
+        perror("Could not build scene. Aborting.\n");
+        exit(EXIT_FAILURE);
+    } /* if */
+
+    if (use_cache) {
+        cache = create_radiance_cache(RADIANCE_CACHE_LOG2_CELLS,
+                                      RADIANCE_CACHE_CELL_SIZE);
+
+        if (!cache) {
+            perror("Could not allocate radiance cache. Aborting.\n");
+            exit(EXIT_FAILURE);
+        } /* if */
+    } /* if */
+
+    init_render_desc(&desc, world, ny);
+    desc.settings.cache = cache;
+    desc.settings.cache_depth = (int)cache_depth;
+    desc.settings.max_depth = (int)max_depth;
+    desc.settings.sky = sky;
+    desc.settings.light_sampling = light_sampling;
+    desc.spp = (uint32_t)spp;
+    desc.threads = (int)threads;
+    desc.order = order;
+    desc.numa = numa;
+    desc.replicate = replicate;
+    desc.raster = raster;
+    desc.textures = textures;
+    desc.groups = groups;
+    desc.photons = (int)photons;
+    desc.on_pass = run_pass_hooks;
+    desc.user = &hooks;
+    timer.last = time(NULL);
+    clock_gettime(CLOCK_MONOTONIC, &preview.last);
+
+    signal(SIGINT, handle_interrupt);
+    signal(SIGTERM, handle_interrupt);
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    job = render_submit(&desc, fb);
+
+    if (!job) {
+        perror("Could not start render. Aborting.\n");
+        exit(EXIT_FAILURE);
+    } /* if */
+
+    do {
+        nanosleep(&poll_delay, NULL);
+        render_get_progress(job, &progress);
+
+        if (interrupted) {
+            render_cancel(job);
+        } /* if */
+
+        if (isatty(STDERR_FILENO) && progress.samples_total > 0) {
+            fprintf(stderr, "\rPass %d, %3d%%", progress.pass,
+                    (int)(100 * progress.samples_done
+                          / progress.samples_total));
+        } /* if */
+    } while (progress.status == RENDER_RUNNING);
+
+    status = render_wait(job);
+    clock_gettime(CLOCK_MONOTONIC, &ended);
+    wall = (double)(ended.tv_sec - started.tv_sec)
+           + 1e-9 * (double)(ended.tv_nsec - started.tv_nsec);
+
+    if (isatty(STDERR_FILENO)) {
+        fprintf(stderr, "\n");
+    } /* if */
+
+    /* Even shares of the rays mean the nodes scale */
+    for (a = 0; numa && a < render_node_count(job); a++) {
+        render_get_node_stats(job, a, &node_stats);
+        fprintf(stderr, "Node %d: %d workers%s, %llu samples, %.2f Mrays/s,"
+                " %.2f Mrays/s per worker\n", node_stats.node,
+                node_stats.workers,
+                node_stats.replicated ? ", own scene copy" : "",
+                (unsigned long long)node_stats.samples,
+                1e-6 * (double)node_stats.rays / wall,
+                node_stats.busy > 0
+                    ? 1e-6 * (double)node_stats.rays / node_stats.busy : 0);
+    } /* for */
+
+    if (render_get_photon_stats(job, &photon_stats)) {
+        fprintf(stderr, "Photons: %d emitted, %d stored, traced in %.3f s,"
+                " tree built in %.3f s\n", photon_stats.emitted,
+                photon_stats.stored, photon_stats.emit_time,
+                photon_stats.build_time);
+    } /* if */
+
+    delete_render_job(job);
+
+    /* The viewer always gets to see the finished image */
+    if (preview.stream) {
+        request_preview(preview.stream, fb);
+        delete_preview(preview.stream);
+    } /* if */
+
+    /* The final state is always saved so the spp can be raised later */
+    delete_checkpoint_writer(timer.writer);
+
+    if (save_checkpoint(fb, checkpoint_file) != 0) {
+        perror("Could not write checkpoint");
+    } /* if */
+
+    if (status == RENDER_CANCELLED) {
+        fprintf(stderr, "Interrupted, resume with --resume\n");
+    } /* if */
+
+    if (write_ppm(fb, filename) != 0) {
+        perror("Could not write output image. Aborting.\n");
+        delete_framebuffer(fb);
+        exit(EXIT_FAILURE);
+    } /* if */
+
+    if (textures) {
+        get_texture_stats(textures, &tex_stats);
+        fprintf(stderr, "Textures: %zu tiles loaded, %zu filtered, %zu evicted,"
+                " peak %zu KB of %zu KB\n", tex_stats.tiles_loaded,
+                tex_stats.tiles_filtered, tex_stats.tiles_evicted,
+                tex_stats.bytes_peak >> 10, tex_stats.bytes_budget >> 10);
+
+        if (tex_stats.tiles_failed > 0) {
+            fprintf(stderr, "Warning: %zu texture tiles could not be"
+                    " allocated and were approximated\n",
+                    tex_stats.tiles_failed);
+        } /* if */
+
+        delete_texture_cache(textures);
+    } /* if */
+
+    if (cache) {
+        cache_used = radiance_cache_cells_used(cache, &cache_total);
+        fprintf(stderr, "Radiance cache: %zu of %zu cells used\n",
+                cache_used, cache_total);
+        delete_radiance_cache(cache);
+    } /* if */
+
+    delete_scene(world);
+
+    if (groups) {
+        get_group_stats(groups, &grp_stats);
+        fprintf(stderr, "Groups: %zu opened, %zu loaded, %zu evicted, peak"
+                " %zu KB of %zu KB\n", grp_stats.groups_opened,
+                grp_stats.groups_loaded, grp_stats.groups_evicted,
+                grp_stats.bytes_peak >> 10, grp_stats.bytes_budget >> 10);
+
+        if (grp_stats.groups_failed > 0) {
+            fprintf(stderr, "Warning: %zu groups could not be mapped and were"
+                    " left out of the image\n", grp_stats.groups_failed);
+        } /* if */
+
+        delete_group_cache(groups);
+    } /* if */
+
+    delete_medium(media[0]);
+    delete_medium(media[1]);
+    delete_framebuffer(fb);
+
+    return 0;
+}
+/* EOF */
@@ -0,0 +1,968 @@
+#include <float.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/raster.h"
+#include "../include/raysort.h"
+#include "../include/renderer.h"
+
+#define TILE_PIXELS (RENDER_TILE_SIZE * RENDER_TILE_SIZE)
+
+/* Photons a worker emits at a time */
+#define PHOTON_RUN 4096
+
+/* What the workers are doing in the current generation */
+enum job_phase
+{
+    PHASE_EMIT,         /* Tracing runs of photons */
+    PHASE_BUILD,        /* Building subtrees of the photon map */
+    PHASE_RENDER        /* Rendering a pass, a tile at a time */
+};
+
+typedef struct worker_t worker;
+
+/* One thread of the pool */
+struct worker_t
+{
+    render_job *job;
+    pthread_t thread;
+    texture_context *tex_ctx;
+    group_context *group_ctx;
+    int node;
+    bool leader;                /* Prepares the node before the first pass */
+    render_settings rs;         /* Points at the node's scene copy */
+
+    atomic_uint_fast64_t samples;
+    atomic_uint_fast64_t rays;
+    atomic_uint_fast64_t busy_ns;
+
+    /* Wavefront buffers, one path per pixel of a tile */
+    path_state *paths;
+    uint32_t *keys;
+    uint32_t *active;
+    uint32_t *scratch;
+
+    /* Visibility buffer of the tile being rendered, and the pixel of each
+     * path in it */
+    raster_pixel *pixels;
+    uint32_t *path_pixel;
+};
+
+struct render_job_t
+{
+    render_desc desc;
+    framebuffer *fb;
+    sampler smp;
+    int tiles_x, num_tiles;
+    worker *workers;
+    raster_bins *bins;          /* Set when primary hits are rasterized */
+    photon_map *photons;        /* Set when desc.photons is and the scene
+                                 * has lights */
+    int num_tasks;              /* Photon runs or subtrees of the phase */
+    atomic_int next_task;
+    double emit_time, build_time;
+
+    /* Each node owns a band of tile rows and steals once it is done */
+    numa_topology topo;
+    int num_nodes;
+    int first_tile[NUMA_MAX_NODES + 1];
+    atomic_int next_tile[NUMA_MAX_NODES];
+    scene *replicas[NUMA_MAX_NODES];
+
+    int num_workers;
+    pthread_t coordinator;
+    bool joined;
+
+    /* Pass hand off between the coordinator and the workers */
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    int generation;             /* Bumped to start a pass */
+    int idle;                   /* Workers done with the current pass */
+    bool quit;
+
+    atomic_int phase;
+    atomic_bool sampled;        /* Whether the current pass took a sample */
+    atomic_bool cancelled;
+    atomic_int pass;
+    atomic_int status;
+    atomic_uint_fast64_t samples_done;
+    atomic_uint_fast64_t rays;
+    uint64_t samples_total;
+};
+
+/* Sets up a description with the chapter defaults */
+void
+init_render_desc(render_desc *desc, const scene *world, int ny)
+{
+    camera *cam = &desc->cam;
+
+    zero_out_vector(&cam->origin);
+    set_elems(&cam->lower_left, -2.0f, -1.0f, -1.0f);
+    set_elems(&cam->horizontal, 4.0f, 0, 0);
+    set_elems(&cam->vertical, 0, 2.0f, 0);
+    cam->shutter_open = 0;
+    cam->shutter_close = 1.0f;
+
+    desc->settings.world = world;
+    desc->settings.groups = NULL;
+    desc->settings.pixel_spread = get_y(&cam->vertical) / (float)ny;
+    desc->settings.max_depth = 8;
+    desc->settings.light_sampling = true;
+    desc->settings.sky = true;
+    desc->settings.cache = NULL;
+    desc->settings.cache_depth = 1;
+    desc->settings.photons = NULL;
+    desc->spp = 64;
+    desc->threads = 0;
+    desc->order = RAY_ORDER_DEPTH_FIRST;
+    desc->numa = false;
+    desc->replicate = false;
+    desc->raster = false;
+    desc->textures = NULL;
+    desc->groups = NULL;
+    desc->photons = 0;
+    desc->on_tile = NULL;
+    desc->on_pass = NULL;
+    desc->user = NULL;
+}
+
+/* Gets a monotonic time stamp in nanoseconds */
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Starts the path of the next sample of a pixel */
+static void
+start_pixel_path(render_job *job, worker *w, int i, int j, uint32_t index,
+                 path_state *path)
+{
+    const camera *cam = &job->desc.cam;
+    framebuffer *fb = job->fb;
+    float u, v, x, y, z, t;
+    vec3 from, dir;
+    ray r;
+
+    u = ((float)i + get_sample(&job->smp, i, j, index, SAMPLE_DIM_PIXEL))
+        / (float)fb->nx;
+    v = ((float)j + get_sample(&job->smp, i, j, index, SAMPLE_DIM_PIXEL + 1))
+        / (float)fb->ny;
+    x = get_x(&cam->lower_left) + u * get_x(&cam->horizontal)
+        + v * get_x(&cam->vertical);
+    y = get_y(&cam->lower_left) + u * get_y(&cam->horizontal)
+        + v * get_y(&cam->vertical);
+    z = get_z(&cam->lower_left) + u * get_z(&cam->horizontal)
+        + v * get_z(&cam->vertical);
+
+    set_elems(&dir, x, y, z);
+    subtract_vec(&dir, &dir, &cam->origin);
+    from = cam->origin;
+    set_ray_vectors(&r, &from, &dir);
+    t = get_sample(&job->smp, i, j, index, SAMPLE_DIM_TIME);
+    set_ray_time(&r, cam->shutter_open
+                     + t * (cam->shutter_close - cam->shutter_open));
+    start_path(&w->rs, &r, (uint32_t)i, (uint32_t)j, index, path);
+}
+
+/* Traces a path's current ray and advances it */
+static void
+step_path(render_job *job, worker *w, path_state *path)
+{
+    hit_record rec;
+
+    extend_path(&w->rs, &job->smp, w->tex_ctx, path,
+                path_hit(&w->rs, path, &rec) ? &rec : NULL);
+}
+
+/* Advances a path past the first hit the visibility buffer found for it */
+static void
+step_primary(render_job *job, worker *w, path_state *path, int prim)
+{
+    vec3 o = path->o, d = path->d;
+    hit_record rec;
+    ray r;
+
+    set_ray_vectors(&r, &o, &d);
+    set_ray_time(&r, path->time);
+    extend_path(&w->rs, &job->smp, w->tex_ctx, path,
+                prim >= 0 && hit_scene_prim(w->rs.world, prim, &r, 0.001f,
+                                            FLT_MAX, &rec) ? &rec : NULL);
+}
+
+/* Adds the result of a finished path to its pixel */
+static void
+finish_path(render_job *job, const path_state *path)
+{
+    vec3 col = path->radiance;
+
+    /* One bad sample would otherwise poison the pixel for good */
+    if (!isfinite(get_r(&col)) || !isfinite(get_g(&col))
+        || !isfinite(get_b(&col))) {
+        zero_out_vector(&col);
+    } /* if */
+
+    add_sample(job->fb, (int)path->x, (int)path->y, &col);
+}
+
+/* Traces the paths of a tile bounce by bounce, optionally sorting each bounce
+ * so rays heading the same way from nearby points are traced together */
+static uint64_t
+trace_wavefront(render_job *job, worker *w, int count)
+{
+    const aabb *bounds = &w->rs.world->bounds;
+    bool sort = job->desc.order == RAY_ORDER_SORTED;
+    uint64_t rays = 0;
+    int bounce, k, n;
+
+    for (bounce = 0; ; bounce++) {
+        for (k = 0, n = 0; k < count; k++) {
+            if (w->paths[k].active) {
+                w->active[n++] = (uint32_t)k;
+            } /* if */
+        } /* for */
+
+        if (n == 0) {
+            break;
+        } /* if */
+
+        /* Camera rays are coherent already */
+        if (sort && bounce > 0) {
+            for (k = 0; k < n; k++) {
+                const path_state *path = &w->paths[w->active[k]];
+
+                w->keys[k] = ray_sort_key(bounds, &path->o, &path->d);
+            } /* for */
+
+            sort_rays(w->keys, w->active, w->scratch, n);
+        } /* if */
+
+        for (k = 0; k < n; k++) {
+            step_path(job, w, &w->paths[w->active[k]]);
+        } /* for */
+
+        rays += (uint64_t)n;
+    } /* for */
+
+    return rays;
+}
+
+/* Starts the paths of a tile, right away tracing them to the end in depth
+ * first order. Returns the number of paths */
+static uint32_t
+start_tile_paths(render_job *job, worker *w, const render_tile *tile,
+                 uint64_t *rays)
+{
+    framebuffer *fb = job->fb;
+    uint32_t taken = 0;
+    path_state path;
+    int i, j;
+
+    for (j = tile->y; j < tile->y + tile->height; j++) {
+        for (i = tile->x; i < tile->x + tile->width; i++) {
+            uint32_t index = pixel_samples(fb, i, j);
+
+            if (index >= job->desc.spp) {
+                continue;
+            } /* if */
+
+            if (job->desc.order == RAY_ORDER_DEPTH_FIRST) {
+                start_pixel_path(job, w, i, j, index, &path);
+
+                for (; path.active; (*rays)++) {
+                    step_path(job, w, &path);
+                } /* for */
+
+                finish_path(job, &path);
+            } else {
+                start_pixel_path(job, w, i, j, index, &w->paths[taken]);
+            } /* if */
+
+            taken++;
+        } /* for */
+    } /* for */
+
+    return taken;
+}
+
+/* Starts the paths of a tile and takes them past their camera rays with a
+ * rasterized visibility buffer. Returns the number of paths */
+static uint32_t
+start_raster_paths(render_job *job, worker *w, int t, const render_tile *tile)
+{
+    framebuffer *fb = job->fb;
+    uint32_t taken = 0, k;
+    int i, j;
+
+    for (j = 0; j < tile->height; j++) {
+        for (i = 0; i < tile->width; i++) {
+            raster_pixel *px = &w->pixels[j * tile->width + i];
+            uint32_t index = pixel_samples(fb, tile->x + i, tile->y + j);
+            path_state *path = &w->paths[taken];
+
+            px->depth = 0;
+
+            if (index >= job->desc.spp) {
+                continue;
+            } /* if */
+
+            start_pixel_path(job, w, tile->x + i, tile->y + j, index, path);
+            px->origin = path->o;
+            px->dir = path->d;
+            px->time = path->time;
+            px->depth = FLT_MAX;
+            w->path_pixel[taken++] = (uint32_t)(j * tile->width + i);
+        } /* for */
+    } /* for */
+
+    if (taken) {
+        raster_tile(job->bins, w->rs.world, t, w->pixels);
+    } /* if */
+
+    for (k = 0; k < taken; k++) {
+        if (w->paths[k].active) {
+            step_primary(job, w, &w->paths[k],
+                         w->pixels[w->path_pixel[k]].prim);
+        } /* if */
+    } /* for */
+
+    return taken;
+}
+
+/* Takes one more sample for every pixel of a tile that needs one */
+static void
+render_tile_pass(render_job *job, worker *w, int t, int pass)
+{
+    framebuffer *fb = job->fb;
+    render_tile tile;
+    uint64_t taken, rays = 0;
+    int k;
+
+    tile.x = (t % job->tiles_x) * RENDER_TILE_SIZE;
+    tile.y = (t / job->tiles_x) * RENDER_TILE_SIZE;
+    tile.width = fb->nx - tile.x < RENDER_TILE_SIZE ? fb->nx - tile.x
+                                                    : RENDER_TILE_SIZE;
+    tile.height = fb->ny - tile.y < RENDER_TILE_SIZE ? fb->ny - tile.y
+                                                     : RENDER_TILE_SIZE;
+
+    if (job->bins) {
+        taken = start_raster_paths(job, w, t, &tile);
+    } else {
+        taken = start_tile_paths(job, w, &tile, &rays);
+    } /* if */
+
+    if (!taken) {
+        return;
+    } /* if */
+
+    if (job->bins && job->desc.order == RAY_ORDER_DEPTH_FIRST) {
+        for (k = 0; k < (int)taken; k++) {
+            for (; w->paths[k].active; rays++) {
+                step_path(job, w, &w->paths[k]);
+            } /* for */
+
+            finish_path(job, &w->paths[k]);
+        } /* for */
+    } else if (job->desc.order != RAY_ORDER_DEPTH_FIRST) {
+        rays = trace_wavefront(job, w, (int)taken);
+
+        for (k = 0; k < (int)taken; k++) {
+            finish_path(job, &w->paths[k]);
+        } /* for */
+    } /* if */
+
+    atomic_store(&job->sampled, true);
+    atomic_fetch_add(&job->samples_done, taken);
+    atomic_fetch_add(&job->rays, rays);
+    atomic_fetch_add(&w->samples, taken);
+    atomic_fetch_add(&w->rays, rays);
+
+    if (job->desc.on_tile) {
+        tile.pass = pass;
+        tile.stride = fb->nx;
+        tile.accum = fb->accum + 3 * ((size_t)tile.y * fb->nx + tile.x);
+        tile.samples = fb->samples + (size_t)tile.y * fb->nx + tile.x;
+        job->desc.on_tile(&tile, job->desc.user);
+    } /* if */
+}
+
+/* Takes the next tile of a pass, from the worker's own node first */
+static int
+next_tile(render_job *job, const worker *w)
+{
+    int k, node, t;
+
+    for (k = 0; k < job->num_nodes; k++) {
+        node = (w->node + k) % job->num_nodes;
+        t = atomic_load(&job->next_tile[node]);
+
+        /* Looking first keeps finished bands from counting up forever */
+        if (t < job->first_tile[node + 1]) {
+            t = atomic_fetch_add(&job->next_tile[node], 1);
+
+            if (t < job->first_tile[node + 1]) {
+                return t;
+            } /* if */
+        } /* if */
+    } /* for */
+
+    return -1;
+}
+
+/* Pins a worker to its node. The node's leader then copies the scene and
+ * faults in the node's band of the framebuffer from there, so those pages end
+ * up in the node's memory */
+static void
+prepare_worker(render_job *job, worker *w)
+{
+    framebuffer *fb = job->fb;
+    size_t row0, row1;
+
+    if (!job->desc.numa) {
+        return;
+    } /* if */
+
+    bind_to_numa_node(&job->topo, w->node);
+
+    if (!w->leader) {
+        return;
+    } /* if */
+
+    if (job->desc.replicate) {
+        job->replicas[w->node] = copy_scene(job->desc.settings.world);
+    } /* if */
+
+    row0 = (size_t)(job->first_tile[w->node] / job->tiles_x)
+           * RENDER_TILE_SIZE;
+    row1 = (size_t)(job->first_tile[w->node + 1] / job->tiles_x)
+           * RENDER_TILE_SIZE;
+    row1 = row1 < (size_t)fb->ny ? row1 : (size_t)fb->ny;
+
+    if (row1 > row0) {
+        touch_pages(fb->accum + 3 * row0 * fb->nx,
+                    3 * (row1 - row0) * fb->nx * sizeof(float));
+        touch_pages(fb->samples + row0 * fb->nx,
+                    (row1 - row0) * fb->nx * sizeof(uint32_t));
+    } /* if */
+}
+
+/* Does a photon run or subtree of the current phase */
+static void
+run_photon_task(render_job *job, worker *w, int phase, int t)
+{
+    const camera *cam = &job->desc.cam;
+
+    if (phase == PHASE_EMIT) {
+        emit_photons(job->photons, w->rs.world, w->rs.groups, t * PHOTON_RUN,
+                     PHOTON_RUN, job->fb->seed, cam->shutter_open,
+                     cam->shutter_close);
+    } else {
+        build_photon_subtree(job->photons, t);
+    } /* if */
+}
+
+/* Pulls tiles off the current pass, or photon tasks off the current phase,
+ * until there are none left */
+static void *
+run_worker(void *arg)
+{
+    worker *w = arg;
+    render_job *job = w->job;
+    int seen = 0, pass, phase, t;
+    uint64_t start;
+
+    prepare_worker(job, w);
+    pthread_mutex_lock(&job->lock);
+
+    if (++job->idle == job->num_workers) {
+        pthread_cond_signal(&job->finished);
+    } /* if */
+
+    pthread_mutex_unlock(&job->lock);
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+
+        while (job->generation == seen && !job->quit) {
+            pthread_cond_wait(&job->start, &job->lock);
+        } /* while */
+
+        if (job->quit) {
+            pthread_mutex_unlock(&job->lock);
+            break;
+        } /* if */
+
+        seen = job->generation;
+        pthread_mutex_unlock(&job->lock);
+        pass = atomic_load(&job->pass);
+        phase = atomic_load(&job->phase);
+        w->rs = job->desc.settings;
+
+        w->rs.groups = w->group_ctx;
+        w->rs.photons = job->photons;
+
+        if (job->replicas[w->node]) {
+            w->rs.world = job->replicas[w->node];
+        } /* if */
+
+        while (phase != PHASE_RENDER && !atomic_load(&job->cancelled)
+               && (t = atomic_fetch_add(&job->next_task, 1))
+                  < job->num_tasks) {
+            start = now_ns();
+            run_photon_task(job, w, phase, t);
+            atomic_fetch_add(&w->busy_ns, now_ns() - start);
+        } /* while */
+
+        while (phase == PHASE_RENDER && !atomic_load(&job->cancelled)
+               && (t = next_tile(job, w)) >= 0) {
+            start = now_ns();
+            render_tile_pass(job, w, t, pass);
+            atomic_fetch_add(&w->busy_ns, now_ns() - start);
+        } /* while */
+
+        pthread_mutex_lock(&job->lock);
+
+        if (++job->idle == job->num_workers) {
+            pthread_cond_signal(&job->finished);
+        } /* if */
+
+        pthread_mutex_unlock(&job->lock);
+    } /* for */
+
+    return NULL;
+}
+
+/* Tells the workers to exit and waits for them */
+static void
+stop_workers(render_job *job, int started)
+{
+    int k;
+
+    pthread_mutex_lock(&job->lock);
+    job->quit = true;
+    pthread_cond_broadcast(&job->start);
+    pthread_mutex_unlock(&job->lock);
+
+    for (k = 0; k < started; k++) {
+        pthread_join(job->workers[k].thread, NULL);
+    } /* for */
+}
+
+/* Starts the workers on a generation and waits until all are done. The
+ * caller must hold the lock */
+static void
+run_generation(render_job *job)
+{
+    job->idle = 0;
+    job->generation++;
+    pthread_cond_broadcast(&job->start);
+
+    while (job->idle < job->num_workers) {
+        pthread_cond_wait(&job->finished, &job->lock);
+    } /* while */
+}
+
+/* Emits the photons and builds the photon map on the workers */
+static void
+run_photon_phases(render_job *job)
+{
+    uint64_t start = now_ns();
+    int tasks;
+
+    pthread_mutex_lock(&job->lock);
+    atomic_store(&job->phase, PHASE_EMIT);
+    atomic_store(&job->next_task, 0);
+    job->num_tasks = (job->desc.photons + PHOTON_RUN - 1) / PHOTON_RUN;
+    run_generation(job);
+    pthread_mutex_unlock(&job->lock);
+    job->emit_time = 1e-9 * (double)(now_ns() - start);
+
+    if (atomic_load(&job->cancelled)) {
+        return;
+    } /* if */
+
+    /* The top of the tree is built here, until there is a subtree for every
+     * worker to start on and some to balance the load */
+    start = now_ns();
+    tasks = prepare_photon_tree(job->photons, 4 * job->num_workers);
+
+    /* Without a tree the caustics are left to the path tracer */
+    if (tasks < 0) {
+        delete_photon_map(job->photons);
+        job->photons = NULL;
+        return;
+    } /* if */
+
+    pthread_mutex_lock(&job->lock);
+    atomic_store(&job->phase, PHASE_BUILD);
+    atomic_store(&job->next_task, 0);
+    job->num_tasks = tasks;
+    run_generation(job);
+    pthread_mutex_unlock(&job->lock);
+    job->build_time = 1e-9 * (double)(now_ns() - start);
+}
+
+/* Runs passes until every pixel has its samples or the job is cancelled */
+static void *
+run_job(void *arg)
+{
+    render_job *job = arg;
+    int pass, node;
+
+    /* Wait until every worker is set up on its node */
+    pthread_mutex_lock(&job->lock);
+
+    while (job->idle < job->num_workers) {
+        pthread_cond_wait(&job->finished, &job->lock);
+    } /* while */
+
+    pthread_mutex_unlock(&job->lock);
+
+    if (job->photons) {
+        run_photon_phases(job);
+    } /* if */
+
+    atomic_store(&job->phase, PHASE_RENDER);
+
+    for (pass = 0; ; pass++) {
+        pthread_mutex_lock(&job->lock);
+        atomic_store(&job->pass, pass);
+
+        for (node = 0; node < job->num_nodes; node++) {
+            atomic_store(&job->next_tile[node], job->first_tile[node]);
+        } /* for */
+
+        atomic_store(&job->sampled, false);
+        run_generation(job);
+        pthread_mutex_unlock(&job->lock);
+
+        if (atomic_load(&job->cancelled) || !atomic_load(&job->sampled)) {
+            break;
+        } /* if */
+
+        if (job->desc.on_pass) {
+            job->desc.on_pass(job->fb, pass, job->desc.user);
+        } /* if */
+    } /* for */
+
+    stop_workers(job, job->num_workers);
+    atomic_store(&job->status,
+                 atomic_load(&job->samples_done) == job->samples_total
+                     ? RENDER_DONE : RENDER_CANCELLED);
+
+    return NULL;
+}
+
+/* Frees a job and whatever its workers hold */
+static void
+free_job(render_job *job)
+{
+    int k;
+
+    for (k = 0; k < job->num_workers; k++) {
+        if (job->workers[k].tex_ctx) {
+            delete_texture_context(job->workers[k].tex_ctx);
+        } /* if */
+
+        delete_group_context(job->workers[k].group_ctx);
+    } /* for */
+
+    for (k = 0; k < job->num_workers; k++) {
+        free(job->workers[k].paths);
+        free(job->workers[k].keys);
+        free(job->workers[k].active);
+        free(job->workers[k].scratch);
+        free(job->workers[k].pixels);
+        free(job->workers[k].path_pixel);
+    } /* for */
+
+    delete_raster_bins(job->bins);
+    delete_photon_map(job->photons);
+
+    for (k = 0; k < job->num_nodes; k++) {
+        delete_scene(job->replicas[k]);
+    } /* for */
+
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->start);
+    pthread_cond_destroy(&job->finished);
+    free(job->workers);
+    free(job);
+}
+
+/* Starts a render in the background */
+render_job *
+render_submit(const render_desc *desc, framebuffer *fb)
+{
+    render_job *job = calloc(1, sizeof(*job));
+    size_t n = (size_t)fb->nx * (size_t)fb->ny;
+    uint64_t done = 0;
+    size_t p;
+    int k, tiles_y;
+
+    if (!job) {
+        return NULL;
+    } /* if */
+
+    job->desc = *desc;
+    job->fb = fb;
+
+    /* The bins only hold spheres and quads, groups and signed distance
+     * shapes need the hierarchy */
+    job->desc.raster = desc->raster && desc->settings.world->num_groups == 0
+                       && desc->settings.world->num_sdfs == 0;
+    job->num_nodes = 1;
+
+    if (desc->numa && discover_numa(&job->topo) == 0) {
+        job->num_nodes = job->topo.num_nodes;
+    } else {
+        job->desc.numa = false;
+    } /* if */
+
+    if (desc->threads > 0) {
+        job->num_workers = desc->threads;
+    } else if (job->desc.numa) {
+        for (k = 0, job->num_workers = 0; k < job->num_nodes; k++) {
+            job->num_workers += job->topo.num_cpus[k];
+        } /* for */
+    } else {
+        job->num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    } /* if */
+
+    job->num_workers = job->num_workers > 0 ? job->num_workers : 1;
+    job->tiles_x = (fb->nx + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    tiles_y = (fb->ny + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    job->num_tiles = job->tiles_x * tiles_y;
+
+    /* Bands of whole tile rows, so nodes only share pages at the seams */
+    for (k = 0; k <= job->num_nodes; k++) {
+        job->first_tile[k] = k * tiles_y / job->num_nodes * job->tiles_x;
+    } /* for */
+
+    for (k = 0; k < job->num_nodes; k++) {
+        atomic_init(&job->next_tile[k], job->first_tile[k]);
+    } /* for */
+
+    job->workers = calloc((size_t)job->num_workers, sizeof(worker));
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->start, NULL);
+    pthread_cond_init(&job->finished, NULL);
+    atomic_init(&job->sampled, false);
+    atomic_init(&job->cancelled, false);
+    atomic_init(&job->pass, 0);
+    atomic_init(&job->phase, PHASE_RENDER);
+    atomic_init(&job->next_task, 0);
+    atomic_init(&job->status, RENDER_RUNNING);
+
+    for (p = 0; p < n; p++) {
+        done += fb->samples[p] < desc->spp ? fb->samples[p] : desc->spp;
+    } /* for */
+
+    atomic_init(&job->samples_done, done);
+    atomic_init(&job->rays, 0);
+    job->samples_total = (uint64_t)n * desc->spp;
+
+    if (job->desc.raster) {
+        job->bins = create_raster_bins(desc->settings.world, &desc->cam,
+                                       fb->nx, fb->ny);
+    } /* if */
+
+    if (desc->photons > 0 && desc->settings.world->num_lights > 0) {
+        job->photons = create_photon_map(desc->photons);
+    } /* if */
+
+    if (!job->workers || (job->desc.raster && !job->bins)
+        || (desc->photons > 0 && desc->settings.world->num_lights > 0
+            && !job->photons)
+        || make_sampler(&job->smp, fb->sampler, (uint32_t)fb->seed) != 0) {
+        job->num_workers = 0;
+        free_job(job);
+        return NULL;
+    } /* if */
+
+    for (k = 0; k < job->num_workers; k++) {
+        worker *w = &job->workers[k];
+
+        w->job = job;
+        w->node = k % job->num_nodes;
+        w->leader = k < job->num_nodes;
+        w->rs = desc->settings;
+        atomic_init(&w->samples, 0);
+        atomic_init(&w->rays, 0);
+        atomic_init(&w->busy_ns, 0);
+
+        if (desc->textures) {
+            w->tex_ctx = create_texture_context(desc->textures);
+        } /* if */
+
+        if (desc->groups) {
+            w->group_ctx = create_group_context(desc->groups);
+        } /* if */
+
+        if (desc->order != RAY_ORDER_DEPTH_FIRST || job->desc.raster) {
+            w->paths = malloc(TILE_PIXELS * sizeof(*w->paths));
+        } /* if */
+
+        if (job->desc.raster) {
+            w->pixels = malloc(TILE_PIXELS * sizeof(*w->pixels));
+            w->path_pixel = malloc(TILE_PIXELS * sizeof(*w->path_pixel));
+        } /* if */
+
+        if (desc->order != RAY_ORDER_DEPTH_FIRST) {
+            w->keys = malloc(TILE_PIXELS * sizeof(*w->keys));
+            w->active = malloc(TILE_PIXELS * sizeof(*w->active));
+            w->scratch = malloc(2 * TILE_PIXELS * sizeof(*w->scratch));
+        } /* if */
+
+        if ((desc->textures && !w->tex_ctx)
+            || (desc->groups && !w->group_ctx)
+            || (desc->order != RAY_ORDER_DEPTH_FIRST
+                && (!w->paths || !w->keys || !w->active || !w->scratch))
+            || (job->desc.raster
+                && (!w->paths || !w->pixels || !w->path_pixel))
+            || pthread_create(&w->thread, NULL, run_worker, w) != 0) {
+            stop_workers(job, k);
+            free_job(job);
+            return NULL;
+        } /* if */
+    } /* for */
+
+    if (pthread_create(&job->coordinator, NULL, run_job, job) != 0) {
+        stop_workers(job, job->num_workers);
+        free_job(job);
+        return NULL;
+    } /* if */
+
+    return job;
+}
+
+/* Asks a job to stop */
+void
+render_cancel(render_job *job)
+{
+    atomic_store(&job->cancelled, true);
+}
+
+/* Gets how far a job has come */
+void
+render_get_progress(render_job *job, render_progress *progress)
+{
+    progress->samples_done = atomic_load(&job->samples_done);
+    progress->samples_total = job->samples_total;
+    progress->rays = atomic_load(&job->rays);
+    progress->pass = atomic_load(&job->pass);
+    progress->status = atomic_load(&job->status);
+}
+
+/* Gets the number of nodes a job runs on */
+int
+render_node_count(render_job *job)
+{
+    return job->num_nodes;
+}
+
+/* Gets what the workers of one node did */
+void
+render_get_node_stats(render_job *job, int node, render_node_stats *stats)
+{
+    int k;
+
+    stats->node = job->desc.numa ? job->topo.id[node] : 0;
+    stats->workers = 0;
+    stats->samples = 0;
+    stats->rays = 0;
+    stats->busy = 0;
+    stats->replicated = job->replicas[node] != NULL;
+
+    for (k = 0; k < job->num_workers; k++) {
+        worker *w = &job->workers[k];
+
+        if (w->node == node) {
+            stats->workers++;
+            stats->samples += atomic_load(&w->samples);
+            stats->rays += atomic_load(&w->rays);
+            stats->busy += 1e-9 * (double)atomic_load(&w->busy_ns);
+        } /* if */
+    } /* for */
+}
+
+/* Gets what the photon pass of a job did */
+bool
+render_get_photon_stats(render_job *job, render_photon_stats *stats)
+{
+    if (!job->photons) {
+        return false;
+    } /* if */
+
+    stats->emitted = photon_map_count(job->photons, &stats->stored);
+    stats->emit_time = job->emit_time;
+    stats->build_time = job->build_time;
+
+    return true;
+}
+
+/* Waits for a job to finish */
+enum render_status
+render_wait(render_job *job)
+{
+    if (!job->joined) {
+        pthread_join(job->coordinator, NULL);
+        job->joined = true;
+    } /* if */
+
+    return atomic_load(&job->status);
+}
+
+/* Waits for a job and deletes it */
+void
+delete_render_job(render_job *job)
+{
+    if (!job) {
+        return;
+    } /* if */
+
+    render_wait(job);
+    free_job(job);
+}
+
+/* Gets the name of a ray order */
+const char *
+ray_order_name(enum ray_order order)
+{
+    switch (order) {
+    case RAY_ORDER_DEPTH_FIRST:
+        return "depth";
+    case RAY_ORDER_WAVEFRONT:
+        return "wavefront";
+    default:
+        return "sorted";
+    } /* switch */
+}
+
+/* Parses a ray order name */
+int
+parse_ray_order(const char *name, enum ray_order *order)
+{
+    if (strcmp(name, "depth") == 0) {
+        *order = RAY_ORDER_DEPTH_FIRST;
+    } else if (strcmp(name, "wavefront") == 0) {
+        *order = RAY_ORDER_WAVEFRONT;
+    } else if (strcmp(name, "sorted") == 0) {
+        *order = RAY_ORDER_SORTED;
+    } else {
+        return -1;
+    } /* if */
+
+    return 0;
+}
+/* EOF */
@@ -0,0 +1,35 @@
+#include "../include/rng.h"
+
+/* Seeds a generator */
+void
+seed_rng(rng *g, uint64_t seed, uint64_t stream)
+{
+    g->state = 0;
+    g->inc = (stream << 1) | 1u;
+    rng_next(g);
+    g->state += seed;
+    rng_next(g);
+}
+
+/* Returns the next 32 random bits */
+uint32_t
+rng_next(rng *g)
+{
+    uint64_t old = g->state;
+    uint32_t xorshifted, rot;
+
+    g->state = old * 6364136223846793005ULL + g->inc;
+    xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    rot = (uint32_t)(old >> 59);
+
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+/* Returns the next random float in [0, 1) */
+float
+rng_float(rng *g)
+{
+    /* Top 24 bits so the result is exactly representable and never 1 */
+    return (float)(rng_next(g) >> 8) * (1.0f / 16777216.0f);
+}
+/* EOF */
@@ -0,0 +1,330 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+
+#include "../include/rng.h"
+#include "../include/sampler.h"
+
+#define MASK_TEXELS (BLUE_NOISE_SIZE * BLUE_NOISE_SIZE)
+#define MASK_SIGMA 1.5f
+
+static float *blue_noise_mask = NULL;
+static pthread_once_t mask_once = PTHREAD_ONCE_INIT;
+
+/* Generator matrix columns of the second Sobol dimension. The first is the
+ * van der Corput sequence, which is just the reversed index */
+static uint32_t sobol_directions[32];
+
+/* Mixes a 32 bit value (lowbias32 by Chris Wellons) */
+static uint32_t
+hash32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+
+    return x;
+}
+
+/* Combines a hash with one more value */
+static uint32_t
+hash_combine(uint32_t h, uint32_t v)
+{
+    return hash32(h ^ (v + 0x9e3779b9u + (h << 6) + (h >> 2)));
+}
+
+/* Reverses the bits of a 32 bit value */
+static uint32_t
+reverse_bits(uint32_t x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+
+    return (x >> 16) | (x << 16);
+}
+
+/* Hash based Owen scramble of a reversed value (Burley 2020). Flipping a bit
+ * only depends on the bits above it, which keeps the sequence stratified */
+static uint32_t
+laine_karras_permutation(uint32_t x, uint32_t seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+
+    return x;
+}
+
+/* Owen scrambles a 32 bit fixed point value */
+static uint32_t
+nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+/* Gets a coordinate of the first two Sobol dimensions as fixed point */
+static uint32_t
+sobol(uint32_t index, uint32_t component)
+{
+    uint32_t x = 0;
+    int bit;
+
+    if (component == 0) {
+        return reverse_bits(index);
+    } /* if */
+
+    for (bit = 0; index; bit++, index >>= 1) {
+        if (index & 1) {
+            x ^= sobol_directions[bit];
+        } /* if */
+    } /* for */
+
+    return x;
+}
+
+/* Converts 32 bit fixed point to a float in [0, 1) */
+static float
+to_unit_float(uint32_t x)
+{
+    return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+/* Adds a point to, or removes it from, the void and cluster energy field */
+static void
+splat_energy(float *energy, const float *kernel, int p, float sign)
+{
+    int px = p % BLUE_NOISE_SIZE, py = p / BLUE_NOISE_SIZE;
+    int x, y;
+
+    for (y = 0; y < BLUE_NOISE_SIZE; y++) {
+        int dy = (y - py) & (BLUE_NOISE_SIZE - 1);
+
+        for (x = 0; x < BLUE_NOISE_SIZE; x++) {
+            int dx = (x - px) & (BLUE_NOISE_SIZE - 1);
+
+            energy[y * BLUE_NOISE_SIZE + x] += sign
+                * kernel[dy * BLUE_NOISE_SIZE + dx];
+        } /* for */
+    } /* for */
+}
+
+/* Finds the set (or unset) texel with the highest (or lowest) energy */
+static int
+find_extreme(const float *energy, const unsigned char *bits, int want_set)
+{
+    int p, best = -1;
+
+    for (p = 0; p < MASK_TEXELS; p++) {
+        if (bits[p] != want_set) {
+            continue;
+        } /* if */
+
+        if (best < 0 || (want_set ? energy[p] > energy[best]
+                                  : energy[p] < energy[best])) {
+            best = p;
+        } /* if */
+    } /* for */
+
+    return best;
+}
+
+/* Builds the shared blue noise mask with the void and cluster method
+ * (Ulichney 1993) and fills in the Sobol directions */
+static void
+build_tables(void)
+{
+    float *kernel = malloc(MASK_TEXELS * sizeof(float));
+    float *energy = calloc(MASK_TEXELS, sizeof(float));
+    float *initial_energy = malloc(MASK_TEXELS * sizeof(float));
+    unsigned char *bits = calloc(MASK_TEXELS, 1);
+    unsigned char *initial = malloc(MASK_TEXELS);
+    float *mask = malloc(MASK_TEXELS * sizeof(float));
+    int x, y, p, rank, ones = 0, placed;
+    rng g;
+
+    sobol_directions[0] = 1u << 31;
+
+    for (x = 1; x < 32; x++) {
+        sobol_directions[x] = sobol_directions[x - 1]
+                              ^ (sobol_directions[x - 1] >> 1);
+    } /* for */
+
+    if (!kernel || !energy || !initial_energy || !bits || !initial
+        || !mask) {
+        goto done;
+    } /* if */
+
+    /* Toroidal gaussian, indexed by offset */
+    for (y = 0; y < BLUE_NOISE_SIZE; y++) {
+        for (x = 0; x < BLUE_NOISE_SIZE; x++) {
+            int dx = x < BLUE_NOISE_SIZE / 2 ? x : BLUE_NOISE_SIZE - x;
+            int dy = y < BLUE_NOISE_SIZE / 2 ? y : BLUE_NOISE_SIZE - y;
+
+            kernel[y * BLUE_NOISE_SIZE + x] =
+                expf(-(float)(dx * dx + dy * dy)
+                     / (2.0f * MASK_SIGMA * MASK_SIGMA));
+        } /* for */
+    } /* for */
+
+    /* Start from white noise covering a tenth of the texels */
+    seed_rng(&g, 0xb1e, 0x0153);
+
+    while (ones < MASK_TEXELS / 10) {
+        p = (int)(rng_next(&g) % MASK_TEXELS);
+
+        if (!bits[p]) {
+            bits[p] = 1;
+            splat_energy(energy, kernel, p, 1.0f);
+            ones++;
+        } /* if */
+    } /* while */
+
+    /* Move the tightest cluster into the largest void until that is a no-op */
+    for (rank = 0; rank < MASK_TEXELS; rank++) {
+        int cluster = find_extreme(energy, bits, 1);
+        int hole;
+
+        bits[cluster] = 0;
+        splat_energy(energy, kernel, cluster, -1.0f);
+        hole = find_extreme(energy, bits, 0);
+        bits[hole] = 1;
+        splat_energy(energy, kernel, hole, 1.0f);
+
+        if (hole == cluster) {
+            break;
+        } /* if */
+    } /* for */
+
+    memcpy(initial, bits, MASK_TEXELS);
+    memcpy(initial_energy, energy, MASK_TEXELS * sizeof(float));
+
+    /* Rank the initial points by removing the tightest clusters first */
+    for (rank = ones - 1; rank >= 0; rank--) {
+        p = find_extreme(energy, bits, 1);
+        bits[p] = 0;
+        splat_energy(energy, kernel, p, -1.0f);
+        mask[p] = (float)rank;
+    } /* for */
+
+    /* Rank the rest by filling the largest voids */
+    memcpy(bits, initial, MASK_TEXELS);
+    memcpy(energy, initial_energy, MASK_TEXELS * sizeof(float));
+
+    for (placed = ones; placed < MASK_TEXELS; placed++) {
+        p = find_extreme(energy, bits, 0);
+        bits[p] = 1;
+        splat_energy(energy, kernel, p, 1.0f);
+        mask[p] = (float)placed;
+    } /* for */
+
+    for (p = 0; p < MASK_TEXELS; p++) {
+        mask[p] = (mask[p] + 0.5f) / (float)MASK_TEXELS;
+    } /* for */
+
+    blue_noise_mask = mask;
+    mask = NULL;
+
+done:
+    free(kernel);
+    free(energy);
+    free(initial_energy);
+    free(bits);
+    free(initial);
+    free(mask);
+}
+
+/* Sets up a sampler */
+int
+make_sampler(sampler *s, enum sampler_type type, uint32_t seed)
+{
+    pthread_once(&mask_once, build_tables);
+
+    s->type = type;
+    s->seed = hash32(seed);
+    s->mask = blue_noise_mask;
+
+    return type == SAMPLER_BLUE_NOISE && !s->mask ? -1 : 0;
+}
+
+/* Gets one sample coordinate */
+float
+get_sample(const sampler *s, uint32_t x, uint32_t y, uint32_t index,
+           uint32_t dim)
+{
+    uint32_t pair = dim >> 1, component = dim & 1;
+    uint32_t h, shuffled, value;
+    float offset, f;
+    int mx, my;
+
+    switch (s->type) {
+    case SAMPLER_SOBOL:
+        /* Every pixel walks the sequence in its own scrambled order, and each
+         * dimension pair gets its own order so pairs stay uncorrelated */
+        h = hash_combine(hash_combine(hash_combine(s->seed, x), y), pair);
+        shuffled = nested_uniform_scramble(index, h);
+        value = sobol(shuffled, component);
+
+        return to_unit_float(nested_uniform_scramble(
+                   value, hash_combine(s->seed, 0x51ab0000u + dim)));
+    case SAMPLER_BLUE_NOISE:
+        /* One scrambled sequence for the whole image, rotated per pixel by a
+         * blue noise value so neighbouring pixels make opposite errors */
+        shuffled = nested_uniform_scramble(index,
+                                           hash_combine(s->seed, pair));
+        value = sobol(shuffled, component);
+        f = to_unit_float(nested_uniform_scramble(
+                value, hash_combine(s->seed, 0x51ab0000u + dim)));
+
+        /* Every dimension reads the mask at its own toroidal shift */
+        h = hash_combine(s->seed, 0xb100u + dim);
+        mx = (int)((x + (h & 0xffffu)) & (BLUE_NOISE_SIZE - 1));
+        my = (int)((y + (h >> 16)) & (BLUE_NOISE_SIZE - 1));
+        offset = s->mask[my * BLUE_NOISE_SIZE + mx];
+        f += offset;
+
+        return f >= 1.0f ? f - 1.0f : f;
+    default:
+        h = hash_combine(hash_combine(hash_combine(s->seed, x), y), index);
+
+        return to_unit_float(hash_combine(h, dim));
+    } /* switch */
+}
+
+/* Gets the name of a sampler type */
+const char *
+sampler_type_name(enum sampler_type type)
+{
+    switch (type) {
+    case SAMPLER_SOBOL:
+        return "sobol";
+    case SAMPLER_BLUE_NOISE:
+        return "bluenoise";
+    default:
+        return "random";
+    } /* switch */
+}
+
+/* Parses a sampler name */
+int
+parse_sampler_type(const char *name, enum sampler_type *type)
+{
+    if (strcmp(name, "random") == 0) {
+        *type = SAMPLER_RANDOM;
+    } else if (strcmp(name, "sobol") == 0) {
+        *type = SAMPLER_SOBOL;
+    } else if (strcmp(name, "bluenoise") == 0) {
+        *type = SAMPLER_BLUE_NOISE;
+    } else {
+        return -1;
+    } /* if */
+
+    return 0;
+}
+/* EOF */
@@ -0,0 +1,540 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/rng.h"
+#include "../include/scene.h"
+
+/* Creates an empty scene */
+scene *
+create_scene(void)
+{
+    return calloc(1, sizeof(scene));
+}
+
+/* Deletes a scene */
+void
+delete_scene(scene *s)
+{
+    if (!s) {
+        return;
+    } /* if */
+
+    delete_bvh(s->accel);
+    delete_bvh(s->group_accel);
+    free(s->spheres);
+    free(s->quads);
+    free(s->sdfs);
+    free(s->materials);
+    free(s->media);
+    free(s->groups);
+    free(s->lights);
+    free(s);
+}
+
+/* Copies an array into a new allocation */
+static void *
+copy_array(const void *src, int count, size_t size)
+{
+    void *dst = malloc((size_t)(count > 0 ? count : 1) * size);
+
+    if (dst && count > 0) {
+        memcpy(dst, src, (size_t)count * size);
+    } /* if */
+
+    return dst;
+}
+
+/* Makes a deep copy of a scene */
+scene *
+copy_scene(const scene *src)
+{
+    scene *s = calloc(1, sizeof(*s));
+
+    if (!s) {
+        return NULL;
+    } /* if */
+
+    *s = *src;
+    s->spheres = copy_array(src->spheres, src->num_spheres, sizeof(sphere));
+    s->quads = copy_array(src->quads, src->num_quads, sizeof(quad));
+    s->sdfs = copy_array(src->sdfs, src->num_sdfs, sizeof(sdf));
+    s->materials = copy_array(src->materials, src->num_materials,
+                              sizeof(material));
+    s->media = copy_array(src->media, src->num_media, sizeof(*src->media));
+    s->groups = copy_array(src->groups, src->num_groups, sizeof(*src->groups));
+    s->lights = copy_array(src->lights, src->num_lights, sizeof(light));
+    s->cap_spheres = src->num_spheres;
+    s->cap_quads = src->num_quads;
+    s->cap_sdfs = src->num_sdfs;
+    s->cap_materials = src->num_materials;
+    s->cap_media = src->num_media;
+    s->cap_groups = src->num_groups;
+    s->accel = src->accel ? copy_bvh(src->accel) : NULL;
+    s->group_accel = src->group_accel ? copy_bvh(src->group_accel) : NULL;
+
+    if (!s->spheres || !s->quads || !s->sdfs || !s->materials || !s->media
+        || !s->groups || !s->lights || (src->accel && !s->accel)
+        || (src->group_accel && !s->group_accel)) {
+        delete_scene(s);
+        return NULL;
+    } /* if */
+
+    return s;
+}
+
+/* Makes room for one more element in a growable array */
+static int
+reserve_one(void **array, int count, int *cap, size_t size)
+{
+    void *grown;
+    int new_cap;
+
+    if (count < *cap) {
+        return 0;
+    } /* if */
+
+    new_cap = *cap ? 2 * *cap : 16;
+    grown = realloc(*array, (size_t)new_cap * size);
+
+    if (!grown) {
+        return -1;
+    } /* if */
+
+    *array = grown;
+    *cap = new_cap;
+
+    return 0;
+}
+
+/* Adds a material to a scene */
+int
+add_material(scene *s, const material *mat)
+{
+    if (reserve_one((void **)&s->materials, s->num_materials,
+                    &s->cap_materials, sizeof(*mat)) != 0) {
+        return -1;
+    } /* if */
+
+    s->materials[s->num_materials] = *mat;
+
+    return s->num_materials++;
+}
+
+/* Adds a sphere to a scene */
+int
+add_sphere(scene *s, const vec3 *center, float radius, int material)
+{
+    sphere *sp;
+
+    if (reserve_one((void **)&s->spheres, s->num_spheres, &s->cap_spheres,
+                    sizeof(*sp)) != 0) {
+        return -1;
+    } /* if */
+
+    sp = &s->spheres[s->num_spheres];
+    sp->center = *center;
+    zero_out_vector(&sp->motion);
+    sp->radius = radius;
+    sp->material = material;
+
+    return s->num_spheres++;
+}
+
+/* Adds a moving sphere to a scene */
+int
+add_moving_sphere(scene *s, const vec3 *center0, const vec3 *center1,
+                  float radius, int material)
+{
+    int k = add_sphere(s, center0, radius, material);
+
+    if (k >= 0) {
+        subtract_vec(&s->spheres[k].motion, center1, center0);
+    } /* if */
+
+    return k;
+}
+
+/* Adds a quad to a scene */
+int
+add_quad(scene *s, const vec3 *corner, const vec3 *edge_u, const vec3 *edge_v,
+         int material)
+{
+    if (reserve_one((void **)&s->quads, s->num_quads, &s->cap_quads,
+                    sizeof(quad)) != 0) {
+        return -1;
+    } /* if */
+
+    make_quad(&s->quads[s->num_quads], corner, edge_u, edge_v, material);
+
+    return s->num_quads++;
+}
+
+/* Adds a signed distance shape to a scene */
+int
+add_sdf(scene *s, const sdf *shape)
+{
+    if (reserve_one((void **)&s->sdfs, s->num_sdfs, &s->cap_sdfs,
+                    sizeof(*shape)) != 0) {
+        return -1;
+    } /* if */
+
+    s->sdfs[s->num_sdfs] = *shape;
+
+    return s->num_sdfs++;
+}
+
+/* Adds a medium to a scene */
+int
+add_medium(scene *s, const medium *m)
+{
+    if (reserve_one((void **)&s->media, s->num_media, &s->cap_media,
+                    sizeof(*s->media)) != 0) {
+        return -1;
+    } /* if */
+
+    s->media[s->num_media] = m;
+
+    return s->num_media++;
+}
+
+/* Adds a group to a scene */
+int
+add_group(scene *s, group *g)
+{
+    if (reserve_one((void **)&s->groups, s->num_groups, &s->cap_groups,
+                    sizeof(*s->groups)) != 0) {
+        return -1;
+    } /* if */
+
+    s->groups[s->num_groups] = g;
+
+    return s->num_groups++;
+}
+
+/* Scatters small spheres over the ground */
+int
+add_random_spheres(scene *s, int count, uint64_t seed, int material,
+                   float hop)
+{
+    rng g;
+    vec3 center, end;
+    int k;
+
+    seed_rng(&g, seed, 0x5ce4e);
+
+    for (k = 0; k < count; k++) {
+        float radius = 0.02f + 0.06f * rng_float(&g);
+
+        set_elems(&center, -6.0f + 12.0f * rng_float(&g), -0.5f + radius,
+                  -0.5f - 8.0f * rng_float(&g));
+
+        /* Static scenes draw the same placements as before */
+        end = center;
+
+        if (hop > 0) {
+            set_elems(&end, get_x(&center),
+                      get_y(&center) + hop * rng_float(&g), get_z(&center));
+        } /* if */
+
+        if (add_moving_sphere(s, &center, &end, radius, material) < 0) {
+            return -1;
+        } /* if */
+    } /* for */
+
+    return 0;
+}
+
+/* Intersects one sphere or signed distance shape of the scene, for the
+ * hierarchy, which holds the shapes after the spheres */
+static bool
+hit_scene_sphere(const void *data, int prim, const ray *r, float t_min,
+                 float t_max, hit_record *rec)
+{
+    const scene *s = data;
+
+    if (prim >= s->num_spheres) {
+        return hit_sdf(&s->sdfs[prim - s->num_spheres], r, t_min, t_max,
+                       rec);
+    } /* if */
+
+    return hit_sphere(&s->spheres[prim], r, t_min, t_max, rec);
+}
+
+/* What the group hierarchy callbacks need */
+struct group_hit_data
+{
+    const scene *s;
+    group_context *ctx;
+};
+
+/* Intersects the spheres of one group, for the group hierarchy */
+static bool
+hit_scene_group(const void *data, int prim, const ray *r, float t_min,
+                float t_max, hit_record *rec)
+{
+    const struct group_hit_data *d = data;
+
+    return hit_group(d->ctx, d->s->groups[prim], r, t_min, t_max, rec);
+}
+
+/* Checks whether one group blocks a ray, for the group hierarchy */
+static bool
+group_blocks(const void *data, int prim, const ray *r, float t_min,
+             float t_max, hit_record *rec)
+{
+    const struct group_hit_data *d = data;
+
+    (void)rec;
+
+    return group_occluded(d->ctx, d->s->groups[prim], r, t_min, t_max);
+}
+
+/* Checks whether a material index refers to an emitter */
+static bool
+is_emissive(const scene *s, int mat)
+{
+    return mat >= 0 && mat < s->num_materials
+           && s->materials[mat].type == MATERIAL_LIGHT;
+}
+
+/* Collects every emissive prim into the light list */
+static int
+collect_lights(scene *s)
+{
+    int k, n = 0;
+
+    free(s->lights);
+    s->lights = malloc((size_t)(s->num_spheres + s->num_quads + 1)
+                       * sizeof(light));
+    s->num_lights = 0;
+
+    if (!s->lights) {
+        return -1;
+    } /* if */
+
+    for (k = 0; k < s->num_spheres; k++) {
+        if (is_emissive(s, s->spheres[k].material)) {
+            s->lights[n].type = LIGHT_SPHERE;
+            s->lights[n++].index = k;
+        } /* if */
+    } /* for */
+
+    for (k = 0; k < s->num_quads; k++) {
+        if (is_emissive(s, s->quads[k].material)) {
+            s->lights[n].type = LIGHT_QUAD;
+            s->lights[n++].index = k;
+        } /* if */
+    } /* for */
+
+    s->num_lights = n;
+
+    return 0;
+}
+
+/* Builds the scene hierarchy */
+int
+build_scene(scene *s, enum bvh_layout layout)
+{
+    aabb *bounds = malloc((size_t)(s->num_spheres + s->num_sdfs + 1)
+                          * sizeof(*bounds));
+    vec3 corner;
+    int k;
+
+    if (!bounds || collect_lights(s) != 0) {
+        free(bounds);
+        return -1;
+    } /* if */
+
+    empty_aabb(&s->bounds);
+
+    for (k = 0; k < s->num_spheres; k++) {
+        sphere_bounds(&s->spheres[k], &bounds[k]);
+        merge_aabb(&s->bounds, &bounds[k]);
+    } /* for */
+
+    /* Shapes sit in the same hierarchy, so rays only march the shapes whose
+     * boxes they pass through */
+    for (k = 0; k < s->num_sdfs; k++) {
+        sdf_bounds(&s->sdfs[k], &bounds[s->num_spheres + k]);
+        merge_aabb(&s->bounds, &bounds[s->num_spheres + k]);
+    } /* for */
+
+    for (k = 0; k < s->num_quads; k++) {
+        const quad *q = &s->quads[k];
+
+        extend_aabb(&s->bounds, &q->corner);
+        add_vec(&corner, &q->corner, &q->edge_u);
+        extend_aabb(&s->bounds, &corner);
+        add_vec(&corner, &corner, &q->edge_v);
+        extend_aabb(&s->bounds, &corner);
+        add_vec(&corner, &q->corner, &q->edge_v);
+        extend_aabb(&s->bounds, &corner);
+    } /* for */
+
+    delete_bvh(s->accel);
+    s->accel = build_bvh(bounds, s->num_spheres + s->num_sdfs, layout);
+    free(bounds);
+    delete_bvh(s->group_accel);
+    s->group_accel = NULL;
+
+    if (!s->accel || s->num_groups == 0) {
+        return s->accel ? 0 : -1;
+    } /* if */
+
+    /* Group bounds come from the group headers, nothing gets loaded here */
+    bounds = malloc((size_t)s->num_groups * sizeof(*bounds));
+
+    if (!bounds) {
+        return -1;
+    } /* if */
+
+    for (k = 0; k < s->num_groups; k++) {
+        group_bounds(s->groups[k], &bounds[k]);
+        merge_aabb(&s->bounds, &bounds[k]);
+    } /* for */
+
+    s->group_accel = build_bvh(bounds, s->num_groups, layout);
+    free(bounds);
+
+    return s->group_accel ? 0 : -1;
+}
+
+/* Finds the closest thing a ray hits */
+bool
+hit_scene(const scene *s, group_context *ctx, const ray *r, float t_min,
+          float t_max, hit_record *rec)
+{
+    bool found = bvh_closest_hit(s->accel, r, t_min, t_max, hit_scene_sphere,
+                                 s, rec);
+    struct group_hit_data d = { s, ctx };
+    int k;
+
+    if (found && rec->prim >= s->num_spheres) {
+        rec->prim += s->num_quads + s->num_groups;
+    } /* if */
+
+    for (k = 0; k < s->num_quads; k++) {
+        if (hit_quad(&s->quads[k], r, t_min, found ? rec->t : t_max, rec)) {
+            rec->prim = s->num_spheres + k;
+            found = true;
+        } /* if */
+    } /* for */
+
+    /* Only groups whose bounds the ray reaches before the closest hit so far
+     * are visited, which is what loads them. The hierarchy reports the group
+     * index as the prim */
+    if (s->group_accel
+        && bvh_closest_hit(s->group_accel, r, t_min, found ? rec->t : t_max,
+                           hit_scene_group, &d, rec)) {
+        rec->prim += s->num_spheres + s->num_quads;
+        found = true;
+    } /* if */
+
+    return found;
+}
+
+/* Intersects a ray with one prim of a scene */
+bool
+hit_scene_prim(const scene *s, int prim, const ray *r, float t_min,
+               float t_max, hit_record *rec)
+{
+    bool found;
+
+    if (prim < s->num_spheres) {
+        found = hit_sphere(&s->spheres[prim], r, t_min, t_max, rec);
+    } else {
+        found = hit_quad(&s->quads[prim - s->num_spheres], r, t_min, t_max,
+                         rec);
+    } /* if */
+
+    if (found) {
+        rec->prim = prim;
+    } /* if */
+
+    return found;
+}
+
+/* Checks whether anything blocks a ray */
+bool
+scene_occluded(const scene *s, group_context *ctx, const ray *r,
+               float t_min, float t_max)
+{
+    struct group_hit_data d = { s, ctx };
+    hit_record rec;
+    int k;
+
+    for (k = 0; k < s->num_quads; k++) {
+        if (hit_quad(&s->quads[k], r, t_min, t_max, &rec)) {
+            return true;
+        } /* if */
+    } /* for */
+
+    if (bvh_any_hit(s->accel, r, t_min, t_max, hit_scene_sphere, s)) {
+        return true;
+    } /* if */
+
+    return s->group_accel
+           && bvh_any_hit(s->group_accel, r, t_min, t_max, group_blocks, &d);
+}
+
+/* Samples where a ray first scatters in the media of a scene */
+int
+scene_sample_media(const scene *s, const ray *r, float t_max, rng *g,
+                   float *t)
+{
+    int k, hit = -1;
+
+    /* Each medium only has to beat the closest collision found so far, the
+     * nearest of independent free flights is the free flight of them all */
+    for (k = 0; k < s->num_media; k++) {
+        if (sample_medium(s->media[k], r, t_max, g, t)) {
+            t_max = *t;
+            hit = k;
+        } /* if */
+    } /* for */
+
+    *t = t_max;
+
+    return hit;
+}
+
+/* Estimates the transmittance of the media of a scene along a ray */
+float
+scene_transmittance(const scene *s, const ray *r, float t_max, rng *g)
+{
+    float transmittance = 1.0f;
+    int k;
+
+    for (k = 0; k < s->num_media && transmittance > 0; k++) {
+        transmittance *= medium_transmittance(s->media[k], r, t_max, g);
+    } /* for */
+
+    return transmittance;
+}
+
+/* Finds the light a hit landed on */
+int
+find_light(const scene *s, const hit_record *rec)
+{
+    enum light_type type = LIGHT_SPHERE;
+    int index = rec->prim;
+    int k;
+
+    if (!is_emissive(s, rec->material)) {
+        return -1;
+    } /* if */
+
+    if (index >= s->num_spheres) {
+        type = LIGHT_QUAD;
+        index -= s->num_spheres;
+    } /* if */
+
+    for (k = 0; k < s->num_lights; k++) {
+        if (s->lights[k].type == type && s->lights[k].index == index) {
+            return k;
+        } /* if */
+    } /* for */
+
+    return -1;
+}
+/* EOF */
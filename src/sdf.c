@@ -0,0 +1,392 @@
+#include <float.h>
+#include <stddef.h>
+#include <tgmath.h>
+
+#include "../include/sdf.h"
+
+/* Offset of the samples the normal is estimated from */
+#define NORMAL_DELTA 5e-4f
+
+/* Radius around its center, in units of its scale, that a mandelbulb fits
+ * in. The classic power 8 bulb reaches about 1.14 */
+#define MANDELBULB_BOUND 1.2f
+
+/* Sets up a shape with no parts */
+void
+make_sdf(sdf *s, float blend, int material)
+{
+    s->num_parts = 0;
+    s->blend = blend;
+    s->material = material;
+}
+
+/* Appends a part to a shape, or returns NULL if it is full */
+static sdf_part *
+add_part(sdf *s, enum sdf_part_type type, const vec3 *center)
+{
+    sdf_part *part;
+
+    if (s->num_parts >= SDF_MAX_PARTS) {
+        return NULL;
+    } /* if */
+
+    part = &s->parts[s->num_parts++];
+    part->type = type;
+    part->center = *center;
+    zero_out_vector(&part->size);
+    part->rounding = 0;
+    part->power = 0;
+
+    return part;
+}
+
+/* Adds a sphere to a shape */
+int
+sdf_add_sphere(sdf *s, const vec3 *center, float radius)
+{
+    sdf_part *part = add_part(s, SDF_PART_SPHERE, center);
+
+    if (!part) {
+        return -1;
+    } /* if */
+
+    set_elems(&part->size, radius, radius, radius);
+
+    return 0;
+}
+
+/* Adds a box with rounded edges to a shape */
+int
+sdf_add_rounded_box(sdf *s, const vec3 *center, const vec3 *half_size,
+                    float rounding)
+{
+    sdf_part *part = add_part(s, SDF_PART_ROUNDED_BOX, center);
+
+    if (!part) {
+        return -1;
+    } /* if */
+
+    part->size = *half_size;
+    part->rounding = rounding;
+
+    return 0;
+}
+
+/* Adds a mandelbulb fractal to a shape */
+int
+sdf_add_mandelbulb(sdf *s, const vec3 *center, float radius, float power)
+{
+    sdf_part *part = add_part(s, SDF_PART_MANDELBULB, center);
+
+    if (!part) {
+        return -1;
+    } /* if */
+
+    set_elems(&part->size, radius, radius, radius);
+    part->power = power;
+
+    return 0;
+}
+
+/* Gets the distance estimate of a mandelbulb of radius 1 at the origin, from
+ * the running derivative of the escape time iteration */
+static float
+mandelbulb_distance(const float p[3], float power)
+{
+    float z[3] = { p[0], p[1], p[2] };
+    float dr = 1.0f, r = 0;
+    float theta, phi, zr, sin_theta;
+    int k;
+
+    for (k = 0; k < SDF_MANDELBULB_ITERATIONS; k++) {
+        r = sqrtf(z[0] * z[0] + z[1] * z[1] + z[2] * z[2]);
+
+        if (r > 2.0f) {
+            break;
+        } /* if */
+
+        /* Points on the center have no direction to raise to a power */
+        if (r < 1e-12f) {
+            return -1e-3f;
+        } /* if */
+
+        theta = acosf(fminf(fmaxf(z[2] / r, -1.0f), 1.0f)) * power;
+        phi = atan2f(z[1], z[0]) * power;
+        zr = powf(r, power - 1.0f);
+        dr = zr * power * dr + 1.0f;
+        zr *= r;
+        sin_theta = sinf(theta);
+        z[0] = zr * sin_theta * cosf(phi) + p[0];
+        z[1] = zr * sin_theta * sinf(phi) + p[1];
+        z[2] = zr * cosf(theta) + p[2];
+    } /* for */
+
+    return 0.5f * logf(fmaxf(r, 1e-12f)) * r / dr;
+}
+
+/* Gets the distance estimate of a power 8 mandelbulb of radius 1 at the
+ * origin. The power is expanded into polynomials, so no trigonometry is
+ * needed. The pole of this form is the y axis rather than z */
+static float
+mandelbulb8_distance(const float p[3])
+{
+    float x = p[0], y = p[1], z = p[2];
+    float m = x * x + y * y + z * z, dr = 1.0f;
+    float x2, x4, y2, y4, z2, z4, k1, k2, k3, k4, nx, ny, nz;
+    int k;
+
+    for (k = 0; k < SDF_MANDELBULB_ITERATIONS && m <= 256.0f; k++) {
+        dr = 8.0f * sqrtf(m * m * m * m * m * m * m) * dr + 1.0f;
+        x2 = x * x;
+        x4 = x2 * x2;
+        y2 = y * y;
+        y4 = y2 * y2;
+        z2 = z * z;
+        z4 = z2 * z2;
+        k3 = x2 + z2;
+        k2 = 1.0f / sqrtf(fmaxf(k3 * k3 * k3 * k3 * k3 * k3 * k3, 1e-30f));
+        k1 = x4 + y4 + z4 - 6.0f * y2 * z2 - 6.0f * x2 * y2 + 2.0f * z2 * x2;
+        k4 = x2 - y2 + z2;
+        nx = p[0] + 64.0f * x * y * z * (x2 - z2) * k4
+                    * (x4 - 6.0f * x2 * z2 + z4) * k1 * k2;
+        ny = p[1] - 16.0f * y2 * k3 * k4 * k4 + k1 * k1;
+        nz = p[2] - 8.0f * y * k4
+                    * (x4 * x4 - 28.0f * x4 * x2 * z2 + 70.0f * x4 * z4
+                       - 28.0f * x2 * z2 * z4 + z4 * z4) * k1 * k2;
+        x = nx;
+        y = ny;
+        z = nz;
+        m = x * x + y * y + z * z;
+    } /* for */
+
+    return 0.25f * logf(fmaxf(m, 1e-30f)) * sqrtf(m) / dr;
+}
+
+/* Gets the signed distance to one part */
+static float
+part_distance(const sdf_part *part, const vec3 *p)
+{
+    float q[3], outside = 0, inside = -FLT_MAX;
+    int k;
+
+    for (k = 0; k < 3; k++) {
+        q[k] = p->e[k] - part->center.e[k];
+    } /* for */
+
+    switch (part->type) {
+    case SDF_PART_SPHERE:
+        return sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2])
+               - part->size.e[0];
+
+    case SDF_PART_ROUNDED_BOX:
+        for (k = 0; k < 3; k++) {
+            q[k] = fabsf(q[k]) - part->size.e[k];
+            outside += fmaxf(q[k], 0) * fmaxf(q[k], 0);
+            inside = fmaxf(inside, q[k]);
+        } /* for */
+
+        return sqrtf(outside) + fminf(inside, 0) - part->rounding;
+
+    case SDF_PART_MANDELBULB:
+        for (k = 0; k < 3; k++) {
+            q[k] /= part->size.e[0];
+        } /* for */
+
+        /* Far from the bulb the distance to its bounding sphere is a cheaper
+         * lower bound than the escape time iteration */
+        outside = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2])
+                  - MANDELBULB_BOUND;
+
+        if (outside > 0.1f) {
+            return outside * part->size.e[0];
+        } /* if */
+
+        if (part->power == 8.0f) {
+            return mandelbulb8_distance(q) * part->size.e[0];
+        } /* if */
+
+        return mandelbulb_distance(q, part->power) * part->size.e[0];
+    } /* switch */
+
+    return FLT_MAX;
+}
+
+/* Gets the signed distance to the surface of a shape */
+float
+sdf_distance(const sdf *s, const vec3 *p)
+{
+    float d = FLT_MAX, a, h;
+    int k;
+
+    for (k = 0; k < s->num_parts; k++) {
+        a = part_distance(&s->parts[k], p);
+
+        if (k == 0 || s->blend <= 0) {
+            d = fminf(d, a);
+            continue;
+        } /* if */
+
+        /* Polynomial smooth minimum, at most blend / 4 below the plain one */
+        h = fmaxf(s->blend - fabsf(a - d), 0) / s->blend;
+        d = fminf(d, a) - 0.25f * h * h * s->blend;
+    } /* for */
+
+    return d;
+}
+
+/* Calculates a box that encloses a shape */
+void
+sdf_bounds(const sdf *s, aabb *box)
+{
+    const sdf_part *part;
+    float grow = s->blend > 0 ? 0.25f * s->blend : 0;
+    aabb part_box;
+    int j, k;
+
+    empty_aabb(box);
+
+    for (j = 0; j < s->num_parts; j++) {
+        part = &s->parts[j];
+
+        for (k = 0; k < 3; k++) {
+            float extent = part->size.e[k] + part->rounding + grow;
+
+            if (part->type == SDF_PART_MANDELBULB) {
+                extent = MANDELBULB_BOUND * part->size.e[0] + grow;
+            } /* if */
+
+            part_box.min.e[k] = part->center.e[k] - extent;
+            part_box.max.e[k] = part->center.e[k] + extent;
+        } /* for */
+
+        merge_aabb(box, &part_box);
+    } /* for */
+}
+
+/* Clips a ray to a box with the slab test, narrowing [*t0, *t1] */
+static bool
+clip_to_box(const aabb *box, const vec3 *o, const vec3 *d, float *t0,
+            float *t1)
+{
+    float inv, near, far, tmp;
+    int k;
+
+    for (k = 0; k < 3; k++) {
+        inv = 1.0f / d->e[k];
+        near = (box->min.e[k] - o->e[k]) * inv;
+        far = (box->max.e[k] - o->e[k]) * inv;
+
+        if (near > far) {
+            tmp = near;
+            near = far;
+            far = tmp;
+        } /* if */
+
+        /* NaN from a zero direction inside the slab leaves the range alone */
+        *t0 = near > *t0 ? near : *t0;
+        *t1 = far < *t1 ? far : *t1;
+
+        if (*t0 > *t1) {
+            return false;
+        } /* if */
+    } /* for */
+
+    return true;
+}
+
+/* Estimates the outward unit normal of a shape from four distance samples at
+ * the corners of a tetrahedron */
+static void
+sdf_normal(const sdf *s, const vec3 *p, vec3 *normal)
+{
+    static const float corners[4][3] = {
+        { 1, -1, -1 }, { -1, -1, 1 }, { -1, 1, -1 }, { 1, 1, 1 }
+    };
+    vec3 q;
+    float d;
+    int j, k;
+
+    zero_out_vector(normal);
+
+    for (j = 0; j < 4; j++) {
+        for (k = 0; k < 3; k++) {
+            q.e[k] = p->e[k] + NORMAL_DELTA * corners[j][k];
+        } /* for */
+
+        d = sdf_distance(s, &q);
+
+        for (k = 0; k < 3; k++) {
+            normal->e[k] += corners[j][k] * d;
+        } /* for */
+    } /* for */
+
+    d = length(normal);
+
+    if (d > 0) {
+        divide_scalar(normal, d);
+    } else {
+        set_elems(normal, 0, 1.0f, 0);
+    } /* if */
+}
+
+/* Intersects a ray with a shape */
+bool
+hit_sdf(const sdf *s, const ray *r, float t_min, float t_max,
+        hit_record *rec)
+{
+    const vec3 *o = origin(r), *d = direction(r);
+    float dlen = length(d), t0 = t_min, t1 = t_max;
+    float omega = SDF_RELAXATION, t, prev_t, dist, prev_dist = FLT_MAX;
+    aabb box;
+    vec3 p;
+    int k;
+
+    sdf_bounds(s, &box);
+
+    if (dlen <= 0 || !clip_to_box(&box, o, d, &t0, &t1)) {
+        return false;
+    } /* if */
+
+    /* Distances are in world units, steps in ray parameters */
+    t = prev_t = t0;
+
+    for (k = 0; k < SDF_MAX_STEPS && t <= t1; k++) {
+        point_at_parameter(r, t, &p);
+        dist = fabsf(sdf_distance(s, &p));
+
+        /* With the unbounding spheres of the last two points apart, the
+         * stretched step may have jumped the surface. Step again from the
+         * last point by the safe distance */
+        if (omega > 1 && dist + prev_dist < (t - prev_t) * dlen) {
+            omega = 1;
+            t = prev_t + prev_dist / dlen;
+            continue;
+        } /* if */
+
+        /* Only a ray closing in on the surface hits it, which keeps rays
+         * leaving a hit point from hitting the surface right away */
+        if (dist < SDF_EPSILON && dist < prev_dist && k > 0) {
+            rec->t = t;
+            sdf_normal(s, &p, &rec->normal);
+
+            /* The point may be just inside, rays leaving it start outside */
+            rec->p = rec->normal;
+            multiply_scalar(&rec->p, 2.0f * SDF_EPSILON
+                                     - sdf_distance(s, &p));
+            add_vec(&rec->p, &rec->p, &p);
+            rec->u = 0.5f + atan2f(get_z(&rec->normal), get_x(&rec->normal))
+                            / (2.0f * (float)M_PI);
+            rec->v = 0.5f + asinf(fminf(fmaxf(get_y(&rec->normal), -1.0f),
+                                        1.0f)) / (float)M_PI;
+            rec->material = s->material;
+            return true;
+        } /* if */
+
+        prev_t = t;
+        prev_dist = dist;
+        t += fmaxf(omega * dist, 0.5f * SDF_EPSILON) / dlen;
+    } /* for */
+
+    return false;
+}
+/* EOF */
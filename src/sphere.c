@@ -0,0 +1,103 @@
+#include <tgmath.h>
+
+#include "../include/sphere.h"
+
+/* Gets where a sphere is at a point in time */
+void
+sphere_center(const sphere *s, float time, vec3 *center)
+{
+    set_elems(center, get_x(&s->center) + time * get_x(&s->motion),
+              get_y(&s->center) + time * get_y(&s->motion),
+              get_z(&s->center) + time * get_z(&s->motion));
+}
+
+/* Finds how far along a ray it hits a sphere */
+bool
+sphere_distance(const sphere *s, const ray *r, float t_min, float t_max,
+                float *t)
+{
+    float a, b, c, discriminant, root, hit;
+    vec3 oc, center;
+
+    sphere_center(s, ray_time(r), &center);
+    subtract_vec(&oc, origin(r), &center);
+
+    a = dot_product(direction(r), direction(r));
+    b = dot_product(&oc, direction(r));
+    c = dot_product(&oc, &oc) - s->radius * s->radius;
+    discriminant = b * b - a * c;
+
+    if (discriminant < 0) {
+        return false;
+    } /* if */
+
+    root = sqrtf(discriminant);
+    hit = (-b - root) / a;
+
+    if (hit <= t_min || hit >= t_max) {
+        hit = (-b + root) / a;
+
+        if (hit <= t_min || hit >= t_max) {
+            return false;
+        } /* if */
+    } /* if */
+
+    *t = hit;
+
+    return true;
+}
+
+/* Intersects a ray with a sphere */
+bool
+hit_sphere(const sphere *s, const ray *r, float t_min, float t_max,
+           hit_record *rec)
+{
+    vec3 center;
+    float t;
+
+    if (!sphere_distance(s, r, t_min, t_max, &t)) {
+        return false;
+    } /* if */
+
+    sphere_center(s, ray_time(r), &center);
+    rec->t = t;
+    point_at_parameter(r, t, &rec->p);
+    subtract_vec(&rec->normal, &rec->p, &center);
+    divide_scalar(&rec->normal, s->radius);
+    sphere_uv(&rec->normal, &rec->u, &rec->v);
+    rec->material = s->material;
+
+    return true;
+}
+
+/* Calculates the bounds of a sphere over its whole motion */
+void
+sphere_bounds(const sphere *s, aabb *box)
+{
+    float r = fabsf(s->radius);
+    vec3 end;
+    aabb swept;
+
+    set_elems(&box->min, get_x(&s->center) - r, get_y(&s->center) - r,
+              get_z(&s->center) - r);
+    set_elems(&box->max, get_x(&s->center) + r, get_y(&s->center) + r,
+              get_z(&s->center) + r);
+
+    /* Linear motion stays inside the box around both end points */
+    sphere_center(s, 1.0f, &end);
+    set_elems(&swept.min, get_x(&end) - r, get_y(&end) - r, get_z(&end) - r);
+    set_elems(&swept.max, get_x(&end) + r, get_y(&end) + r, get_z(&end) + r);
+    merge_aabb(box, &swept);
+}
+
+/* Gets the texture coordinates of a point on a unit sphere */
+void
+sphere_uv(const vec3 *p, float *u, float *v)
+{
+    float phi = atan2f(get_z(p), get_x(p));
+    float theta = asinf(fmaxf(-1.0f, fminf(1.0f, get_y(p))));
+
+    *u = 1.0f - (phi + (float)M_PI) / (2.0f * (float)M_PI);
+    *v = (theta + (float)M_PI / 2.0f) / (float)M_PI;
+}
+/* EOF */
@@ -0,0 +1,690 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+#include <unistd.h>
+
+#include "../include/texture.h"
+
+#define TILE_TEXELS (TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE)
+#define TILE_BYTES (sizeof(tile))
+#define HASH_BUCKETS 4096
+#define MAX_LEVELS 24
+
+typedef struct tile_t tile;
+
+enum tile_state
+{
+    TILE_LOADING,
+    TILE_READY
+};
+
+/* A square block of texels of one mip level, stored as gamma 2 bytes */
+struct tile_t
+{
+    texture *tex;
+    int level, tx, ty;
+    atomic_int refs;
+    int state;
+    tile *hash_next;
+    tile *lru_prev, *lru_next;
+    unsigned char texels[TILE_TEXELS * 3];
+};
+
+struct mip_level
+{
+    int width, height;
+    int tiles_x, tiles_y;
+};
+
+struct texture_t
+{
+    texture_cache *cache;
+    texture *next;
+    int id;
+    int fd;
+    off_t offset;       /* Where the texel data starts in the file */
+    int levels;
+    struct mip_level level[MAX_LEVELS];
+};
+
+struct texture_cache_t
+{
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;
+    tile *buckets[HASH_BUCKETS];
+    tile *lru_head, *lru_tail;  /* Most recently used at the head */
+    texture *textures;
+    int next_id;
+    texture_stats stats;
+    float decode[256];          /* Byte to linear lookup table */
+};
+
+struct texture_context_t
+{
+    texture_cache *cache;
+    tile *front[TEXTURE_FRONT_SIZE];
+};
+
+/* Hashes a tile key */
+static unsigned
+hash_key(int id, int level, int tx, int ty)
+{
+    uint32_t h = (uint32_t)id * 0x9e3779b1u;
+
+    h ^= (uint32_t)level * 0x85ebca77u;
+    h ^= (uint32_t)tx * 0xc2b2ae3du;
+    h ^= (uint32_t)ty * 0x27d4eb2fu;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+
+    return h;
+}
+
+/* Checks whether a tile has the given key */
+static int
+tile_matches(const tile *t, const texture *tex, int level, int tx, int ty)
+{
+    return t->tex == tex && t->level == level && t->tx == tx && t->ty == ty;
+}
+
+/* Unlinks a tile from the LRU list */
+static void
+lru_remove(texture_cache *c, tile *t)
+{
+    if (t->lru_prev) {
+        t->lru_prev->lru_next = t->lru_next;
+    } else {
+        c->lru_head = t->lru_next;
+    } /* if */
+
+    if (t->lru_next) {
+        t->lru_next->lru_prev = t->lru_prev;
+    } else {
+        c->lru_tail = t->lru_prev;
+    } /* if */
+
+    t->lru_prev = t->lru_next = NULL;
+}
+
+/* Links a tile at the most recently used end of the LRU list */
+static void
+lru_push(texture_cache *c, tile *t)
+{
+    t->lru_prev = NULL;
+    t->lru_next = c->lru_head;
+
+    if (c->lru_head) {
+        c->lru_head->lru_prev = t;
+    } else {
+        c->lru_tail = t;
+    } /* if */
+
+    c->lru_head = t;
+}
+
+/* Unlinks a tile from its hash bucket */
+static void
+hash_remove(texture_cache *c, tile *t)
+{
+    tile **link = &c->buckets[hash_key(t->tex->id, t->level, t->tx, t->ty)
+                              % HASH_BUCKETS];
+
+    while (*link != t) {
+        link = &(*link)->hash_next;
+    } /* while */
+
+    *link = t->hash_next;
+}
+
+/* Evicts unpinned tiles, oldest first, until one more tile fits the budget */
+static void
+evict_for_space(texture_cache *c)
+{
+    tile *t = c->lru_tail;
+
+    while (t && c->stats.bytes_used + TILE_BYTES > c->stats.bytes_budget) {
+        tile *prev = t->lru_prev;
+
+        if (atomic_load(&t->refs) == 0 && t->state == TILE_READY) {
+            lru_remove(c, t);
+            hash_remove(c, t);
+            free(t);
+            c->stats.bytes_used -= TILE_BYTES;
+            c->stats.tiles_evicted++;
+        } /* if */
+
+        t = prev;
+    } /* while */
+}
+
+/* Reads a level 0 tile from the image file */
+static void
+load_tile(tile *t)
+{
+    const texture *tex = t->tex;
+    int w = tex->level[0].width;
+    int h = tex->level[0].height;
+    int x0 = t->tx * TEXTURE_TILE_SIZE;
+    int count = w - x0 < TEXTURE_TILE_SIZE ? w - x0 : TEXTURE_TILE_SIZE;
+    int row, y;
+
+    for (row = 0; row < TEXTURE_TILE_SIZE; row++) {
+        off_t at;
+        size_t size = (size_t)count * 3;
+
+        y = t->ty * TEXTURE_TILE_SIZE + row;
+
+        if (y >= h) {
+            break;
+        } /* if */
+
+        at = tex->offset + ((off_t)y * w + x0) * 3;
+
+        /* A short read leaves the rest of the row black */
+        if (pread(tex->fd, t->texels + row * TEXTURE_TILE_SIZE * 3, size, at)
+            != (ssize_t)size) {
+            break;
+        } /* if */
+    } /* for */
+}
+
+static tile *acquire_tile(texture_context *ctx, texture *tex, int level,
+                          int tx, int ty);
+
+/* Gets a stand in for the texels of a tile that could not be allocated: the
+ * average color of the texture if its coarsest mip is in memory, else grey */
+static void
+fallback_texel(texture_cache *c, const texture *tex, unsigned char *out)
+{
+    int level = tex->levels - 1;
+    tile *t;
+
+    out[0] = out[1] = out[2] = 128;
+    pthread_mutex_lock(&c->lock);
+
+    for (t = c->buckets[hash_key(tex->id, level, 0, 0) % HASH_BUCKETS]; t;
+         t = t->hash_next) {
+        if (tile_matches(t, tex, level, 0, 0) && t->state == TILE_READY) {
+            memcpy(out, t->texels, 3);
+            break;
+        } /* if */
+    } /* for */
+
+    pthread_mutex_unlock(&c->lock);
+}
+
+/* Builds a mip tile by box filtering the level below it. The (up to) four
+ * source tiles stay pinned for the whole tile so a tight budget can not evict
+ * them half way through */
+static void
+filter_tile(texture_context *ctx, tile *t)
+{
+    texture *tex = t->tex;
+    const struct mip_level *lv = &tex->level[t->level];
+    const struct mip_level *below = &tex->level[t->level - 1];
+    const float *decode = ctx->cache->decode;
+    tile *src[2][2] = { { NULL, NULL }, { NULL, NULL } };
+    unsigned char fallback[3];
+    bool missing = false;
+    int row, col, k, dx, dy;
+    float sum[3];
+
+    for (dy = 0; dy < 2; dy++) {
+        for (dx = 0; dx < 2; dx++) {
+            if (2 * t->tx + dx < below->tiles_x
+                && 2 * t->ty + dy < below->tiles_y) {
+                src[dy][dx] = acquire_tile(ctx, tex, t->level - 1,
+                                           2 * t->tx + dx, 2 * t->ty + dy);
+                missing |= !src[dy][dx];
+            } /* if */
+        } /* for */
+    } /* for */
+
+    if (missing) {
+        fallback_texel(ctx->cache, tex, fallback);
+    } /* if */
+
+    for (row = 0; row < TEXTURE_TILE_SIZE; row++) {
+        int y = t->ty * TEXTURE_TILE_SIZE + row;
+
+        if (y >= lv->height) {
+            break;
+        } /* if */
+
+        for (col = 0; col < TEXTURE_TILE_SIZE; col++) {
+            int x = t->tx * TEXTURE_TILE_SIZE + col;
+            unsigned char *dst = t->texels
+                                 + (row * TEXTURE_TILE_SIZE + col) * 3;
+
+            if (x >= lv->width) {
+                break;
+            } /* if */
+
+            sum[0] = sum[1] = sum[2] = 0;
+
+            for (dy = 0; dy < 2; dy++) {
+                for (dx = 0; dx < 2; dx++) {
+                    int sx = 2 * x + dx < below->width ? 2 * x + dx
+                                                       : below->width - 1;
+                    int sy = 2 * y + dy < below->height ? 2 * y + dy
+                                                        : below->height - 1;
+                    const tile *s = src[sy / TEXTURE_TILE_SIZE - 2 * t->ty]
+                                       [sx / TEXTURE_TILE_SIZE - 2 * t->tx];
+                    const unsigned char *texel = !s ? fallback
+                        : s->texels
+                          + ((sy % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE
+                             + sx % TEXTURE_TILE_SIZE) * 3;
+
+                    for (k = 0; k < 3; k++) {
+                        sum[k] += decode[texel[k]];
+                    } /* for */
+                } /* for */
+            } /* for */
+
+            /* Averaged in linear space, stored back as gamma 2 */
+            for (k = 0; k < 3; k++) {
+                dst[k] = (unsigned char)(255.0f * sqrtf(0.25f * sum[k])
+                                         + 0.5f);
+            } /* for */
+        } /* for */
+    } /* for */
+
+    for (dy = 0; dy < 2; dy++) {
+        for (dx = 0; dx < 2; dx++) {
+            if (src[dy][dx]) {
+                atomic_fetch_sub(&src[dy][dx]->refs, 1);
+            } /* if */
+        } /* for */
+    } /* for */
+}
+
+/* Finds or creates a tile and returns it with a reference held. Returns
+ * NULL if the tile could not be allocated */
+static tile *
+acquire_tile(texture_context *ctx, texture *tex, int level, int tx, int ty)
+{
+    texture_cache *c = ctx->cache;
+    unsigned bucket = hash_key(tex->id, level, tx, ty) % HASH_BUCKETS;
+    tile *t;
+
+    pthread_mutex_lock(&c->lock);
+
+    for (t = c->buckets[bucket]; t; t = t->hash_next) {
+        if (tile_matches(t, tex, level, tx, ty)) {
+            atomic_fetch_add(&t->refs, 1);
+            lru_remove(c, t);
+            lru_push(c, t);
+
+            while (t->state == TILE_LOADING) {
+                pthread_cond_wait(&c->loaded, &c->lock);
+            } /* while */
+
+            pthread_mutex_unlock(&c->lock);
+            return t;
+        } /* if */
+    } /* for */
+
+    evict_for_space(c);
+
+    t = calloc(1, sizeof(*t));
+
+    if (!t) {
+        c->stats.tiles_failed++;
+        pthread_mutex_unlock(&c->lock);
+        return NULL;
+    } /* if */
+
+    t->tex = tex;
+    t->level = level;
+    t->tx = tx;
+    t->ty = ty;
+    t->state = TILE_LOADING;
+    atomic_init(&t->refs, 1);
+    t->hash_next = c->buckets[bucket];
+    c->buckets[bucket] = t;
+    lru_push(c, t);
+
+    c->stats.bytes_used += TILE_BYTES;
+
+    if (c->stats.bytes_used > c->stats.bytes_peak) {
+        c->stats.bytes_peak = c->stats.bytes_used;
+    } /* if */
+
+    /* The I/O and filtering happen unlocked, other threads only wait if they
+     * want this very tile */
+    pthread_mutex_unlock(&c->lock);
+
+    if (level == 0) {
+        load_tile(t);
+    } else {
+        filter_tile(ctx, t);
+    } /* if */
+
+    pthread_mutex_lock(&c->lock);
+    t->state = TILE_READY;
+
+    if (level == 0) {
+        c->stats.tiles_loaded++;
+    } else {
+        c->stats.tiles_filtered++;
+    } /* if */
+
+    pthread_cond_broadcast(&c->loaded);
+    pthread_mutex_unlock(&c->lock);
+
+    return t;
+}
+
+/* Gets a tile through the context's front cache, NULL if it could not be
+ * allocated */
+static const tile *
+lookup_tile(texture_context *ctx, texture *tex, int level, int tx, int ty)
+{
+    unsigned slot = hash_key(tex->id, level, tx, ty) % TEXTURE_FRONT_SIZE;
+    tile *t = ctx->front[slot];
+
+    if (t && tile_matches(t, tex, level, tx, ty)) {
+        return t;
+    } /* if */
+
+    t = acquire_tile(ctx, tex, level, tx, ty);
+
+    if (!t) {
+        return NULL;
+    } /* if */
+
+    if (ctx->front[slot]) {
+        atomic_fetch_sub(&ctx->front[slot]->refs, 1);
+    } /* if */
+
+    ctx->front[slot] = t;
+
+    return t;
+}
+
+/* Reads one texel as linear rgb, wrapping coordinates around the edges */
+static void
+fetch_texel(texture_context *ctx, texture *tex, int level, int x, int y,
+            float *out)
+{
+    const struct mip_level *lv = &tex->level[level];
+    const float *decode = ctx->cache->decode;
+    const unsigned char *texel;
+    unsigned char fallback[3];
+    const tile *t;
+
+    x %= lv->width;
+    y %= lv->height;
+    x += x < 0 ? lv->width : 0;
+    y += y < 0 ? lv->height : 0;
+
+    t = lookup_tile(ctx, tex, level, x / TEXTURE_TILE_SIZE,
+                    y / TEXTURE_TILE_SIZE);
+
+    if (t) {
+        texel = t->texels + ((y % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE
+                             + x % TEXTURE_TILE_SIZE) * 3;
+    } else {
+        fallback_texel(ctx->cache, tex, fallback);
+        texel = fallback;
+    } /* if */
+
+    out[0] = decode[texel[0]];
+    out[1] = decode[texel[1]];
+    out[2] = decode[texel[2]];
+}
+
+/* Bilinearly samples one mip level */
+static void
+sample_level(texture_context *ctx, texture *tex, int level, float u, float v,
+             float *out)
+{
+    const struct mip_level *lv = &tex->level[level];
+    float x = (u - floorf(u)) * (float)lv->width - 0.5f;
+    float y = (1.0f - (v - floorf(v))) * (float)lv->height - 0.5f;
+    float x0 = floorf(x), y0 = floorf(y);
+    float fx = x - x0, fy = y - y0;
+    float t00[3], t10[3], t01[3], t11[3];
+    int k;
+
+    fetch_texel(ctx, tex, level, (int)x0, (int)y0, t00);
+    fetch_texel(ctx, tex, level, (int)x0 + 1, (int)y0, t10);
+    fetch_texel(ctx, tex, level, (int)x0, (int)y0 + 1, t01);
+    fetch_texel(ctx, tex, level, (int)x0 + 1, (int)y0 + 1, t11);
+
+    for (k = 0; k < 3; k++) {
+        out[k] = (1 - fy) * ((1 - fx) * t00[k] + fx * t10[k])
+                 + fy * ((1 - fx) * t01[k] + fx * t11[k]);
+    } /* for */
+}
+
+/* Creates a tile cache */
+texture_cache *
+create_texture_cache(size_t budget)
+{
+    texture_cache *c = calloc(1, sizeof(*c));
+    int b;
+
+    if (!c) {
+        return NULL;
+    } /* if */
+
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->loaded, NULL);
+    c->stats.bytes_budget = budget;
+
+    for (b = 0; b < 256; b++) {
+        float f = (float)b / 255.0f;
+
+        c->decode[b] = f * f;
+    } /* for */
+
+    return c;
+}
+
+/* Deletes a cache and its textures */
+void
+delete_texture_cache(texture_cache *cache)
+{
+    tile *t, *next;
+    texture *tex, *next_tex;
+
+    if (!cache) {
+        return;
+    } /* if */
+
+    for (t = cache->lru_head; t; t = next) {
+        next = t->lru_next;
+        free(t);
+    } /* for */
+
+    for (tex = cache->textures; tex; tex = next_tex) {
+        next_tex = tex->next;
+        close(tex->fd);
+        free(tex);
+    } /* for */
+
+    pthread_mutex_destroy(&cache->lock);
+    pthread_cond_destroy(&cache->loaded);
+    free(cache);
+}
+
+/* Reads the next integer from a ppm header, skipping comments */
+static int
+read_header_int(FILE *f, int *value)
+{
+    int ch = fgetc(f);
+
+    while (ch != EOF && (isspace(ch) || ch == '#')) {
+        if (ch == '#') {
+            while (ch != EOF && ch != '\n') {
+                ch = fgetc(f);
+            } /* while */
+        } /* if */
+
+        ch = fgetc(f);
+    } /* while */
+
+    if (ch == EOF || !isdigit(ch)) {
+        return -1;
+    } /* if */
+
+    *value = 0;
+
+    while (ch != EOF && isdigit(ch)) {
+        *value = *value * 10 + (ch - '0');
+        ch = fgetc(f);
+    } /* while */
+
+    /* Exactly one whitespace character ends each value */
+    return isspace(ch) ? 0 : -1;
+}
+
+/* Opens a ppm as a lazily loaded texture */
+texture *
+open_texture(texture_cache *cache, const char *filename)
+{
+    int w, h, maxval;
+    char magic[2];
+    texture *tex;
+    FILE *f = fopen(filename, "rb");
+
+    if (!f) {
+        return NULL;
+    } /* if */
+
+    if (fread(magic, 1, 2, f) != 2 || magic[0] != 'P' || magic[1] != '6'
+        || read_header_int(f, &w) || read_header_int(f, &h)
+        || read_header_int(f, &maxval) || w <= 0 || h <= 0
+        || maxval != 255) {
+        fclose(f);
+        return NULL;
+    } /* if */
+
+    tex = calloc(1, sizeof(*tex));
+
+    if (!tex) {
+        fclose(f);
+        return NULL;
+    } /* if */
+
+    tex->cache = cache;
+    tex->offset = ftell(f);
+    fclose(f);
+
+    tex->fd = open(filename, O_RDONLY);
+
+    if (tex->fd < 0) {
+        free(tex);
+        return NULL;
+    } /* if */
+
+    for (tex->levels = 0; tex->levels < MAX_LEVELS; tex->levels++) {
+        struct mip_level *lv = &tex->level[tex->levels];
+
+        lv->width = w;
+        lv->height = h;
+        lv->tiles_x = (w + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+        lv->tiles_y = (h + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+
+        if (w == 1 && h == 1) {
+            tex->levels++;
+            break;
+        } /* if */
+
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    } /* for */
+
+    pthread_mutex_lock(&cache->lock);
+    tex->id = cache->next_id++;
+    tex->next = cache->textures;
+    cache->textures = tex;
+    pthread_mutex_unlock(&cache->lock);
+
+    return tex;
+}
+
+/* Creates a per-thread context */
+texture_context *
+create_texture_context(texture_cache *cache)
+{
+    texture_context *ctx = calloc(1, sizeof(*ctx));
+
+    if (ctx) {
+        ctx->cache = cache;
+    } /* if */
+
+    return ctx;
+}
+
+/* Unpins a context's tiles and deletes it */
+void
+delete_texture_context(texture_context *ctx)
+{
+    int k;
+
+    if (!ctx) {
+        return;
+    } /* if */
+
+    for (k = 0; k < TEXTURE_FRONT_SIZE; k++) {
+        if (ctx->front[k]) {
+            atomic_fetch_sub(&ctx->front[k]->refs, 1);
+        } /* if */
+    } /* for */
+
+    free(ctx);
+}
+
+/* Samples a texture with trilinear filtering */
+void
+sample_texture(texture_context *ctx, texture *tex, float u, float v,
+               float footprint, vec3 *col)
+{
+    const struct mip_level *base = &tex->level[0];
+    float size = (float)(base->width > base->height ? base->width
+                                                    : base->height);
+    float lod = log2f(fmaxf(footprint * size, 1e-8f));
+    float a[3], b[3], f;
+    int level;
+
+    if (lod <= 0) {
+        sample_level(ctx, tex, 0, u, v, a);
+        set_elems(col, a[0], a[1], a[2]);
+        return;
+    } /* if */
+
+    if (lod >= (float)(tex->levels - 1)) {
+        sample_level(ctx, tex, tex->levels - 1, u, v, a);
+        set_elems(col, a[0], a[1], a[2]);
+        return;
+    } /* if */
+
+    level = (int)lod;
+    f = lod - (float)level;
+
+    sample_level(ctx, tex, level, u, v, a);
+    sample_level(ctx, tex, level + 1, u, v, b);
+
+    set_elems(col, a[0] + f * (b[0] - a[0]), a[1] + f * (b[1] - a[1]),
+              a[2] + f * (b[2] - a[2]));
+}
+
+/* Gets a snapshot of the cache counters */
+void
+get_texture_stats(texture_cache *cache, texture_stats *stats)
+{
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
+/* EOF */
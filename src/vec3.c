@@ -335,4 +335,17 @@ entrywise_division_new(const vec3 *first, const vec3 *second)
 
     return vec;
 }
+
+/* Builds an orthonormal basis around a unit normal (Duff et al. 2017) */
+void
+orthonormal_basis(const vec3 *n, vec3 *t, vec3 *b)
+{
+    float sign = copysignf(1.0f, n->e[2]);
+    float a = -1.0f / (sign + n->e[2]);
+    float c = n->e[0] * n->e[1] * a;
+
+    set_elems(t, 1.0f + sign * n->e[0] * n->e[0] * a, sign * c,
+              -sign * n->e[0]);
+    set_elems(b, c, sign + n->e[1] * n->e[1] * a, -n->e[1]);
+}
 /* EOF */
\ No newline at end of file